@@ -25,6 +25,204 @@ va_is_dirty(void *va)
 	return (uvpt[PGNUM(va)] & PTE_D) != 0;
 }
 
+// The block cache keeps at most BCPAGES blocks mapped, besides the
+// superblock and the bitmap blocks, which stay pinned because 'super'
+// and 'bitmap' point straight at them.  bc_slots lists the cached
+// blocks and bc_hand sweeps it CLOCK-style: a block with PTE_A clear is
+// evicted, anything else has PTE_A cleared and gets another turn.
+// Remapping a page to clear PTE_A clears PTE_D as well, so the hand
+// writes dirty blocks back as it passes them.  Pointers into the block
+// map stay good across eviction: touching the block faults it back in.
+
+// Fewest pages the cache may be limited to: one operation can need a
+// few blocks mapped at once (a memmove between two blocks, the indirect
+// block and the directory block holding the File).
+#define BCMINPAGES	16
+#if BCPAGES < BCMINPAGES
+# error "BCPAGES is below BCMINPAGES"
+#endif
+// Most blocks read ahead at once (see bc_readahead)
+#define BCRAMAX		32
+// While eviction is held off, the cache may grow past the budget by
+// a whole file's worth of blocks (see serve_spawn).
+#define BCMAXSLOTS	(BCPAGES + NDIRECT + NINDIRECT + BCMINPAGES + BCRAMAX)
+
+static uint32_t bc_slots[BCMAXSLOTS];
+static size_t bc_nslots;
+static size_t bc_hand;
+static bool bc_held;
+struct CacheStat bc_stats;
+
+// Dirty blocks are written back BCFLUSH_MSEC after the first is marked,
+// or as soon as BCFLUSH_DIRTY are marked, whichever comes first.
+#define BCFLUSH_MSEC	1000
+#define BCFLUSH_DIRTY	512
+
+static uint32_t bc_dirtymap[DISKSIZE / BLKSIZE / 32];
+static uint32_t bc_ndirty;	// Bits set in bc_dirtymap
+static bool bc_flush_pending;
+static uint32_t bc_flush_deadline;
+
+static void bc_flush_bitmap(void);
+
+static bool
+bc_pinned(uint64_t blockno)
+{
+	return blockno < 2 || (super && blockno < 2 + ROUNDUP(super->s_nblocks, BLKBITSIZE) / BLKBITSIZE);
+}
+
+// Write the 'n' blocks from 'blockno' on to disk with one command and
+// clear their PTE_D.  Panics if the disk reports an error, before
+// marking anything clean, as bc_pgfault does for reads.  If 'async' is
+// set, only queues the write: the blocks are marked clean at once and
+// the caller must check ide_wait before relying on them being on disk.
+// Writing to them meanwhile just makes them dirty again.
+static void
+bc_write(uint32_t blockno, uint32_t n, bool async)
+{
+	void *addr = diskaddr(blockno);
+	uint32_t i, b;
+	int r;
+
+#ifndef VMM_GUEST
+	if (async)
+		r = ide_write_async(blockno * BLKSECTS, addr, n * BLKSECTS);
+	else
+		r = ide_write(blockno * BLKSECTS, addr, n * BLKSECTS);
+	if (r < 0)
+		panic("in bc_write, ide_write blocks %08x+%d: %e", blockno, n, r);
+#else
+	if ((r = host_write(blockno * BLKSECTS, addr, n * BLKSECTS)) < 0)
+		panic("in bc_write, host_write blocks %08x+%d: %e", blockno, n, r);
+#endif
+	for (i = 0; i < n; i++) {
+		sys_page_map(0, addr + i * BLKSIZE, 0, addr + i * BLKSIZE,
+			     uvpt[PGNUM(addr + i * BLKSIZE)] & PTE_SYSCALL);
+		b = blockno + i;
+		if (bc_dirtymap[b / 32] & (1 << (b % 32))) {
+			bc_dirtymap[b / 32] &= ~(1 << (b % 32));
+			bc_ndirty--;
+		}
+	}
+	bc_stats.cs_writes++;
+}
+
+// Move the CLOCK hand to a block to evict, evict it and return its slot.
+static size_t
+bc_evict(void)
+{
+	void *va;
+	pte_t pte;
+
+	while (1) {
+		if (bc_hand >= bc_nslots)
+			bc_hand = 0;
+		va = diskaddr(bc_slots[bc_hand]);
+		if (!va_is_mapped(va))
+			break;
+		pte = uvpt[PGNUM(va)];
+		if (!(pte & PTE_A)) {
+			flush_block(va);
+			sys_page_unmap(0, va);
+			bc_stats.cs_evictions++;
+			break;
+		}
+		if (pte & PTE_D)
+			flush_block(va);
+		else
+			sys_page_map(0, va, 0, va, pte & PTE_SYSCALL);
+		bc_hand++;
+	}
+	return bc_hand++;
+}
+
+// Evict blocks until the cache is within its budget.
+static void
+bc_shrink(void)
+{
+	size_t slot;
+
+	while (bc_nslots > BCPAGES) {
+		slot = bc_evict();
+		bc_slots[slot] = bc_slots[--bc_nslots];
+	}
+}
+
+// Find a slot for another cached block, evicting one if the cache is full.
+static size_t
+bc_slot_alloc(void)
+{
+	if (bc_held || bc_nslots < BCPAGES) {
+		if (bc_nslots == BCMAXSLOTS)
+			panic("block cache overflow");
+		return bc_nslots++;
+	}
+	bc_shrink();
+	return bc_evict();
+}
+
+// Hold off eviction while 'hold' is set, so that blocks faulted in
+// meanwhile stay mapped.  The cache shrinks back to its budget on the
+// first fault after the hold ends.
+void
+bc_hold(bool hold)
+{
+	bc_held = hold;
+}
+
+void
+bc_stat(struct CacheStat *cs)
+{
+	*cs = bc_stats;
+	cs->cs_resident = bc_nslots;
+	cs->cs_budget = BCPAGES;
+}
+
+// Sequential read-ahead.  The cache follows a few streams of faults at
+// once; a fault at the block just past a stream's last read doubles its
+// window, up to BCRAMAX blocks, and any other fault starts a new stream
+// of one block.  The blocks read ahead are mapped at once, so the scan
+// finds them cached instead of faulting on each.  BCRAMAX blocks are
+// 256 sectors, the most one disk command moves.
+
+#define BCRASTREAMS	4	// Streams followed at once
+
+static struct {
+	uint32_t ra_next;	// Block that would continue the stream
+	uint32_t ra_win;	// Current window in blocks
+} bc_ra[BCRASTREAMS];
+static int bc_ra_victim;
+
+// Return how many blocks to read in, starting with the faulting block
+// 'blockno'.  The run stops short at a block that is already cached,
+// free or past the end of the disk, and stays well under the budget so
+// the CLOCK hand can't come round to the new blocks before they're used.
+static uint32_t
+bc_readahead(uint32_t blockno)
+{
+	uint32_t n, win;
+	int i;
+
+	if (!super || !bitmap || bc_pinned(blockno))
+		return 1;
+	for (i = 0; i < BCRASTREAMS && bc_ra[i].ra_next != blockno; i++)
+		;
+	if (i == BCRASTREAMS) {
+		i = bc_ra_victim;
+		bc_ra_victim = (bc_ra_victim + 1) % BCRASTREAMS;
+		win = 1;
+	} else
+		win = MIN(bc_ra[i].ra_win * 2, MIN(BCRAMAX, BCPAGES / 4));
+
+	for (n = 1; n < win && blockno + n < super->s_nblocks
+		     && !va_is_mapped(diskaddr(blockno + n))
+		     && !block_is_free(blockno + n); n++)
+		;
+	bc_ra[i].ra_next = blockno + n;
+	bc_ra[i].ra_win = win;
+	return n;
+}
+
 // Fault any disk block that is read in to memory by
 // loading it from disk.
 // Hint: Use ide_read and BLKSECTS.
@@ -33,6 +231,7 @@ bc_pgfault(struct UTrapframe *utf)
 {
 	void *addr = (void *) utf->utf_fault_va;
 	uint64_t blockno = ((uint64_t)addr - DISKMAP) / BLKSIZE;
+	uint32_t n, i;
 	int r;
 
 	// Check that the fault was within the block cache region
@@ -44,14 +243,25 @@ bc_pgfault(struct UTrapframe *utf)
 	if (super && blockno >= super->s_nblocks)
 		panic("reading non-existent block %08x\n", blockno);
 
+	// Read in the block and any blocks after it that a sequential
+	// scan will want next, all with one disk command.
+	n = bc_readahead(blockno);
+	bc_stats.cs_misses++;
+	bc_stats.cs_readahead += n - 1;
+
 	// Allocate a page in the disk map region, read the contents
 	// of the block from the disk into that page.
 	// Hint: first round addr to page boundary.
 	//
 #line 52 "../fs/bc.c"
 	addr = ROUNDDOWN(addr, PGSIZE);
-	if ((r = sys_page_alloc(0, addr, PTE_U|PTE_P|PTE_W)) < 0)
-		panic("in bc_pgfault, sys_page_alloc: %e", r);
+	for (i = 0; i < n; i++) {
+		// Make room in the cache first; pinned blocks don't count.
+		if (!bc_pinned(blockno + i))
+			bc_slots[bc_slot_alloc()] = blockno + i;
+		if ((r = sys_page_alloc(0, addr + i * BLKSIZE, PTE_U|PTE_P|PTE_W)) < 0)
+			panic("in bc_pgfault, sys_page_alloc: %e", r);
+	}
 
 #line 59 "../fs/bc.c"
 
@@ -60,7 +270,7 @@ bc_pgfault(struct UTrapframe *utf)
 #ifndef VMM_GUEST
 
 #line 65 "../fs/bc.c"
-	if ((r = ide_read(blockno * BLKSECTS, addr, BLKSECTS)) < 0)
+	if ((r = ide_read(blockno * BLKSECTS, addr, n * BLKSECTS)) < 0)
 		panic("in bc_pgfault, ide_read: %e", r);
 #line 70 "../fs/bc.c"
 
@@ -68,15 +278,17 @@ bc_pgfault(struct UTrapframe *utf)
 
 #line 74 "../fs/bc.c"
 	/* FIXME DP: Should be lab 8 */
-	if ((r = host_read(blockno * BLKSECTS, addr, BLKSECTS)) < 0)
+	if ((r = host_read(blockno * BLKSECTS, addr, n * BLKSECTS)) < 0)
 		panic("in bc_pgfault, host_read: %e", r);
 #line 81 "../fs/bc.c"
 #endif // VMM_GUEST
 
 #line 93 "../fs/bc.c"
 
-	if ((r = sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL)) < 0)
-		panic("in bc_pgfault, sys_page_map: %e", r);
+	for (i = 0; i < n; i++)
+		if ((r = sys_page_map(0, addr + i * BLKSIZE, 0, addr + i * BLKSIZE,
+				      uvpt[PGNUM(addr + i * BLKSIZE)] & PTE_SYSCALL)) < 0)
+			panic("in bc_pgfault, sys_page_map: %e", r);
 
 	// Check that the block we read was allocated. (exercise for
 	// the reader: why do we do this *after* reading the block
@@ -104,18 +316,133 @@ flush_block(void *addr)
 	if (!va_is_mapped(addr) || !va_is_dirty(addr))
 		return;
 
-	// Write the disk block and clear PTE_D.
-	addr = ROUNDDOWN(addr, BLKSIZE);
+	// Allocations must reach the disk before anything that uses the
+	// blocks allocated.
+	if (!bc_pinned(blockno))
+		bc_flush_bitmap();
+	bc_write(blockno, 1, 0);
+#line 141 "../fs/bc.c"
+}
+
+// Write back the dirty bitmap blocks.
+static void
+bc_flush_bitmap(void)
+{
+	uint32_t b;
+
+	if (!super)
+		return;
+	for (b = 2; bc_pinned(b); b++)
+		if (va_is_mapped(diskaddr(b)) && va_is_dirty(diskaddr(b)))
+			bc_write(b, 1, 0);
+}
+
+// Note that the block containing 'va' has been written to.  Once enough
+// blocks are dirty, write them all back.
+void
+bc_mark_dirty(void *va)
+{
+	uint32_t blockno = ((uint64_t) va - DISKMAP) / BLKSIZE;
+
+	if (!(bc_dirtymap[blockno / 32] & (1 << (blockno % 32)))) {
+		bc_dirtymap[blockno / 32] |= 1 << (blockno % 32);
+		bc_ndirty++;
+	}
+	if (!bc_flush_pending) {
+		bc_flush_pending = 1;
+		bc_flush_deadline = sys_time_msec() + BCFLUSH_MSEC;
+	}
+	if (bc_ndirty >= BCFLUSH_DIRTY)
+		bc_flush();
+}
+
+// Make the cache's own mapping of the block at 'va' copy-on-write, so
+// that the page can be lent out read-only and a later write to the block
+// lands in a fresh copy instead of showing through to the borrower.
+// Returns 0 on success, < 0 on error.
+int
+bc_share(void *va)
+{
+	pte_t pte;
+
+	va = ROUNDDOWN(va, BLKSIZE);
+	if (!(uvpt[PGNUM(va)] & PTE_W))
+		return 0;
+	// Remapping clears PTE_D, and bc_flush and bc_evict only write
+	// blocks with PTE_D set, so write the block back first.
+	flush_block(va);
+	pte = uvpt[PGNUM(va)];
+	return sys_page_map(0, va, 0, va, ((pte & PTE_SYSCALL) & ~PTE_W) | PTE_COW);
+}
+
+// Write back every dirty block, in block order, with one disk command
+// per run of up to BCRAMAX contiguous dirty blocks.  Ascending order
+// also puts the superblock and bitmap blocks first.  The runs are all
+// queued before waiting for any, so the drive goes from one straight
+// to the next.  The dirty set holds
+// the blocks marked with bc_mark_dirty; PTE_D adds any written without.
+void
+bc_flush(void)
+{
+	uint32_t b, n;
+	size_t i;
+#ifndef VMM_GUEST
+	int r;
+#endif
+
+	if (!super)
+		return;
+	for (b = 1; bc_pinned(b); b++)
+		if (va_is_mapped(diskaddr(b)) && va_is_dirty(diskaddr(b)))
+			bc_dirtymap[b / 32] |= 1 << (b % 32);
+	for (i = 0; i < bc_nslots; i++)
+		if (va_is_mapped(diskaddr(bc_slots[i]))
+		    && va_is_dirty(diskaddr(bc_slots[i])))
+			bc_dirtymap[bc_slots[i] / 32] |= 1 << (bc_slots[i] % 32);
+
+	for (b = 0; b < super->s_nblocks; b += MAX(n, 1)) {
+		n = 0;
+		if (bc_dirtymap[b / 32] == 0) {
+			// Skip the rest of an empty word.
+			n = 32 - b % 32;
+			continue;
+		}
+		while (n < BCRAMAX && b + n < super->s_nblocks
+		       && (bc_dirtymap[(b + n) / 32] & (1 << ((b + n) % 32)))) {
+			bc_dirtymap[(b + n) / 32] &= ~(1 << ((b + n) % 32));
+			// Blocks evicted or flushed since they were marked
+			// end the run.
+			if (!va_is_mapped(diskaddr(b + n)) || !va_is_dirty(diskaddr(b + n)))
+				break;
+			n++;
+		}
+		if (n > 0)
+			bc_write(b, n, 1);
+	}
 #ifndef VMM_GUEST
-	ide_write(blockno * BLKSECTS, (void*) addr, BLKSECTS);
-#else
-#line 129 "../fs/bc.c"
-	/* FIXME DP: Should be lab 8 */
-	host_write(blockno * BLKSECTS, (void*) addr, BLKSECTS);
-#line 135 "../fs/bc.c"
+	if ((r = ide_wait()) < 0)
+		panic("in bc_flush, ide_write: %e", r);
 #endif
-	sys_page_map(0, addr, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL);
-#line 141 "../fs/bc.c"
+	bc_ndirty = 0;
+	bc_flush_pending = 0;
+}
+
+// Return how long the server may wait for its next request before
+// dirty blocks are due to be written back, in milliseconds, or 0 if it
+// may wait indefinitely.  If they are due already, write them back now.
+unsigned
+bc_flush_timeout(void)
+{
+	int32_t left;
+
+	if (!bc_flush_pending)
+		return 0;
+	left = bc_flush_deadline - sys_time_msec();
+	if (left <= 0) {
+		bc_flush();
+		return 0;
+	}
+	return left;
 }
 
 // Test that the block cache works, by smashing the superblock and
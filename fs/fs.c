@@ -45,11 +45,13 @@ free_block(uint32_t blockno)
 	if (blockno == 0)
 		panic("attempt to free zero block");
 	bitmap[blockno/32] |= 1<<(blockno%32);
+	bc_mark_dirty(&bitmap[blockno/32]);
 }
 
-// Search the bitmap for a free block and allocate it.  When you
-// allocate a block, immediately flush the changed bitmap block
-// to disk.
+// Search the bitmap for a free block and allocate it.  The changed
+// bitmap block is only marked dirty: flush_block writes dirty bitmap
+// blocks out before any other block, so the allocation still reaches
+// the disk before anything that points at the new block.
 //
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
@@ -70,7 +72,7 @@ alloc_block(void)
 		j = (lastalloc+i)%super->s_nblocks;
 		if (block_is_free(j)) {
 			bitmap[j/32] &= ~(1<<(j%32));
-			flush_block(&bitmap[j/32]);
+			bc_mark_dirty(&bitmap[j/32]);
 			lastalloc = j;
 			return j;
 		}
@@ -205,6 +207,8 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
 		*ptr = r;
 	}
 	*blk = diskaddr(*ptr);
+	if (va_is_mapped(*blk))
+		bc_stats.cs_hits++;
 	return 0;
 #line 289 "../fs/fs.c"
 }
@@ -338,6 +342,14 @@ walk_path(const char *path, struct File **pdir, struct File **pf, char *lastelem
 // File operations
 // --------------------------------------------------------------
 
+// Give f a version number that no file has had before, so that clients
+// can tell that it changed (see spawn_template).
+static void
+file_touch(struct File *f)
+{
+	f->f_version = ++super->s_version;
+}
+
 // Create "path".  On success set *pf to point at the file and return 0.
 // On error return < 0.
 int
@@ -354,6 +366,7 @@ file_create(const char *path, struct File **pf)
 	if ((r = dir_alloc_file(dir, &f)) < 0)
 		return r;
 	strcpy(f->f_name, name);
+	file_touch(f);
 	*pf = f;
 	file_flush(dir);
 	return 0;
@@ -411,11 +424,13 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 		if ((r = file_set_size(f, offset + count)) < 0)
 			return r;
 
+	file_touch(f);
 	for (pos = offset; pos < offset + count; ) {
 		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
 			return r;
 		bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
 		memmove(blk + pos % BLKSIZE, buf, bn);
+		bc_mark_dirty(blk);
 		pos += bn;
 		buf += bn;
 	}
@@ -474,29 +489,19 @@ file_set_size(struct File *f, off_t newsize)
 	if (f->f_size > newsize)
 		file_truncate_blocks(f, newsize);
 	f->f_size = newsize;
+	file_touch(f);
 	flush_block(f);
 	return 0;
 }
 
 // Flush the contents and metadata of file f out to disk.
-// Loop over all the blocks in file.
-// Translate the file block number into a disk block number
-// and then check whether that disk block is dirty.  If so, write it out.
+// Rather than walk the file's blocks, write back the whole dirty set,
+// which costs only as much as there is dirty data and writes it in
+// contiguous runs.
 void
 file_flush(struct File *f)
 {
-	int i;
-	uint32_t *pdiskbno;
-
-	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
-		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-		    pdiskbno == NULL || *pdiskbno == 0)
-			continue;
-		flush_block(diskaddr(*pdiskbno));
-	}
-	flush_block(f);
-	if (f->f_indirect)
-		flush_block(diskaddr(f->f_indirect));
+	bc_flush();
 }
 
 // Remove a file by truncating it and then zeroing the name.
@@ -512,17 +517,16 @@ file_remove(const char *path)
 	file_truncate_blocks(f, 0);
 	f->f_name[0] = '\0';
 	f->f_size = 0;
+	file_touch(f);
 	flush_block(f);
 
 	return 0;
 }
 
-// Sync the entire file system.  A big hammer.
+// Sync the entire file system by writing back every dirty block.
 void
 fs_sync(void)
 {
-	int i;
-	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+	bc_flush();
 }
 
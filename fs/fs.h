@@ -12,6 +12,12 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE	0xC0000000
 
+/* Block cache budget in pages, besides the pinned superblock and bitmap
+ * blocks.  Build with 'make BCPAGES=n' to change it. */
+#ifndef BCPAGES
+#define BCPAGES		8192
+#endif
+
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
@@ -21,6 +27,8 @@ void   ide_set_disk(int diskno);
 #line 24 "../fs/fs.h"
 int    ide_read(uint32_t secno, void *dst, size_t nsecs);
 int    ide_write(uint32_t secno, const void *src, size_t nsecs);
+int    ide_write_async(uint32_t secno, const void *src, size_t nsecs);
+int    ide_wait(void);
 
 /* bc.c */
 void*  diskaddr(uint64_t blockno);
@@ -28,6 +36,14 @@ bool   va_is_mapped(void *va);
 bool   va_is_dirty(void *va);
 void   flush_block(void *addr);
 void   bc_init(void);
+void   bc_hold(bool hold);
+void   bc_stat(struct CacheStat *cs);
+void   bc_mark_dirty(void *va);
+int    bc_share(void *va);
+void   bc_flush(void);
+unsigned bc_flush_timeout(void);
+
+extern struct CacheStat bc_stats;
 
 /* fs.c */
 void   fs_init(void);
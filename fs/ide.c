@@ -1,56 +1,29 @@
 #line 2 "../fs/ide.c"
 /*
- * Minimal PIO-based (non-interrupt-driven) IDE driver code.
+ * Minimal IDE driver code.  The kernel's bus-master DMA driver does the
+ * work: it probes the drives, moves whole pages between the disk and
+ * the buffer cache, and puts the file server to sleep until the drive
+ * interrupts.  Buffers must therefore be page-aligned.
  * For information about what all this IDE/ATA magic means,
  * see the materials available on the class references page.
  */
 
 #include "fs.h"
-#include <inc/x86.h>
-
-#define IDE_BSY		0x80
-#define IDE_DRDY	0x40
-#define IDE_DF		0x20
-#define IDE_ERR		0x01
 
 static int diskno = 1;
 #line 21 "../fs/ide.c"
 
-static int
-ide_wait_ready(bool check_error)
-{
-	int r;
-
-	while (((r = inb(0x1F7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
-		/* do nothing */;
-
-	if (check_error && (r & (IDE_DF|IDE_ERR)) != 0)
-		return -1;
-	return 0;
-}
-
 bool
 ide_probe_disk1(void)
 {
-	int r, x;
-
-	// wait for Device 0 to be ready
-	ide_wait_ready(0);
-
-	// switch to Device 1
-	outb(0x1F6, 0xE0 | (1<<4));
-
-	// check for Device 1 to be ready for a while
-	for (x = 0;
-	     x < 1000 && ((r = inb(0x1F7)) & (IDE_BSY|IDE_DF|IDE_ERR)) != 0;
-	     x++)
-		/* do nothing */;
-
-	// switch back to Device 0
-	outb(0x1F6, 0xE0 | (0<<4));
+	static uint8_t probebuf[PGSIZE] __attribute__((aligned(PGSIZE)));
+	int r;
 
-	cprintf("Device 1 presence: %d\n", (x < 1000));
-	return (x < 1000);
+	// The kernel knows whether drive 1 answered when it attached the
+	// controller; reading a sector from it asks.
+	r = sys_disk_read(1, 0, probebuf, 1);
+	cprintf("Device 1 presence: %d\n", r == 0);
+	return r == 0;
 }
 
 void
@@ -65,52 +38,36 @@ ide_set_disk(int d)
 int
 ide_read(uint32_t secno, void *dst, size_t nsecs)
 {
-	int r;
-
-	assert(nsecs <= 256);
-
-#line 90 "../fs/ide.c"
-	ide_wait_ready(0);
-
-	outb(0x1F2, nsecs);
-	outb(0x1F3, secno & 0xFF);
-	outb(0x1F4, (secno >> 8) & 0xFF);
-	outb(0x1F5, (secno >> 16) & 0xFF);
-	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x20);	// CMD 0x20 means read sector
-
-	for (; nsecs > 0; nsecs--, dst += SECTSIZE) {
-		if ((r = ide_wait_ready(1)) < 0)
-			return r;
-		insw(0x1F0, dst, SECTSIZE/2);
-	}
-
-	return 0;
+	assert(nsecs <= 256 && PGOFF(dst) == 0);
+	return sys_disk_read(diskno, secno, dst, nsecs);
 }
 
 int
 ide_write(uint32_t secno, const void *src, size_t nsecs)
 {
-	int r;
-
-	assert(nsecs <= 256);
-
-#line 122 "../fs/ide.c"
-	ide_wait_ready(0);
+	assert(nsecs <= 256 && PGOFF(src) == 0);
+	return sys_disk_write(diskno, secno, src, nsecs, 0);
+}
 
-	outb(0x1F2, nsecs);
-	outb(0x1F3, secno & 0xFF);
-	outb(0x1F4, (secno >> 8) & 0xFF);
-	outb(0x1F5, (secno >> 16) & 0xFF);
-	outb(0x1F6, 0xE0 | ((diskno&1)<<4) | ((secno>>24)&0x0F));
-	outb(0x1F7, 0x30);	// CMD 0x30 means write sector
+// Queue a write and return without waiting for it.  The buffer must
+// stay untouched, and the result is only known, once ide_wait returns.
+// If the kernel's queue is full, first waits for what is in it.
+int
+ide_write_async(uint32_t secno, const void *src, size_t nsecs)
+{
+	int r;
 
-	for (; nsecs > 0; nsecs--, src += SECTSIZE) {
-		if ((r = ide_wait_ready(1)) < 0)
+	assert(nsecs <= 256 && PGOFF(src) == 0);
+	while ((r = sys_disk_write(diskno, secno, src, nsecs, 1)) == -E_AGAIN)
+		if ((r = sys_disk_wait()) < 0)
 			return r;
-		outsw(0x1F0, src, SECTSIZE/2);
-	}
-
-	return 0;
+	return r;
 }
 
+// Wait for all the writes queued with ide_write_async.  Returns the
+// error of the first one that failed, if any.
+int
+ide_wait(void)
+{
+	return sys_disk_wait();
+}
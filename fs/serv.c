@@ -47,7 +47,13 @@ struct OpenFile opentab[MAXOPEN] = {
 };
 
 // Virtual address at which to receive page mappings containing client requests.
-union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
+// The data pages of a bulk write are mapped right after the request page,
+// so the window ends just below the disk map.
+#define FSREQVA		(DISKMAP - (1 + FSBULK_MAXPAGES) * PGSIZE)
+union Fsipc *fsreq = (union Fsipc *)FSREQVA;
+
+// Staging area for the data pages of a bulk read reply.
+#define FSBULKVA	(FILEVA + MAXOPEN * PGSIZE)
 
 void
 serve_init(void)
@@ -283,6 +289,131 @@ serve_write(envid_t envid, struct Fsreq_write *req)
 #line 292 "../fs/serv.c"
 }
 
+// Read at most req->req_n bytes (up to FSBULK_MAXPAGES pages) from the
+// current seek position in req->req_fileid into pages at FSBULKVA, and
+// update the seek position.  Whole blocks at a block-aligned position
+// are the block cache's own pages, mapped read-only and made
+// copy-on-write in the cache, so the reader keeps a snapshot even if the
+// file is written later; the rest is copied into fresh pages.  On success, stores the number of pages to send
+// back in *npages_store and returns the number of bytes read.
+// Returns < 0 on error.
+int
+serve_read_bulk(envid_t envid, struct Fsreq_bulk *req, size_t *npages_store)
+{
+	struct OpenFile *o;
+	size_t n, i, nlent = 0;
+	off_t pos;
+	char *blk;
+	int r;
+
+	if (debug)
+		cprintf("serve_read_bulk %08x %08x %08x\n", envid, req->req_fileid, req->req_n);
+
+	*npages_store = 0;
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+
+	n = MIN(req->req_n, FSBULK_MAXPAGES * PGSIZE);
+	pos = o->o_fd->fd_offset;
+	if (pos % BLKSIZE == 0)
+		for (; pos + BLKSIZE <= o->o_file->f_size
+			     && (nlent + 1) * BLKSIZE <= n; nlent++, pos += BLKSIZE) {
+			if ((r = file_get_block(o->o_file, pos / BLKSIZE, &blk)) < 0)
+				return r;
+			// Fault the block into the cache before sharing it.
+			(void) *(volatile char *) blk;
+			if ((r = bc_share(blk)) < 0)
+				return r;
+			if ((r = sys_page_map(0, blk, 0, (void*) (FSBULKVA + nlent * PGSIZE),
+					      PTE_P|PTE_U)) < 0)
+				return r;
+		}
+	n -= nlent * BLKSIZE;
+
+	for (i = nlent; i < nlent + ROUNDUP(n, PGSIZE) / PGSIZE; i++)
+		if ((r = sys_page_alloc(0, (void*) (FSBULKVA + i * PGSIZE),
+					PTE_P|PTE_U|PTE_W)) < 0)
+			return r;
+
+	if ((r = file_read(o->o_file, (void*) (FSBULKVA + nlent * PGSIZE), n, pos)) < 0)
+		return r;
+	r += nlent * BLKSIZE;
+
+	o->o_fd->fd_offset += r;
+	*npages_store = ROUNDUP(r, PGSIZE) / PGSIZE;
+	return r;
+}
+
+// Write req->req_n bytes from the 'npages' data pages following the
+// request page to req_fileid, starting at the current seek position,
+// and update the seek position.  Returns the number of bytes written,
+// or < 0 on error.
+int
+serve_write_bulk(envid_t envid, struct Fsreq_bulk *req, size_t npages)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_write_bulk %08x %08x %08x\n", envid, req->req_fileid, req->req_n);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+
+	if (req->req_n > npages * PGSIZE)
+		return -E_INVAL;
+
+	if ((r = file_write(o->o_file, (char*) fsreq + PGSIZE, req->req_n,
+			    o->o_fd->fd_offset)) < 0)
+		return r;
+
+	o->o_fd->fd_offset += r;
+	return r;
+}
+
+// Load the program in req->req_fileid into the new environment
+// req->req_envid, which must be a child of the requester, by handing
+// the kernel the block cache pages that hold the file.
+// Returns 0 on success, < 0 on error.
+int
+serve_spawn(envid_t envid, struct Fsreq_spawn *req)
+{
+	static void *pages[NDIRECT + NINDIRECT];
+	const volatile struct Env *child;
+	struct OpenFile *o;
+	uint32_t *pdiskbno;
+	size_t i, n;
+	int r;
+
+	if (debug)
+		cprintf("serve_spawn %08x %08x %08x\n", envid, req->req_fileid, req->req_envid);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	child = &envs[ENVX(req->req_envid)];
+	if (child->env_id != req->req_envid || child->env_parent_id != envid)
+		return -E_BAD_ENV;
+
+	// The blocks must all still be mapped when the kernel looks.
+	bc_hold(1);
+	n = ROUNDUP(o->o_file->f_size, BLKSIZE) / BLKSIZE;
+	for (i = 0; i < n; i++) {
+		if ((r = file_block_walk(o->o_file, i, &pdiskbno, 0)) < 0)
+			goto out;
+		if (*pdiskbno == 0) {
+			r = -E_NOT_SUPP;	// sparse file
+			goto out;
+		}
+		pages[i] = diskaddr(*pdiskbno);
+		// Fault the block into the cache for the kernel.
+		(void) *(volatile char *) pages[i];
+	}
+	r = sys_spawn_from_pages(req->req_envid, pages, n);
+out:
+	bc_hold(0);
+	return r;
+}
+
 // Stat ipc->stat.req_fileid.  Return the file's struct Stat to the
 // caller in ipc->statRet.
 int
@@ -302,6 +433,7 @@ serve_stat(envid_t envid, union Fsipc *ipc)
 	strcpy(ret->ret_name, o->o_file->f_name);
 	ret->ret_size = o->o_file->f_size;
 	ret->ret_isdir = (o->o_file->f_type == FTYPE_DIR);
+	ret->ret_version = o->o_file->f_version;
 	return 0;
 }
 
@@ -350,6 +482,15 @@ serve_sync(envid_t envid, union Fsipc *req)
 	return 0;
 }
 
+// Return the block cache counters in ipc->cachestatRet.  The budget is
+// fixed when the file server is built, so clients can only look.
+int
+serve_cachestat(envid_t envid, union Fsipc *ipc)
+{
+	bc_stat(&ipc->cachestatRet.ret_stat);
+	return 0;
+}
+
 #line 394 "../fs/serv.c"
 
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
@@ -364,7 +505,9 @@ fshandler handlers[] = {
 	[FSREQ_WRITE] =		(fshandler)serve_write,
 	[FSREQ_REMOVE] =	(fshandler)serve_remove,
 #line 410 "../fs/serv.c"
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_SPAWN] =		(fshandler)serve_spawn,
+	[FSREQ_CACHESTAT] =	serve_cachestat
 };
 #define NHANDLERS (sizeof(handlers)/sizeof(handlers[0]))
 
@@ -374,34 +517,61 @@ serve(void)
 	uint32_t req, whom;
 	int perm, r;
 	void *pg;
+	struct IpcPage reply[FSBULK_MAXPAGES];
+	size_t npages, nreply, i;
 
 	while (1) {
 		perm = 0;
-		req = ipc_recv((int32_t *) &whom, fsreq, &perm);
+		// Wait for a request, writing dirty blocks back whenever
+		// they come due in the meantime.
+		while ((r = sys_notify_wait(0, 1, fsreq, 1 + FSBULK_MAXPAGES,
+					    bc_flush_timeout())) == -E_TIMEOUT)
+			;
+		if (r < 0)
+			panic("serve: sys_notify_wait: %e", r);
+		req = thisenv->env_ipc_value;
+		whom = thisenv->env_ipc_from;
+		npages = thisenv->env_ipc_npages;
 		if (debug)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
 				req, whom, uvpt[PGNUM(fsreq)], fsreq);
 
 		// All requests must contain an argument page
-		if (!(perm & PTE_P)) {
+		if (npages == 0) {
 			cprintf("Invalid request from %08x: no argument page\n",
 				whom);
 			continue; // just leave it hanging...
 		}
 
 		pg = NULL;
+		nreply = 0;
 		if (req == FSREQ_OPEN) {
 			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
+		} else if (req == FSREQ_READ_BULK) {
+			r = serve_read_bulk(whom, &fsreq->bulk, &nreply);
+		} else if (req == FSREQ_WRITE_BULK) {
+			r = serve_write_bulk(whom, &fsreq->bulk, npages - 1);
 		} else if (req < NHANDLERS && handlers[req]) {
 			r = handlers[req](whom, fsreq);
 		} else {
 			cprintf("Invalid request code %d from %08x\n", req, whom);
 			r = -E_INVAL;
 		}
-		ipc_send(whom, r, pg, perm);
+		if (nreply > 0) {
+			for (i = 0; i < nreply; i++) {
+				reply[i].ip_va = (void*) (FSBULKVA + i * PGSIZE);
+				reply[i].ip_perm = PTE_P|PTE_U;
+			}
+			ipc_sendv(whom, r, reply, nreply);
+		} else
+			ipc_send(whom, r, pg, perm);
 		if(debug)
 			cprintf("FS: Sent response %d to %x\n", r, whom);
-		sys_page_unmap(0, fsreq);
+		for (i = 0; i < npages; i++)
+			sys_page_unmap(0, (char*) fsreq + i * PGSIZE);
+		if (req == FSREQ_READ_BULK)
+			for (i = 0; i < FSBULK_MAXPAGES; i++)
+				sys_page_unmap(0, (void*) (FSBULKVA + i * PGSIZE));
 	}
 }
 
@@ -409,15 +579,14 @@ void
 umain(int argc, char **argv)
 {
 	static_assert(sizeof(struct File) == 256);
+	static_assert(FSBULK_MAXPAGES < IPC_MAXPAGES);
 	binaryname = "fs";
 	cprintf("FS is running\n");
 
-	// Check that we are able to do I/O
-	outw(0x8A00, 0x8A00);
-	cprintf("FS can do I/O\n");
-
 	serve_init();
 	fs_init();
+	// fs_init has read the superblock, through the kernel's disk driver.
+	cprintf("FS can do I/O\n");
 #line 467 "../fs/serv.c"
 	serve();
 }
@@ -0,0 +1,51 @@
+#ifndef JOS_INC_CLOCK_H
+#define JOS_INC_CLOCK_H
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+// The kernel's clock page, mapped read-only into every env at UCLOCK.
+// Time since boot in nanoseconds is
+//	cp_ns_base + (TSC - cp_tsc_base) * cp_mult / 2^32,
+// so reading the clock takes no system call.  The kernel rebases
+// cp_tsc_base and cp_ns_base on every timer tick.  Readers use
+// cp_seq as a seqlock: it is odd while an update is in progress, and
+// changes whenever one happens.  cp_mult is 0 if the TSC has not been
+// calibrated (for instance in a VMX guest), in which case only
+// sys_time_msec works.
+
+struct ClockPage {
+	volatile uint32_t cp_seq;	// Update sequence number
+	uint32_t cp_pad;
+	uint64_t cp_tsc_base;		// TSC at cp_ns_base
+	uint64_t cp_ns_base;		// Nanoseconds since boot
+	uint64_t cp_mult;		// Nanoseconds per TSC tick, * 2^32
+	uint64_t cp_tsc_hz;		// Calibrated TSC frequency
+};
+
+// Return the current time in nanoseconds according to 'cp',
+// or 0 if the clock is not calibrated.
+static __inline uint64_t
+clock_page_ns(const volatile struct ClockPage *cp)
+{
+	uint32_t seq;
+	uint64_t tsc_base, ns_base, mult, tsc;
+
+	do {
+		while ((seq = cp->cp_seq) & 1)
+			asm volatile("pause");
+		asm volatile("" : : : "memory");
+		tsc_base = cp->cp_tsc_base;
+		ns_base = cp->cp_ns_base;
+		mult = cp->cp_mult;
+		tsc = read_tsc();
+		asm volatile("" : : : "memory");
+	} while (cp->cp_seq != seq);
+
+	if (tsc < tsc_base)	// Read on a CPU whose TSC lags slightly
+		tsc = tsc_base;
+	return ns_base
+		+ (uint64_t) (((unsigned __int128) (tsc - tsc_base) * mult) >> 32);
+}
+
+#endif /* !JOS_INC_CLOCK_H */
@@ -34,13 +34,26 @@ extern physaddr_t boot_cr3;
 #define NENV			(1 << LOG2NENV)
 #define ENVX(envid)		((envid) & (NENV - 1))
 
+// Maximum number of page mappings one vectored IPC can transfer
+// (see sys_ipc_try_sendv and sys_ipc_recvv).
+#define IPC_MAXPAGES		16
+
+// One element of a vectored IPC send: the page mapped at 'ip_va' in the
+// sender is shared with the receiver using permissions 'ip_perm'.
+struct IpcPage {
+	void *ip_va;
+	int ip_perm;
+};
+
 // Values of env_status in struct Env
 enum {
 	ENV_FREE = 0,
 	ENV_DYING,
 	ENV_RUNNABLE,
 	ENV_RUNNING,
-	ENV_NOT_RUNNABLE
+	ENV_NOT_RUNNABLE,
+	ENV_TEMPLATE,		// Never runs; sys_env_clone copies it
+	ENV_ZOMBIE		// Exited; holds its status for the parent
 };
 
 // Special environment types
@@ -56,6 +69,10 @@ enum EnvType {
 #line 59 "../inc/env.h"
 };
 
+// Notification bit the kernel sets in a parent when one of its
+// children is freed.  Applications should pick their own bits below it.
+#define NOTIFY_CHILD_EXIT	(1ULL << 63)
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	struct Env *env_link;   // Free list link pointers
@@ -77,12 +94,33 @@ struct Env {
 	// Exception handling
 	void *env_pgfault_upcall;	// Page fault upcall entry point
 
+	// Saved FPU/SSE/AVX state (see kern/fpu.c)
+	void *env_fpu;			// Kernel virtual address, NULL if unused
+
 	// Lab 4 IPC
 	bool env_ipc_recving;		// Env is blocked receiving
 	void *env_ipc_dstva;		// VA at which to map received page
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	size_t env_ipc_maxpages;	// Pages the receive window can hold
+	size_t env_ipc_npages;		// Number of page mappings received
+
+	// Notifications (see sys_notify)
+	uint64_t env_notify_bits;	// Pending notification bits
+	uint64_t env_notify_mask;	// Bits that end sys_notify_wait, 0 if none
+	unsigned env_notify_deadline;	// time_msec() to give up at, 0 if none
+
+	// Exit (see sys_env_exit and sys_env_wait)
+	int env_exit_status;		// Reported to waiters when freed
+	envid_t env_wait_envid;		// Env blocked on in sys_env_wait, 0 if none
+	int env_wait_status;		// Status from the last sys_env_wait
+	bool env_keep_zombies;		// Keep exited children until waited for
+
+	// Futex wait state (see kern/futex.c)
+	physaddr_t env_futex_key;	// Physical address waited on, 0 if none
+	unsigned env_futex_deadline;	// time_msec() to give up at, 0 if none
+	struct Env *env_futex_link;	// Next waiter on the same queue
 #line 90 "../inc/env.h"
 	uint8_t *elf;
 #line 93 "../inc/env.h"
@@ -37,6 +37,11 @@ enum {
 	E_VMX_ON = 19,    // Couldn't transition the cpu to VMX root mode
 	E_VMCS_INIT = 20, // Couldn't init the VMCS region
 	E_NO_ENT = 21,
+
+	E_AGAIN		= 22,	// Futex value changed; try again
+	E_TIMEOUT	= 23,	// Wait timed out
+	E_CANCELED	= 24,	// Skipped because an earlier linked call failed
+	E_PERM		= 25,	// Caller is not allowed to do this
 	MAXERROR
 };
 
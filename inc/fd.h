@@ -13,6 +13,14 @@ struct Fd;
 struct Stat;
 struct Dev;
 
+// One buffer of a scatter-gather transfer (readv/writev)
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+#define IOV_MAX		64	// Most iovecs in one readv/writev
+
 // Per-device-class file descriptor operations
 struct Dev {
 	int dev_id;
@@ -22,10 +30,25 @@ struct Dev {
 	int (*dev_close)(struct Fd *fd);
 	int (*dev_stat)(struct Fd *fd, struct Stat *stat);
 	int (*dev_trunc)(struct Fd *fd, off_t length);
+	// Optional scatter-gather transfers; without them readv/writev
+	// make one dev_read/dev_write call per iovec.
+	ssize_t (*dev_readv)(struct Fd *fd, const struct iovec *iov, int iovcnt);
+	ssize_t (*dev_writev)(struct Fd *fd, const struct iovec *iov, int iovcnt);
+	// Optional whole-page transfers for splice.  dev_readpages maps
+	// pages holding up to 'len' bytes at the page-aligned 'va' and
+	// returns the byte count; dev_writepages writes up to 'len' bytes
+	// from the pages at 'va' by handing the pages themselves on.
+	ssize_t (*dev_readpages)(struct Fd *fd, void *va, size_t len);
+	ssize_t (*dev_writepages)(struct Fd *fd, void *va, size_t len);
 };
 
 struct FdFile {
 	int id;
+	// Client-side buffer of an O_BUFFERED file (see lib/file.c).  It
+	// lives in the Fd page so envs sharing the fd share its state.
+	off_t buf_off;		// File offset of the buffered bytes
+	uint32_t buf_len;	// Number of buffered bytes
+	bool buf_dirty;		// Buffered bytes are writes not yet sent
 };
 
 #line 32 "../inc/fd.h"
@@ -52,15 +75,22 @@ struct Stat {
 	char st_name[MAXNAMELEN];
 	off_t st_size;
 	int st_isdir;
+	uint32_t st_version;	// Changes whenever a file does; 0 if not a file
 	struct Dev *st_dev;
 };
 
+// Pages of data area each file descriptor gets at fd2data(fd).
+#define FDDATAPAGES	32
+
 char*	fd2data(struct Fd *fd);
 uint64_t	fd2num(struct Fd *fd);
 int	fd_alloc(struct Fd **fd_store);
 int	fd_close(struct Fd *fd, bool must_exist);
 int	fd_lookup(int fdnum, struct Fd **fd_store);
 int	dev_lookup(int devid, struct Dev **dev_store);
+size_t	iov_total(const struct iovec *iov, int iovcnt);
+size_t	iov_gather(void *dst, const struct iovec *iov, int iovcnt, size_t n);
+void	iov_scatter(const struct iovec *iov, int iovcnt, const void *src, size_t n);
 
 extern struct Dev devfile;
 #line 67 "../inc/fd.h"
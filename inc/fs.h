@@ -37,9 +37,13 @@ struct File {
 	uint32_t f_direct[NDIRECT];	// direct blocks
 	uint32_t f_indirect;		// indirect block
 
+	// Changes whenever the file does; no two versions of any files
+	// share a number (see s_version).
+	uint32_t f_version;
+
 	// Pad out to 256 bytes; must do arithmetic in case we're compiling
 	// fsformat on a 64-bit machine.
-	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4];
+	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4 - 4];
 } __attribute__((packed));	// required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -58,6 +62,7 @@ struct Super {
 	uint32_t s_magic;		// Magic number: FS_MAGIC
 	uint32_t s_nblocks;		// Total number of blocks on disk
 	struct File s_root;		// Root directory node
+	uint32_t s_version;		// Last f_version handed out
 };
 
 // Definitions for requests from clients to file system
@@ -72,10 +77,37 @@ enum {
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
 #line 78 "../inc/fs.h"
-	FSREQ_SYNC
+	FSREQ_SYNC,
 #line 80 "../inc/fs.h"
+	// The bulk requests move up to FSBULK_MAXPAGES pages of file data
+	// in one vectored IPC (ipc_sendv/ipc_recvv).  Both take a
+	// Fsreq_bulk on the request page.  Write-bulk sends the data pages
+	// right after the request page; read-bulk replies with the data
+	// pages instead of a Fsret_read.
+	FSREQ_READ_BULK,
+	FSREQ_WRITE_BULK,
+	// Spawn loads the program in an open file into a new child of the
+	// caller with sys_spawn_from_pages.  Takes a Fsreq_spawn.
+	FSREQ_SPAWN,
+	// Cachestat returns the block cache counters in a Fsret_cachestat.
+	FSREQ_CACHESTAT
+};
+
+// Block cache counters, as returned by FSREQ_CACHESTAT
+struct CacheStat {
+	uint64_t cs_hits;	// File block lookups that found the block cached
+	uint64_t cs_misses;	// Blocks read in from disk on a fault
+	uint64_t cs_readahead;	// Blocks read in ahead of a sequential scan
+	uint64_t cs_evictions;	// Blocks dropped to stay within the budget
+	uint64_t cs_writes;	// Disk writes, each of a run of blocks
+	uint32_t cs_resident;	// Blocks cached, not counting pinned ones
+	uint32_t cs_budget;	// Most blocks cached, not counting pinned ones
 };
 
+// Maximum number of data pages in a bulk request.  The request page
+// travels in the same IPC, so this must be less than IPC_MAXPAGES.
+#define FSBULK_MAXPAGES	15
+
 union Fsipc {
 	struct Fsreq_open {
 		char req_path[MAXPATHLEN];
@@ -104,6 +136,7 @@ union Fsipc {
 		char ret_name[MAXNAMELEN];
 		off_t ret_size;
 		int ret_isdir;
+		uint32_t ret_version;
 	} statRet;
 	struct Fsreq_flush {
 		int req_fileid;
@@ -111,6 +144,17 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_bulk {
+		int req_fileid;
+		size_t req_n;
+	} bulk;
+	struct Fsreq_spawn {
+		int req_fileid;
+		int32_t req_envid;
+	} spawn;
+	struct Fsret_cachestat {
+		struct CacheStat ret_stat;
+	} cachestatRet;
 #line 129 "../inc/fs.h"
 
 	// Ensure Fsipc is one page
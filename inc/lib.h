@@ -17,6 +17,8 @@
 #include <inc/env.h>
 #include <inc/memlayout.h>
 #include <inc/syscall.h>
+#include <inc/sysring.h>
+#include <inc/clock.h>
 #line 21 "../inc/lib.h"
 #include <inc/trap.h>
 #line 24 "../inc/lib.h"
@@ -25,6 +27,7 @@
 #include <inc/args.h>
 #line 29 "../inc/lib.h"
 #include <inc/malloc.h>
+#include <inc/thread.h>
 #include <inc/ns.h>
 #line 33 "../inc/lib.h"
 #include <inc/vmx.h>
@@ -32,6 +35,10 @@
 
 #define USED(x)		(void)(x)
 
+// Marks a zero-initialized global that each sfork'd thread gets its own
+// copy of, rather than sharing (see sfork).
+#define THREAD_LOCAL	__attribute__((section(".bss.thread")))
+
 // main user program
 void	umain(int argc, char **argv);
 
@@ -40,9 +47,11 @@ extern const char *binaryname;
 extern const volatile struct Env *thisenv;
 extern const volatile struct Env envs[NENV];
 extern const volatile struct PageInfo pages[];
+extern const volatile struct ClockPage clockpage;
 
 // exit.c
 void	exit(void);
+void	exit_with(int status);
 
 #line 51 "../inc/lib.h"
 // pgfault.c
@@ -61,6 +70,15 @@ int	sys_env_destroy(envid_t);
 void	sys_yield(void);
 static envid_t sys_exofork(void);
 int	sys_env_set_status(envid_t env, int status);
+envid_t	sys_env_clone(envid_t tmpl);
+int	sys_env_set_parent(envid_t envid, envid_t parent);
+int	sys_spawn_from_pages(envid_t env, void *const *pages, size_t npages);
+int	sys_env_write(envid_t env, uintptr_t dstva, const void *src, size_t len,
+		      int perm);
+int	sys_env_read(envid_t env, uintptr_t srcva, void *dst, size_t len);
+void	sys_env_exit(int status);
+int	sys_env_wait(envid_t env, int *status_store);
+int	sys_env_keep_zombies(bool keep);
 #line 68 "../inc/lib.h"
 int	sys_env_set_trapframe(envid_t env, struct Trapframe *tf);
 #line 70 "../inc/lib.h"
@@ -71,11 +89,26 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint64_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_try_sendv(envid_t to_env, uint64_t value,
+			  const struct IpcPage *pages, size_t npages);
+int	sys_ipc_recvv(void *rcv_pg, size_t npages);
+int	sys_futex_wait(const volatile uint32_t *va, uint32_t expected,
+		       unsigned timeout);
+int	sys_futex_wake(const volatile uint32_t *va, int n);
+int	sys_ring_enter(struct Sysring *ring);
+int	sys_notify(envid_t envid, uint64_t bits);
+int	sys_notify_wait(uint64_t mask, bool ipc, void *rcv_pg, size_t npages,
+			unsigned timeout);
+uint64_t sys_notify_take(uint64_t mask);
 #line 78 "../inc/lib.h"
 unsigned int sys_time_msec(void);
 #line 80 "../inc/lib.h"
 int	sys_net_transmit(const char *data, unsigned int len);
 int	sys_net_receive(char *buf, unsigned int len);
+int	sys_disk_read(int diskno, uint32_t secno, void *dst, size_t nsecs);
+int	sys_disk_write(int diskno, uint32_t secno, const void *src,
+		       size_t nsecs, bool async);
+int	sys_disk_wait(void);
 #line 85 "../inc/lib.h"
 int sys_ept_map(envid_t srcenvid, void *srcva, envid_t guest, void* guest_pa, int perm);
 envid_t sys_env_mkguest(uint64_t gphysz, uint64_t gRIP);
@@ -103,6 +136,14 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+void	ipc_sendv(envid_t to_env, uint32_t value,
+		  const struct IpcPage *pages, size_t npages);
+int32_t ipc_recvv(envid_t *from_env_store, void *pg, size_t maxpages,
+		  size_t *npages_store);
+int32_t ipc_recv_notify(envid_t *from_env_store, void *pg, size_t maxpages,
+			size_t *npages_store, uint64_t mask,
+			uint64_t *bits_store);
+uint64_t notify_wait(uint64_t mask);
 envid_t	ipc_find_env(enum EnvType type);
 
 #line 114 "../inc/lib.h"
@@ -112,10 +153,17 @@ int32_t ipc_host_recv(void *pg);
 #endif
 #line 119 "../inc/lib.h"
 
+// sysring.c
+void	sysring_push(int num, uint32_t flags, uint64_t a1, uint64_t a2,
+		     uint64_t a3, uint64_t a4, uint64_t a5);
+int	sysring_submit(void);
+
+// clock.c
+uint64_t clock_ns(void);
+
 // fork.c
-#define	PTE_SHARE	0x400
 envid_t	fork(void);
-envid_t	sfork(void);	// Challenge!
+envid_t	sfork(void);
 #line 125 "../inc/lib.h"
 
 #line 127 "../inc/lib.h"
@@ -123,6 +171,11 @@ envid_t	sfork(void);	// Challenge!
 int	close(int fd);
 ssize_t	read(int fd, void *buf, size_t nbytes);
 ssize_t	write(int fd, const void *buf, size_t nbytes);
+ssize_t	readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t	writev(int fd, const struct iovec *iov, int iovcnt);
+ssize_t	preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+ssize_t	pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+ssize_t	splice(int fdin, int fdout, size_t len);
 int	seek(int fd, off_t offset);
 void	close_all(void);
 ssize_t	readn(int fd, void *buf, size_t nbytes);
@@ -135,6 +188,9 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	fsync(int fd);
+int	fs_cachestat(struct CacheStat *cs);
+int	file_load_program(int fd, envid_t child);
 #line 144 "../inc/lib.h"
 int	copy(char *src, char *dest);
 #line 146 "../inc/lib.h"
@@ -161,12 +217,18 @@ int     nsipc_connect(int s, const struct sockaddr *name, socklen_t namelen);
 int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *buf, int size, unsigned int flags);
+int     nsipc_recvv(int s, const struct iovec *iov, int iovcnt, unsigned int flags);
+int     nsipc_sendv(int s, const struct iovec *iov, int iovcnt, unsigned int flags);
+int     nsipc_recvpages(int s, void *va, int len);
+int     nsipc_sendpages(int s, void *va, int size);
 int     nsipc_socket(int domain, int type, int protocol);
 #line 171 "../inc/lib.h"
 
 // spawn.c
 envid_t	spawn(const char *program, const char **argv);
 envid_t	spawnl(const char *program, const char *arg0, ...);
+envid_t	spawn_template(const char *program, const char **argv);
+int	spawn_template_init(void);
 #line 176 "../inc/lib.h"
 
 #line 178 "../inc/lib.h"
@@ -178,10 +240,30 @@ int	opencons(void);
 
 // pipe.c
 int	pipe(int pipefds[2]);
+int	pipesize(int pipefds[2], size_t size);
 int	pipeisclosed(int pipefd);
 
 // wait.c
-void	wait(envid_t env);
+int	wait(envid_t env);
+
+// sthread.c
+struct Mutex {
+	volatile uint32_t m_state;
+};
+struct Cond {
+	volatile uint32_t c_seq;
+};
+int	sthread_create(envid_t *tid, int (*fn)(void *), void *arg);
+void	sthread_exit(int status) __attribute__((noreturn));
+int	sthread_join(envid_t tid, int *status);
+void	mutex_init(struct Mutex *m);
+void	mutex_lock(struct Mutex *m);
+int	mutex_trylock(struct Mutex *m);
+void	mutex_unlock(struct Mutex *m);
+void	cond_init(struct Cond *c);
+void	cond_wait(struct Cond *c, struct Mutex *m);
+void	cond_signal(struct Cond *c);
+void	cond_broadcast(struct Cond *c);
 #line 191 "../inc/lib.h"
 
 /* File open modes */
@@ -194,5 +276,6 @@ void	wait(envid_t env);
 #define	O_TRUNC		0x0200		/* truncate to zero length */
 #define	O_EXCL		0x0400		/* error if already exists */
 #define O_MKDIR		0x0800		/* create directory, not regular file */
+#define O_BUFFERED	0x1000		/* buffer reads and writes in the client */
 
 #endif	// !JOS_INC_LIB_H
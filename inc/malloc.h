@@ -2,7 +2,25 @@
 #ifndef JOS_INC_MALLOC_H
 #define JOS_INC_MALLOC_H 1
 
+#include <inc/types.h>
+
+// Allocator counters, as returned by malloc_stats.
+struct MallocStats {
+	uint64_t ms_nmalloc;		// Successful allocations
+	uint64_t ms_nfree;		// Blocks freed
+	uint64_t ms_mapcalls;		// Ring submissions mapping heap pages
+	size_t ms_inuse;		// Bytes in live blocks, rounded up
+					// to their size class or to pages
+	size_t ms_slabpages;		// Pages holding small objects
+	size_t ms_runpages;		// Pages in large blocks
+	size_t ms_emptyslabs;		// Slab pages cached for reuse
+};
+
 void *malloc(size_t size);
+void *calloc(size_t nmemb, size_t size);
+void *realloc(void *addr, size_t size);
 void free(void *addr);
+void malloc_stats(struct MallocStats *ms);
+int malloc_share(size_t npages);
 
 #endif
@@ -16,8 +16,8 @@
 // Global descriptor numbers
 #define GD_KT     0x08     // kernel text
 #define GD_KD     0x10     // kernel data
-#define GD_UT     0x18     // user text
-#define GD_UD     0x20     // user data
+#define GD_UD     0x18     // user data
+#define GD_UT     0x20     // user text (must follow GD_UD for SYSRET)
 #define GD_TSS0   0x28     // Task segment selector for CPU 0
 
 /*
@@ -48,6 +48,8 @@
  *    MMIOLIM ------>  +------------------------------+ 0x8003e00000    --+
  *                     |       Memory-mapped I/O      | RW/--  PTSIZE
  * ULIM, MMIOBASE -->  +------------------------------+ 0x8003c00000
+ *                     |     Clock page (User R-)     | R-/R-  PGSIZE
+ *    UCLOCK    ---->  +------------------------------+ 0x8003bff000
  *                     |  PageInfo structs (User R-)  | R-/R-  PTSIZE
  *    UPAGES    ---->  +------------------------------+ 0x8000a00000
  *                     |           RO ENVS            | R-/R-  PTSIZE
@@ -115,6 +117,8 @@
 // User read-only virtual page table (see 'uvpt' below)
 
 #define UVPT    0x10000000000
+// Read-only clock page (see inc/clock.h)
+#define UCLOCK		(ULIM - PGSIZE)
 // Read-only copies of the Page structures
 #define UPAGES		(ULIM - 25 * PTSIZE)
 // Read-only copies of the global env structures
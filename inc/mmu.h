@@ -82,6 +82,13 @@
 // hardware, so user processes are allowed to set them arbitrarily.
 #define PTE_AVAIL	0xE00	// Available for software use
 
+// PTE_SHARE marks pages that fork, spawn and sys_env_clone share
+// rather than copy.  PTE_COW marks copy-on-write page table entries.
+// Both are PTE_AVAIL bits, but the kernel resolves write faults on
+// PTE_COW pages itself (see page_cow) before any user fault handler.
+#define PTE_SHARE	0x400
+#define PTE_COW		0x800
+
 // Flags in PTE_SYSCALL may be used only in system calls. (Others may not.)
 #define PTE_SYSCALL (PTE_AVAIL | PTE_P | PTE_W | PTE_U)
 
@@ -104,6 +111,9 @@
 #define CR0_CD		0x40000000	// Cache Disable
 #define CR0_PG		0x80000000	// Paging
 
+#define CR4_OSXSAVE	0x00040000	// XSAVE and Processor Extended States Enable
+#define CR4_OSXMMEXCPT	0x00000400	// Unmasked SIMD FP Exceptions Support
+#define CR4_OSFXSR	0x00000200	// FXSAVE/FXRSTOR and SSE Support
 #define CR4_PCE		0x00000100	// Performance counter enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
 #define CR4_PSE		0x00000010	// Page Size Extensions
@@ -117,6 +127,14 @@
 #define CR4_PAE		0x00000020
 #define EFER_MSR	0xC0000080
 #define EFER_LME	8
+#define EFER_SCE	0x00000001	// SYSCALL Enable
+
+// SYSCALL/SYSRET MSRs
+#define MSR_STAR	0xC0000081	// Segment selectors
+#define MSR_LSTAR	0xC0000082	// 64-bit SYSCALL target
+#define MSR_FMASK	0xC0000084	// RFLAGS bits cleared by SYSCALL
+#define MSR_GS_BASE	0xC0000101	// GS segment base
+#define MSR_KERNEL_GS_BASE 0xC0000102	// Swapped with MSR_GS_BASE by SWAPGS
 
 // Eflags register
 #define FL_CF		0x00000001	// Carry Flag
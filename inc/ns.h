@@ -28,16 +28,37 @@ enum {
 	NSREQ_SEND,
 	NSREQ_SOCKET,
 
-	// The following two messages pass a page containing a struct jif_pkt
+	// The following two messages pass a page containing a struct jif_pkt.
+	// The input environment now uses NSNOTIFY_INPUT instead.
 	NSREQ_INPUT,
 	// NSREQ_OUTPUT, unlike all other messages, is sent *from* the
 	// network server, to the output environment
 	NSREQ_OUTPUT,
 
-	// The following message passes no page
+	// The following message passes no page.
+	// The timer environment now uses NSNOTIFY_TIMER instead.
 	NSREQ_TIMER,
+
+	// The bulk requests move up to NSBULK_MAXPAGES pages of socket data
+	// in one vectored IPC (ipc_sendv/ipc_recvv).  Send-bulk takes a
+	// Nsreq_send whose data is in the pages following the request page;
+	// recv-bulk takes a Nsreq_recv and replies with the data pages.
+	NSREQ_SEND_BULK,
+	NSREQ_RECV_BULK,
 };
 
+// Notification bits (sys_notify) from the network server's helper
+// environments.  Unlike NSREQ_TIMER and NSREQ_INPUT messages, these
+// never block the sender until the server is ready to receive.
+#define NSNOTIFY_TIMER	0x1	// A timer interval has passed
+#define NSNOTIFY_INPUT	0x2	// Packets are waiting in the input ring
+// ... and from the network server to its input environment.
+#define NSNOTIFY_ROOM	0x4	// A full input ring has room again
+
+// Maximum number of data pages in a bulk request.  The request page
+// travels in the same IPC, so this must be less than IPC_MAXPAGES.
+#define NSBULK_MAXPAGES	15
+
 union Nsipc {
 	struct Nsreq_accept {
 		int req_s;
@@ -1,11 +1,8 @@
-#line 2 "../net/lwip/jos/arch/i386/setjmp.h"
-#ifndef JOS_MACHINE_SETJMP_H
-#define JOS_MACHINE_SETJMP_H
+#ifndef JOS_INC_SETJMP_H
+#define JOS_INC_SETJMP_H
 
 #include <inc/types.h>
 
-#define JOS_LONGJMP_GCCATTR	regparm(2)
-
 struct jos_jmp_buf {
     uint64_t jb_rip;
     uint64_t jb_rsp;
@@ -23,4 +20,8 @@ struct jos_jmp_buf {
     uint64_t jb_r8;
 };
 
+int  jos_setjmp(volatile struct jos_jmp_buf *buf);
+void jos_longjmp(volatile struct jos_jmp_buf *buf, int val)
+	__attribute__((__noreturn__));
+
 #endif
@@ -21,11 +21,30 @@ enum {
 	SYS_yield,
 	SYS_ipc_try_send,
 	SYS_ipc_recv,
+	SYS_ipc_try_sendv,
+	SYS_ipc_recvv,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_ring_enter,
+	SYS_notify,
+	SYS_notify_wait,
+	SYS_notify_take,
+	SYS_env_clone,
+	SYS_env_set_parent,
+	SYS_spawn_from_pages,
+	SYS_env_write,
+	SYS_env_read,
+	SYS_env_exit,
+	SYS_env_wait,
+	SYS_env_keep_zombies,
 #line 26 "../inc/syscall.h"
 	SYS_time_msec,
 #line 28 "../inc/syscall.h"
 	SYS_net_transmit,
 	SYS_net_receive,
+	SYS_disk_read,
+	SYS_disk_write,
+	SYS_disk_wait,
 #line 33 "../inc/syscall.h"
 	SYS_ept_map,
 	SYS_env_mkguest,
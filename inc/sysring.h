@@ -0,0 +1,36 @@
+#ifndef JOS_INC_SYSRING_H
+#define JOS_INC_SYSRING_H
+
+#include <inc/types.h>
+
+// A system call submission ring.  User space queues system call
+// descriptors at sr_tail; sys_ring_enter runs every entry from sr_head
+// up to sr_tail in a single kernel entry and stores each result in the
+// entry's se_result.  Only calls that always return to the caller may
+// be queued (see sysring_allowed in kern/syscall.c); others complete
+// with -E_INVAL.
+
+#define SYSRING_SIZE	64		// Entries in the ring
+
+// Flags for SysringEntry.se_flags
+#define SYSRING_LINK	0x1		// Cancel the rest of the chain if
+					// this entry fails
+#define SYSRING_ARG(i)	(0x100 << (i))	// Replace argument i (1..5) with
+					// the previous entry's result
+
+struct SysringEntry {
+	uint32_t se_num;		// System call number
+	uint32_t se_flags;		// SYSRING_* flags
+	uint64_t se_args[5];		// Arguments a1..a5
+	int64_t se_result;		// Return value, set by the kernel
+};
+
+struct Sysring {
+	uint32_t sr_head;		// Next entry for the kernel to run
+	uint32_t sr_tail;		// Next entry for user space to fill
+	int64_t sr_prev;		// Result of the last entry run
+	uint32_t sr_cancel;		// Skipping the rest of a failed chain
+	struct SysringEntry sr_ent[SYSRING_SIZE];
+};
+
+#endif // !JOS_INC_SYSRING_H
@@ -1,20 +1,27 @@
-#line 2 "../net/lwip/jos/arch/thread.h"
-#ifndef LWIP_ARCH_THREAD_H
-#define LWIP_ARCH_THREAD_H
+#ifndef JOS_INC_THREAD_H
+#define JOS_INC_THREAD_H
 
 #include <inc/types.h>
+#include <inc/env.h>
+
+// Cooperative ("green") threads within one environment; see lib/thread.c.
 
 typedef uint32_t thread_id_t;
 
 void thread_init(void);
 thread_id_t thread_id(void);
+bool thread_active(void);
 void thread_wakeup(volatile uint32_t *addr);
 void thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec);
+void thread_sleep(uint32_t msec);
 int thread_wakeups_pending(void);
 int thread_onhalt(void (*fun)(thread_id_t));
 int thread_create(thread_id_t *tid, const char *name, 
 		void (*entry)(uint64_t), uint64_t arg);
 void thread_yield(void);
 void thread_halt(void);
+int32_t thread_ipc_recv(envid_t from, void *pg, size_t maxpages,
+		size_t *npages_store);
+int32_t thread_ipc_call(envid_t to, uint32_t type, void *req, void *dstva);
 
 #endif
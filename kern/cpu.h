@@ -3,6 +3,12 @@
 #ifndef JOS_INC_CPU_H
 #define JOS_INC_CPU_H
 
+// Offsets of the struct CpuInfo fields used from assembly through %gs.
+#define CPUINFO_SELF		0x0
+#define CPUINFO_KSTACKTOP	0x8
+
+#ifndef __ASSEMBLER__
+
 #include <inc/types.h>
 #include <inc/memlayout.h>
 #include <inc/mmu.h>
@@ -23,10 +29,14 @@ enum {
 
 // Per-CPU state
 struct CpuInfo {
+	struct CpuInfo *cpu_self;       // Points to itself; see thiscpu
+	uintptr_t cpu_kstacktop;        // Top of this CPU's kernel stack
 	uint8_t cpu_id;                 // Local APIC ID; index into cpus[] below
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+	struct Trapframe *cpu_syscall_tf; // Unsaved SYSCALL frame, if any
+	struct Env *cpu_fpu_env;        // Env whose FPU state is loaded, if any
 #line 34 "../kern/cpu.h"
     bool is_vmx_root;               // Is the CPU in VMX root mode?
     uintptr_t vmxon_region;         // KVA of vmxon region.
@@ -38,12 +48,30 @@ extern struct CpuInfo cpus[NCPU];
 extern int ncpu;                    // Total number of CPUs in the system
 extern struct CpuInfo *bootcpu;     // The boot-strap processor (BSP)
 extern physaddr_t lapicaddr;        // Physical MMIO address of the local APIC
+extern physaddr_t ioapicaddr;       // Physical MMIO address of the I/O APIC
 
 // Per-CPU kernel stacks
 extern unsigned char percpu_kstacks[NCPU][KSTKSIZE];
 
 int cpunum(void);
+
+#ifndef VMM_GUEST
+// While in the kernel, each CPU's GS base points at its own CpuInfo
+// (set by trap_init_percpu), so finding it takes a single %gs-relative
+// load rather than a LAPIC ID read.  User GS is swapped in with swapgs
+// on the way out to user mode and back out on kernel entry.
+static __inline struct CpuInfo *
+cpu_self(void)
+{
+	struct CpuInfo *c;
+
+	__asm("movq %%gs:%c1,%0" : "=r" (c) : "i" (CPUINFO_SELF));
+	return c;
+}
+#define thiscpu (cpu_self())
+#else
 #define thiscpu (&cpus[cpunum()])
+#endif
 
 void mp_init(void);
 void lapic_init(void);
@@ -51,4 +79,6 @@ void lapic_startap(uint8_t apicid, uint32_t addr);
 void lapic_eoi(void);
 void lapic_ipi(int vector);
 
+#endif /* !__ASSEMBLER__ */
+
 #endif
@@ -211,8 +211,9 @@ e1000_transmit(const char *buf, unsigned int len)
 		return 0;
 	}
 
-	// Fill in the next descriptor
-	memmove(tx_data[tail], buf, len);
+	// Fill in the next descriptor.  buf is a user address.
+	if (copy_from_user(tx_data[tail], buf, len) < 0)
+		return -E_FAULT;
 	tx_ring[tail].length = len;
 	tx_ring[tail].status &= ~E1000_TXD_STAT_DD;
 	// Set EOP to actually send this packet.  Set RS to get DD
@@ -238,9 +239,11 @@ e1000_receive(char *buf, unsigned int len)
 		return 0;
 	assert(rx_ring[tail].status & E1000_RXD_STAT_EOP);
 
-	// Copy the packet data
+	// Copy the packet data to the user's buffer.  On a fault, leave
+	// the packet in the ring for the next try.
 	len = MIN(len, rx_ring[tail].length);
-	memmove(buf, rx_data[tail], len);
+	if (copy_to_user(buf, rx_data[tail], len) < 0)
+		return -E_FAULT;
 	rx_ring[tail].status = 0;
 
 	// Move the tail pointer
@@ -18,6 +18,9 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/futex.h>
+#include <kern/time.h>
+#include <kern/fpu.h>
 #line 23 "../kern/env.c"
 #include <vmm/vmx.h>
 #include <vmm/ept.h>
@@ -30,6 +33,7 @@ struct Env *envs = NULL;		// All environments
 #line 34 "../kern/env.c"
 static struct Env *env_free_list;	// Free environment list
 // (linked by Env->env_link)
+static int notify_ntimed;		// Envs in sys_notify_wait with a timeout
 
 #define ENVGENSHIFT	12		// >= LOGNENV
 
@@ -62,12 +66,12 @@ struct Segdesc gdt[2*NCPU + 5] =
 	// 0x10 - kernel data segment
 	[GD_KD >> 3] = SEG64(STA_W, 0x0, 0xffffffff,0),
 
-	// 0x18 - user code segment
-	[GD_UT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xffffffff,3),
-
-	// 0x20 - user data segment
+	// 0x18 - user data segment
 	[GD_UD >> 3] = SEG64(STA_W, 0x0, 0xffffffff,3),
 
+	// 0x20 - user code segment
+	[GD_UT >> 3] = SEG64(STA_X | STA_R, 0x0, 0xffffffff,3),
+
 #line 77 "../kern/env.c"
 	// Per-CPU TSS descriptors (starting from GD_TSS0) are initialized
 	// in trap_init_percpu()
@@ -106,8 +110,10 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	// to ensure that the envid is not stale
 	// (i.e., does not refer to a _previous_ environment
 	// that used the same slot in the envs[] array).
+	// A zombie has only its exit status left; see sys_env_wait.
 	e = &envs[ENVX(envid)];
-	if (e->env_status == ENV_FREE || e->env_id != envid) {
+	if (e->env_status == ENV_FREE || e->env_status == ENV_ZOMBIE
+	    || e->env_id != envid) {
 		*env_store = 0;
 		return -E_BAD_ENV;
 	}
@@ -126,6 +132,125 @@ envid2env(envid_t envid, struct Env **env_store, bool checkperm)
 	return 0;
 }
 
+// Set 'bits' in e's pending notification word, waking e if it is
+// blocked in sys_notify_wait for any of the now pending bits.
+void
+env_notify(struct Env *e, uint64_t bits)
+{
+	e->env_notify_bits |= bits;
+	if (e->env_notify_mask & e->env_notify_bits) {
+		e->env_notify_mask = 0;
+		e->env_notify_deadline = 0;
+		e->env_ipc_recving = 0;
+		e->env_ipc_from = 0;
+		e->env_ipc_value = 0;
+		e->env_ipc_perm = 0;
+		e->env_ipc_npages = 0;
+		e->env_tf.tf_regs.reg_rax = 1;
+		e->env_status = ENV_RUNNABLE;
+	}
+}
+
+// Give up e's sys_notify_wait after 'timeout' milliseconds, if nonzero.
+void
+env_notify_timeout(struct Env *e, unsigned timeout)
+{
+	e->env_notify_deadline = 0;
+	if (timeout) {
+		e->env_notify_deadline = time_msec() + timeout;
+		if (!e->env_notify_deadline)
+			e->env_notify_deadline = 1;
+		notify_ntimed++;
+	}
+}
+
+// Time out sys_notify_wait calls whose deadline has passed.
+// Called once per timer tick, after time_tick.
+void
+env_notify_tick(void)
+{
+	struct Env *e;
+	unsigned now;
+	int i, n = 0;
+
+	if (!notify_ntimed)
+		return;
+	now = time_msec();
+	for (i = 0; i < NENV; i++) {
+		e = &envs[i];
+		if (!e->env_notify_deadline)
+			continue;
+		if (e->env_status != ENV_NOT_RUNNABLE)
+			e->env_notify_deadline = 0;
+		else if ((int) (now - e->env_notify_deadline) >= 0) {
+			e->env_notify_deadline = 0;
+			e->env_notify_mask = 0;
+			e->env_ipc_recving = 0;
+			e->env_tf.tf_regs.reg_rax = -E_TIMEOUT;
+			e->env_status = ENV_RUNNABLE;
+		} else
+			n++;
+	}
+	notify_ntimed = n;
+}
+
+// Returns true if some env is in sys_notify_wait with a timeout.
+bool
+env_notify_timeouts_pending(void)
+{
+	return notify_ntimed > 0;
+}
+
+// Return e, which has exited, to the free list.
+void
+env_reap(struct Env *e)
+{
+	e->env_status = ENV_FREE;
+	e->env_link = env_free_list;
+	env_free_list = e;
+}
+
+// Called once e's resources have been freed: hand its exit status to
+// every env blocked in sys_env_wait on it, and tell its parent it is
+// gone.  If the parent asked for zombies (sys_env_keep_zombies) and was
+// not one of those waiters, e then stays an ENV_ZOMBIE holding its
+// status until the parent reaps it with sys_env_wait or exits itself.
+// Otherwise e goes straight back to the free list, as do e's own zombie
+// children, which nobody can reap now.
+static void
+env_exited(struct Env *e)
+{
+	struct Env *w, *p;
+	bool reaped = 0;
+	int i;
+
+	for (i = 0; i < NENV; i++) {
+		w = &envs[i];
+		if (w->env_status == ENV_NOT_RUNNABLE
+		    && w->env_wait_envid == e->env_id) {
+			w->env_wait_envid = 0;
+			w->env_wait_status = e->env_exit_status;
+			w->env_tf.tf_regs.reg_rax = 0;
+			w->env_status = ENV_RUNNABLE;
+			if (w->env_id == e->env_parent_id)
+				reaped = 1;
+		} else if (w->env_status == ENV_ZOMBIE
+			   && w->env_parent_id == e->env_id)
+			env_reap(w);
+	}
+
+	p = &envs[ENVX(e->env_parent_id)];
+	if (e->env_parent_id && p->env_id == e->env_parent_id
+	    && p->env_status != ENV_FREE && p->env_status != ENV_ZOMBIE) {
+		env_notify(p, NOTIFY_CHILD_EXIT);
+		if (!reaped && p->env_keep_zombies) {
+			e->env_status = ENV_ZOMBIE;
+			return;
+		}
+	}
+	env_reap(e);
+}
+
 // Mark all environments in 'envs' as free, set their env_ids to 0,
 // and insert them into the env_free_list.
 // Make sure the environments are in the free list in the same order
@@ -157,8 +282,9 @@ env_init_percpu(void)
 {
 	lgdt(&gdt_pd);
 
-	// The kernel never uses GS or FS, so we leave those set to
-	// the user data segment.
+	// The kernel never uses FS, and only uses GS through its base
+	// MSRs (see trap_init_percpu), so we leave those set to the user
+	// data segment.
 	asm volatile("movw %%ax,%%gs" :: "a" (GD_UD|3));
 	asm volatile("movw %%ax,%%fs" :: "a" (GD_UD|3));
 	// The kernel does use ES, DS, and SS.  We'll change between
@@ -311,7 +437,15 @@ env_guest_alloc(struct Env **newenv_store, envid_t parent_id)
 	memset(&e->env_tf, 0, sizeof(e->env_tf));
 
 	e->env_pgfault_upcall = 0;
+	e->env_fpu = NULL;
 	e->env_ipc_recving = 0;
+	e->env_notify_bits = 0;
+	e->env_notify_mask = 0;
+	e->env_notify_deadline = 0;
+	e->env_exit_status = -1;
+	e->env_wait_envid = 0;
+	e->env_wait_status = 0;
+	e->env_keep_zombies = 0;
 
 	// commit the allocation
 	env_free_list = e->env_link;
@@ -338,10 +472,9 @@ void env_guest_free(struct Env *e) {
 	e->env_pml4e = 0;
 	e->env_cr3 = 0;
 
-	// return the environment to the free list
-	e->env_status = ENV_FREE;
-	e->env_link = env_free_list;
-	env_free_list = e;
+	// Wake envs blocked in sys_env_wait, notify the parent, and
+	// return the environment to the free list once it is reaped.
+	env_exited(e);
 
 	cprintf("[%08x] free vmx guest env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 }
@@ -412,9 +545,17 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Clear the page fault handler until user installs one.
 	e->env_pgfault_upcall = 0;
+	e->env_fpu = NULL;
 
-	// Also clear the IPC receiving flag.
+	// Also clear the IPC receiving flag and any notifications.
 	e->env_ipc_recving = 0;
+	e->env_notify_bits = 0;
+	e->env_notify_mask = 0;
+	e->env_notify_deadline = 0;
+	e->env_exit_status = -1;
+	e->env_wait_envid = 0;
+	e->env_wait_status = 0;
+	e->env_keep_zombies = 0;
 
 #line 427 "../kern/env.c"
 	// commit the allocation
@@ -554,11 +695,9 @@ env_create(uint8_t *binary, enum EnvType type)
 	e->env_type = type;
 #line 601 "../kern/env.c"
 
-	// If this is the file server (type == ENV_TYPE_FS) give it I/O privileges.
-	// LAB 5: Your code here.
 #line 605 "../kern/env.c"
-	if (type == ENV_TYPE_FS)
-		e->env_tf.tf_eflags |= FL_IOPL_3;
+	// The file server reaches the disk through sys_disk_read and
+	// sys_disk_write, so it needs no I/O privilege.
 #line 609 "../kern/env.c"
 }
 
@@ -571,6 +710,9 @@ env_free(struct Env *e)
 	pte_t *pt;
 	uint64_t pdeno, pteno;
 	physaddr_t pa;
+	int i;
+
+	fpu_free(e);
 
 #line 622 "../kern/env.c"
 #ifndef VMM_GUEST 
@@ -587,6 +729,15 @@ env_free(struct Env *e)
 	if (e == curenv)
 		lcr3(boot_cr3);
 
+	// Stop waiting on any futex.
+	futex_cancel(e);
+
+	// Templates die with the environment that owns them.
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_status == ENV_TEMPLATE
+		    && envs[i].env_parent_id == e->env_id)
+			env_free(&envs[i]);
+
 	// Note the environment's demise.
 #line 638 "../kern/env.c"
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
@@ -638,10 +789,9 @@ env_free(struct Env *e)
 	e->env_cr3 = 0;
 	page_decref(pa2page(pa));
 
-	// return the environment to the free list
-	e->env_status = ENV_FREE;
-	e->env_link = env_free_list;
-	env_free_list = e;
+	// Wake envs blocked in sys_env_wait, notify the parent, and
+	// return the environment to the free list once it is reaped.
+	env_exited(e);
 }
 
 //
@@ -683,7 +833,7 @@ env_pop_tf(struct Trapframe *tf)
 {
 #line 739 "../kern/env.c"
 	// Record the CPU we are running on for user-space debugging
-	curenv->env_cpunum = cpunum();
+	curenv->env_cpunum = thiscpu->cpu_id;
 #line 742 "../kern/env.c"
 	__asm __volatile("movq %0,%%rsp\n"
 			 POPA
@@ -691,6 +841,9 @@ env_pop_tf(struct Trapframe *tf)
 			 "movw 8(%%rsp),%%ds\n"
 			 "addq $16,%%rsp\n"
 			 "\taddq $16,%%rsp\n" /* skip tf_trapno and tf_errcode */
+#ifndef VMM_GUEST
+			 "\tswapgs\n"
+#endif
 			 "\tiretq"
 			 : : "g" (tf) : "memory");
 	panic("iret failed");  /* mostly to placate the compiler */
@@ -708,6 +861,8 @@ env_run(struct Env *e)
 #line 763 "../kern/env.c"
 	// Is this a context switch or just a return?
 	if (curenv != e) {
+		// Put away the old env's FPU state; e's is loaded lazily.
+		fpu_save();
 		if (curenv && curenv->env_status == ENV_RUNNING)
 			curenv->env_status = ENV_RUNNABLE;
 
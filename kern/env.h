@@ -21,6 +21,11 @@ int	env_alloc(struct Env **e, envid_t parent_id);
 void	env_free(struct Env *e);
 void	env_create(uint8_t *binary, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
+void	env_reap(struct Env *e);
+void	env_notify(struct Env *e, uint64_t bits);
+void	env_notify_timeout(struct Env *e, unsigned timeout);
+void	env_notify_tick(void);
+bool	env_notify_timeouts_pending(void);
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 // The following two functions do not return
@@ -0,0 +1,191 @@
+// Lazy saving and restoring of user FPU/SSE/AVX state.
+//
+// An env's x87, SSE and (with XSAVE) AVX registers are saved in a page
+// hanging off env_fpu, allocated the first time the env touches the
+// FPU.  The registers of at most one env, thiscpu->cpu_fpu_env, are
+// live on each CPU; CR0.TS is clear exactly when there is one.  With
+// TS set, the env's first FPU instruction raises T_DEVICE, and
+// fpu_trap loads its state.  Envs that never use the FPU are never
+// saved or restored.
+//
+// Live state never outlives the env's time slice on a CPU: env_run
+// saves it (fpu_save) when switching to another env, so an env's
+// state is always in env_fpu by the time another CPU can run it.
+//
+// The kernel itself is built without SSE, so it never disturbs the
+// user's registers.
+//
+// VMX guests are not covered: vmx_vmrun never enters a guest in this
+// tree, so their FPU state is left to whoever completes it.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/fpu.h>
+#include <kern/pmap.h>
+
+#define CPUID1_ECX_XSAVE	(1 << 26)
+#define CPUID1_ECX_AVX		(1 << 28)
+#define CPUID1_EDX_FXSR		(1 << 24)
+
+#define XCR0_X87	0x1
+#define XCR0_SSE	0x2
+#define XCR0_AVX	0x4
+
+static bool fpu_xsave;		// Use XSAVE rather than FXSAVE
+static uint64_t fpu_xcr0;	// State components XSAVE saves
+
+static void
+xsetbv(uint32_t reg, uint64_t val)
+{
+	asm volatile("xsetbv" : : "c" (reg), "a" ((uint32_t) val),
+		     "d" ((uint32_t) (val >> 32)));
+}
+
+// Enable FXSAVE and SSE, and XSAVE and AVX where the CPU has them, on
+// this CPU.  Every CPU starts out with no env's FPU state loaded.
+void
+fpu_init(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid_count(1, 0, &eax, &ebx, &ecx, &edx);
+	if (!(edx & CPUID1_EDX_FXSR))
+		panic("fpu_init: CPU has no FXSAVE");
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+#ifndef VMM_GUEST
+	// XSETBV always exits to the VMM, which doesn't handle it,
+	// so guests stick to FXSAVE.
+	if (ecx & CPUID1_ECX_XSAVE) {
+		fpu_xsave = 1;
+		fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+		if (ecx & CPUID1_ECX_AVX)
+			fpu_xcr0 |= XCR0_AVX;
+		lcr4(rcr4() | CR4_OSXSAVE);
+		xsetbv(0, fpu_xcr0);
+
+		// EBX is the save area size for the components in XCR0.
+		cpuid_count(0xD, 0, &eax, &ebx, &ecx, &edx);
+		if (ebx > PGSIZE)
+			panic("fpu_init: XSAVE area is %d bytes", ebx);
+	}
+#endif
+
+	lcr0((rcr0() | CR0_MP | CR0_TS) & ~CR0_EM);
+	thiscpu->cpu_fpu_env = NULL;
+}
+
+static void
+fpu_save_area(void *area)
+{
+	if (fpu_xsave)
+		asm volatile("xsave64 %0" : "=m" (*(char (*)[PGSIZE]) area)
+			     : "a" ((uint32_t) fpu_xcr0),
+			       "d" ((uint32_t) (fpu_xcr0 >> 32)));
+	else
+		asm volatile("fxsave64 %0" : "=m" (*(char (*)[512]) area));
+}
+
+static void
+fpu_restore_area(void *area)
+{
+	if (fpu_xsave)
+		asm volatile("xrstor64 %0" : : "m" (*(char (*)[PGSIZE]) area),
+			     "a" ((uint32_t) fpu_xcr0),
+			     "d" ((uint32_t) (fpu_xcr0 >> 32)));
+	else
+		asm volatile("fxrstor64 %0" : : "m" (*(char (*)[512]) area));
+}
+
+// Allocate e's save area, holding the state a freshly reset FPU would
+// have (with all exceptions masked).  Returns 0 or -E_NO_MEM.
+static int
+fpu_alloc(struct Env *e)
+{
+	struct PageInfo *pp;
+	uint8_t *area;
+
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	pp->pp_ref++;
+	area = page2kva(pp);
+	// The legacy region is laid out the same way for FXSAVE and
+	// XSAVE; an all-zero XSAVE header means every other component is
+	// in its initial state.
+	*(uint16_t *) (area + 0) = 0x037F;	// FCW
+	*(uint32_t *) (area + 24) = 0x1F80;	// MXCSR
+	e->env_fpu = area;
+	return 0;
+}
+
+// Make e's FPU state live on this CPU, saving whoever else's is.
+void
+fpu_load(struct Env *e)
+{
+	if (thiscpu->cpu_fpu_env == e)
+		return;
+	fpu_save();
+	if (!e->env_fpu && fpu_alloc(e) < 0) {
+		cprintf("[%08x] out of memory for FPU state\n", e->env_id);
+		env_destroy(e);
+	}
+	lcr0(rcr0() & ~CR0_TS);
+	fpu_restore_area(e->env_fpu);
+	thiscpu->cpu_fpu_env = e;
+}
+
+// Handle T_DEVICE from user mode: curenv used the FPU with CR0.TS set.
+void
+fpu_trap(void)
+{
+	fpu_load(curenv);
+}
+
+// Save the live FPU state on this CPU, if any, back to its env and set
+// CR0.TS again.
+void
+fpu_save(void)
+{
+	struct Env *e = thiscpu->cpu_fpu_env;
+
+	if (!e)
+		return;
+	fpu_save_area(e->env_fpu);
+	lcr0(rcr0() | CR0_TS);
+	thiscpu->cpu_fpu_env = NULL;
+}
+
+// Give dst a copy of src's FPU state, as fork expects.
+// Returns 0 on success, -E_NO_MEM if out of memory.
+int
+fpu_copy(struct Env *dst, struct Env *src)
+{
+	int r;
+
+	if (!src->env_fpu)
+		return 0;
+	if (thiscpu->cpu_fpu_env == src)
+		fpu_save_area(src->env_fpu);
+	if (!dst->env_fpu && (r = fpu_alloc(dst)) < 0)
+		return r;
+	memmove(dst->env_fpu, src->env_fpu, PGSIZE);
+	return 0;
+}
+
+// Free e's FPU state.  If it is live on this CPU, just forget it.
+void
+fpu_free(struct Env *e)
+{
+	if (thiscpu->cpu_fpu_env == e) {
+		lcr0(rcr0() | CR0_TS);
+		thiscpu->cpu_fpu_env = NULL;
+	}
+	if (e->env_fpu) {
+		page_decref(pa2page(PADDR(e->env_fpu)));
+		e->env_fpu = NULL;
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <kern/env.h>
+
+void fpu_init(void);
+void fpu_trap(void);
+void fpu_load(struct Env *e);
+void fpu_save(void);
+int fpu_copy(struct Env *dst, struct Env *src);
+void fpu_free(struct Env *e);
+
+#endif	// !JOS_KERN_FPU_H
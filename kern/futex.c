@@ -0,0 +1,206 @@
+// Futexes: wait queues for user-space synchronization.
+//
+// A futex is identified by the physical address of an aligned 32-bit
+// word, so envs that share a page (for example PTE_SHARE pipe pages)
+// wait on the same futex no matter where each one maps it.
+//
+// An env blocked in futex_wait is ENV_NOT_RUNNABLE, so the scheduler
+// passes over it, and is linked through env_futex_link on one of
+// FUTEX_NHASH wait queues.  The queues are hashed by physical page so
+// that futex_wake_page only has to look at one of them.
+
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/memlayout.h>
+
+#include <kern/futex.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/time.h>
+
+#define FUTEX_NHASH	64
+
+static struct Env *futex_queues[FUTEX_NHASH];
+static int futex_nwaiters;	// Envs on any queue
+static int futex_ntimed;	// Envs on any queue with a deadline
+
+static struct Env **
+futex_queue(physaddr_t key)
+{
+	return &futex_queues[PGNUM(key) % FUTEX_NHASH];
+}
+
+// Translate the user address 'va' in 'e' to a futex key.
+// Returns -E_INVAL if 'va' is misaligned or above ULIM, and -E_FAULT if
+// it isn't mapped user-accessible.
+static int
+futex_key(struct Env *e, const void *va, physaddr_t *key)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	if ((uintptr_t) va >= ULIM || ((uintptr_t) va & 3))
+		return -E_INVAL;
+	if (!(pp = page_lookup(e->env_pml4e, (void *) va, &pte))
+	    || !(*pte & PTE_U))
+		return -E_FAULT;
+	*key = page2pa(pp) + PGOFF(va);
+	return 0;
+}
+
+// Remove the waiter at *link from its queue and make it runnable,
+// returning 'ret' from its sys_futex_wait.
+static void
+futex_dequeue(struct Env **link, int ret)
+{
+	struct Env *e = *link;
+
+	*link = e->env_futex_link;
+	e->env_futex_link = NULL;
+	e->env_futex_key = 0;
+	if (e->env_futex_deadline)
+		futex_ntimed--;
+	e->env_futex_deadline = 0;
+	futex_nwaiters--;
+	e->env_tf.tf_regs.reg_rax = ret;
+	e->env_status = ENV_RUNNABLE;
+}
+
+// Block 'e' (which must be curenv) until a futex_wake on 'va', provided
+// the word at 'va' still holds 'expected'.  If 'timeout' is nonzero, give
+// up after that many milliseconds.
+//
+// Does not return on success; the system call eventually returns 0 when
+// woken or -E_TIMEOUT when the timeout expires.  Returns < 0 on error:
+//	-E_INVAL, -E_FAULT if 'va' is not a valid futex address (see futex_key).
+//	-E_AGAIN if the word at 'va' does not hold 'expected'.
+int
+futex_wait(struct Env *e, const void *va, uint32_t expected, unsigned timeout)
+{
+	struct Env **link;
+	physaddr_t key;
+	int r;
+
+	assert(e == curenv);
+	if ((r = futex_key(e, va, &key)) < 0)
+		return r;
+	if (*(volatile uint32_t *) KADDR(key) != expected)
+		return -E_AGAIN;
+
+	// Append, so that waiters are woken in FIFO order.
+	for (link = futex_queue(key); *link; link = &(*link)->env_futex_link)
+		/* do nothing */;
+	*link = e;
+	e->env_futex_link = NULL;
+	e->env_futex_key = key;
+	e->env_futex_deadline = 0;
+	if (timeout) {
+		e->env_futex_deadline = time_msec() + timeout;
+		if (!e->env_futex_deadline)
+			e->env_futex_deadline = 1;
+		futex_ntimed++;
+	}
+	futex_nwaiters++;
+
+	e->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Wake up to 'n' envs waiting on the futex at physical address 'key'.
+// Returns the number of envs woken.
+int
+futex_wake_key(physaddr_t key, int n)
+{
+	struct Env **link;
+	int woken = 0;
+
+	link = futex_queue(key);
+	while (*link && woken < n) {
+		if ((*link)->env_futex_key == key) {
+			futex_dequeue(link, 0);
+			woken++;
+		} else
+			link = &(*link)->env_futex_link;
+	}
+	return woken;
+}
+
+// Wake up to 'n' envs waiting on the futex at user address 'va' in 'e'.
+// Returns the number of envs woken, or < 0 if 'va' is not a valid futex
+// address (see futex_key).
+int
+futex_wake(struct Env *e, const void *va, int n)
+{
+	physaddr_t key;
+	int r;
+
+	if ((r = futex_key(e, va, &key)) < 0)
+		return r;
+	return futex_wake_key(key, n);
+}
+
+// Wake every env waiting on a futex in the physical page at 'pa'.
+// Called when a mapping of the page goes away, so that user code that
+// compares page reference counts (as pipes do to notice a closed end)
+// gets to look again.
+void
+futex_wake_page(physaddr_t pa)
+{
+	struct Env **link;
+
+	if (!futex_nwaiters)
+		return;
+	link = futex_queue(pa);
+	while (*link) {
+		if (PTE_ADDR((*link)->env_futex_key) == PTE_ADDR(pa))
+			futex_dequeue(link, 0);
+		else
+			link = &(*link)->env_futex_link;
+	}
+}
+
+// Take 'e' off its futex queue, if it is on one.  Used when freeing 'e'.
+void
+futex_cancel(struct Env *e)
+{
+	struct Env **link;
+
+	if (!e->env_futex_key)
+		return;
+	for (link = futex_queue(e->env_futex_key); *link != e;
+	     link = &(*link)->env_futex_link)
+		assert(*link);
+	futex_dequeue(link, 0);
+}
+
+// Time out waiters whose deadline has passed.
+// Called once per timer tick, after time_tick.
+void
+futex_tick(void)
+{
+	struct Env **link;
+	unsigned now;
+	int i;
+
+	if (!futex_ntimed)
+		return;
+	now = time_msec();
+	for (i = 0; i < FUTEX_NHASH; i++) {
+		link = &futex_queues[i];
+		while (*link) {
+			if ((*link)->env_futex_deadline
+			    && (int) (now - (*link)->env_futex_deadline) >= 0)
+				futex_dequeue(link, -E_TIMEOUT);
+			else
+				link = &(*link)->env_futex_link;
+		}
+	}
+}
+
+// Returns true if some env is waiting on a futex with a timeout, and so
+// will become runnable again without any other env's help.
+bool
+futex_timeouts_pending(void)
+{
+	return futex_ntimed > 0;
+}
@@ -0,0 +1,19 @@
+#ifndef JOS_KERN_FUTEX_H
+#define JOS_KERN_FUTEX_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <kern/env.h>
+
+int futex_wait(struct Env *e, const void *va, uint32_t expected,
+	       unsigned timeout);
+int futex_wake(struct Env *e, const void *va, int n);
+int futex_wake_key(physaddr_t key, int n);
+void futex_wake_page(physaddr_t pa);
+void futex_cancel(struct Env *e);
+void futex_tick(void);
+bool futex_timeouts_pending(void);
+
+#endif	// !JOS_KERN_FUTEX_H
@@ -0,0 +1,342 @@
+// Bus-master DMA driver for the primary channel of a PIIX IDE
+// controller, which is what QEMU emulates.
+//
+// Each request moves up to 256 sectors straight between the disk and
+// the pages of a user buffer, one PRD table entry per page, so the file
+// server neither copies the data nor spins on the status port.  The
+// requesting env sleeps until the drive's interrupt (IRQ 14) says the
+// command is done, or, for an asynchronous write, goes on at once and
+// collects the outcome of all its writes later with ide_wait.  Requests
+// that come in while the controller is busy wait their turn in a short
+// queue, and so does one that finds the drive still busy: the clock
+// tick starts it later rather than the kernel spinning on BSY.  Only
+// the file server may use the disk.
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/trap.h>
+#include <kern/ide.h>
+#include <kern/pcireg.h>
+#include <kern/pmap.h>
+#include <kern/env.h>
+#include <kern/sched.h>
+#include <kern/picirq.h>
+
+#define SECTSIZE	512
+#define IDE_MAXSECTS	256	// Most sectors one command moves
+#define IDE_MAXPAGES	(IDE_MAXSECTS * SECTSIZE / PGSIZE)
+#define IDE_QLEN	8	// Requests that can wait for the controller
+
+// Primary channel command block and control registers
+#define IDE_NSECT	0x1F2
+#define IDE_LBA0	0x1F3
+#define IDE_LBA1	0x1F4
+#define IDE_LBA2	0x1F5
+#define IDE_DRIVE	0x1F6
+#define IDE_CMD		0x1F7	// Command when written, status when read
+#define IDE_CTL		0x3F6	// Device control; bit 1 (nIEN) masks the IRQ
+
+#define IDE_BSY		0x80
+#define IDE_DF		0x20
+#define IDE_ERR		0x01
+
+#define IDE_CMD_READ_DMA	0xC8
+#define IDE_CMD_WRITE_DMA	0xCA
+
+// [PIIX 2.7] Bus master registers of the primary channel, at the I/O
+// base in BAR 4
+#define BM_CMD		0x0
+#define BM_STATUS	0x2
+#define BM_PRDT		0x4	// Physical address of the PRD table
+
+#define BM_CMD_START	0x01
+#define BM_CMD_TOMEM	0x08	// Transfer is a disk read, into memory
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERR	0x02	// Write 1 to clear
+#define BM_STATUS_INTR	0x04	// Write 1 to clear
+
+// Physical region descriptor: one physically contiguous piece of the
+// buffer, below 4GB
+struct ide_prd {
+	uint32_t prd_addr;
+	uint16_t prd_len;	// Bytes; 0 means 64K
+	uint16_t prd_flags;
+} __attribute__((packed));
+
+#define PRD_EOT		0x8000	// Last entry in the table
+
+struct ide_req {
+	envid_t r_envid;	// Env to wake when done, 0 if asynchronous
+	int r_diskno;
+	uint32_t r_secno;
+	uint32_t r_nsecs;
+	bool r_write;
+	size_t r_npages;
+	struct PageInfo *r_pages[IDE_MAXPAGES];
+};
+
+static uint16_t bmbase;		// Bus master I/O base, 0 if no controller
+
+// The PRD table must not cross a 64K boundary.
+static struct ide_prd prdt[IDE_MAXPAGES] __attribute__((aligned(PGSIZE)));
+
+// queue[qhead] is the next command to finish whenever qlen > 0, and
+// 'running' says whether it has been started.
+static struct ide_req queue[IDE_QLEN];
+static int qhead, qlen;
+static bool running;
+
+static bool disk1;		// Whether there is a drive 1
+static int nasync;		// Asynchronous requests in the queue
+static int async_err;		// First error of one since the last ide_wait
+static envid_t async_waiter;	// Env in ide_wait, 0 if none
+
+// Select drive 'diskno' and see whether it becomes ready within a
+// bounded number of status reads.  Only ide_attach spins like this.
+static bool
+ide_probe(int diskno)
+{
+	int x;
+
+	for (x = 0; x < 100000 && (inb(IDE_CMD) & IDE_BSY); x++)
+		/* do nothing */;
+	outb(IDE_DRIVE, 0xE0 | (diskno << 4));
+	for (x = 0;
+	     x < 1000 && (inb(IDE_CMD) & (IDE_BSY|IDE_DF|IDE_ERR)) != 0;
+	     x++)
+		/* do nothing */;
+	outb(IDE_DRIVE, 0xE0);
+	return x < 1000;
+}
+
+int
+ide_attach(struct pci_func *pcif)
+{
+	pci_func_enable(pcif);
+
+	// [PIIX 2.3] Interface bit 0 set means the primary channel is in
+	// native mode, away from the legacy ports and IRQ 14.
+	if ((PCI_INTERFACE(pcif->dev_class) & 1) || !pcif->reg_base[4]) {
+		cprintf("ide: no compatibility-mode bus master, using PIO\n");
+		return 0;
+	}
+	bmbase = pcif->reg_base[4];
+	disk1 = ide_probe(1);
+	cprintf("ide: drive 1 presence: %d\n", disk1);
+
+	outb(bmbase + BM_CMD, 0);
+	outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+	outl(bmbase + BM_PRDT, PADDR(prdt));
+	outb(IDE_CTL, 0);
+	if (ioapic_enable(IRQ_IDE) < 0)
+		irq_setmask_8259A(irq_mask_8259A & ~(1 << IRQ_IDE));
+	return 0;
+}
+
+// Point the PRD table at req's pages and start the command, unless the
+// drive is still busy; ide_tick tries again then.
+static void
+ide_start(struct ide_req *req)
+{
+	size_t i, n = req->r_nsecs * SECTSIZE;
+
+	if (inb(IDE_CMD) & IDE_BSY)
+		return;
+	outb(IDE_DRIVE, 0xE0 | ((req->r_diskno & 1) << 4)
+	     | ((req->r_secno >> 24) & 0x0F));
+	if (inb(IDE_CMD) & IDE_BSY)
+		return;
+
+	for (i = 0; i < req->r_npages; i++) {
+		prdt[i].prd_addr = page2pa(req->r_pages[i]);
+		prdt[i].prd_len = MIN(n - i * PGSIZE, PGSIZE);
+		prdt[i].prd_flags = (i == req->r_npages - 1 ? PRD_EOT : 0);
+	}
+
+	outb(bmbase + BM_CMD, req->r_write ? 0 : BM_CMD_TOMEM);
+	outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+	outl(bmbase + BM_PRDT, PADDR(prdt));
+
+	outb(IDE_NSECT, req->r_nsecs & 0xFF);	// 0 means 256
+	outb(IDE_LBA0, req->r_secno & 0xFF);
+	outb(IDE_LBA1, (req->r_secno >> 8) & 0xFF);
+	outb(IDE_LBA2, (req->r_secno >> 16) & 0xFF);
+	outb(IDE_CMD, req->r_write ? IDE_CMD_WRITE_DMA : IDE_CMD_READ_DMA);
+	outb(bmbase + BM_CMD, (req->r_write ? 0 : BM_CMD_TOMEM) | BM_CMD_START);
+	running = 1;
+}
+
+// Transfer 'nsecs' sectors between sector 'secno' of disk 'diskno' and
+// curenv's page-aligned buffer at 'va', reading from the disk unless
+// 'write' is set.  Unless 'async' is set, block curenv until the
+// transfer is done.  An asynchronous write returns 0 once it is queued;
+// the caller must leave the buffer alone until ide_wait returns.
+//
+// A synchronous transfer does not return on success; the system call
+// eventually returns 0, or -E_UNSPECIFIED if the drive or the
+// controller reported an error.
+// Returns < 0 on error:
+//	-E_PERM if curenv is not the file server.
+//	-E_NOT_SUPP if there is no bus master controller.
+//	-E_NOT_FOUND if there is no drive 'diskno'.
+//	-E_INVAL if diskno is not 0 or 1, nsecs is 0 or over 256, the
+//		sectors run past 28-bit LBA, 'async' is set for a read, or
+//		va is not page-aligned or the buffer runs past UTOP.
+//	-E_FAULT if the buffer is not mapped user-accessible (and
+//		writable, for a read), or lies above 4GB physical.
+//	-E_AGAIN if too many requests are waiting already.
+int
+ide_dma(int diskno, uint32_t secno, void *va, size_t nsecs, bool write,
+	bool async)
+{
+	struct ide_req *req;
+	struct PageInfo *pp;
+	pte_t *pte;
+	size_t i;
+
+	if (curenv->env_type != ENV_TYPE_FS)
+		return -E_PERM;
+	if (!bmbase)
+		return -E_NOT_SUPP;
+	if ((diskno & ~1) || nsecs == 0 || nsecs > IDE_MAXSECTS
+	    || (uint64_t) secno + nsecs > (1 << 28) || (async && !write)
+	    || PGOFF(va) || (uintptr_t) va >= UTOP
+	    || (uintptr_t) va + nsecs * SECTSIZE > UTOP)
+		return -E_INVAL;
+	if (diskno == 1 && !disk1)
+		return -E_NOT_FOUND;
+	if (qlen == IDE_QLEN)
+		return -E_AGAIN;
+
+	// Hold a reference to each page until the transfer is done, so
+	// that an unmap meanwhile can't free a page under the DMA.
+	req = &queue[(qhead + qlen) % IDE_QLEN];
+	req->r_npages = ROUNDUP(nsecs * SECTSIZE, PGSIZE) / PGSIZE;
+	for (i = 0; i < req->r_npages; i++) {
+		pp = page_lookup(curenv->env_pml4e, (char *) va + i * PGSIZE, &pte);
+		if (!pp || !(*pte & PTE_U) || (!write && !(*pte & PTE_W))
+		    || page2pa(pp) + PGSIZE > 0x100000000ULL) {
+			while (i-- > 0)
+				page_decref(req->r_pages[i]);
+			return -E_FAULT;
+		}
+		pp->pp_ref++;
+		req->r_pages[i] = pp;
+	}
+	req->r_envid = async ? 0 : curenv->env_id;
+	req->r_diskno = diskno;
+	req->r_secno = secno;
+	req->r_nsecs = nsecs;
+	req->r_write = write;
+
+	if (qlen++ == 0)
+		ide_start(req);
+	if (async) {
+		nasync++;
+		return 0;
+	}
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Wait until all of curenv's asynchronous writes are done.
+//
+// Returns 0 if they all succeeded, or the error of the first one that
+// failed since the last ide_wait.  Blocks curenv first if any are still
+// queued.  Returns -E_PERM if curenv is not the file server.
+int
+ide_wait(void)
+{
+	int r;
+
+	if (curenv->env_type != ENV_TYPE_FS)
+		return -E_PERM;
+	if (nasync > 0) {
+		async_waiter = curenv->env_id;
+		curenv->env_status = ENV_NOT_RUNNABLE;
+		sched_yield();
+	}
+	r = async_err;
+	async_err = 0;
+	return r;
+}
+
+// Make env 'envid', asleep in ide_dma or ide_wait, return r, unless it
+// has gone away meanwhile.
+static void
+ide_wake(envid_t envid, int r)
+{
+	struct Env *e = &envs[ENVX(envid)];
+
+	if (e->env_id == envid && e->env_status == ENV_NOT_RUNNABLE) {
+		e->env_tf.tf_regs.reg_rax = r;
+		e->env_status = ENV_RUNNABLE;
+	}
+}
+
+// Handle IRQ 14: finish the running command, wake its env and start
+// the next one.
+void
+ide_intr(void)
+{
+	struct ide_req *req;
+	uint8_t bmstatus, status;
+	size_t i;
+	int r;
+
+	if (!bmbase)
+		return;
+	bmstatus = inb(bmbase + BM_STATUS);
+	// Reading the status register acknowledges the drive's interrupt.
+	status = inb(IDE_CMD);
+	if (!running || !(bmstatus & BM_STATUS_INTR)
+	    || ((bmstatus & BM_STATUS_ACTIVE) && !(bmstatus & BM_STATUS_ERR)))
+		return;
+
+	outb(bmbase + BM_CMD, 0);
+	outb(bmbase + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+	running = 0;
+	r = 0;
+	if ((bmstatus & BM_STATUS_ERR) || (status & (IDE_DF | IDE_ERR)))
+		r = -E_UNSPECIFIED;
+
+	req = &queue[qhead];
+	for (i = 0; i < req->r_npages; i++)
+		page_decref(req->r_pages[i]);
+	if (!req->r_envid) {
+		if (r < 0 && !async_err)
+			async_err = r;
+		if (--nasync == 0 && async_waiter) {
+			ide_wake(async_waiter, async_err);
+			async_err = 0;
+			async_waiter = 0;
+		}
+	} else
+		ide_wake(req->r_envid, r);
+
+	qhead = (qhead + 1) % IDE_QLEN;
+	if (--qlen > 0)
+		ide_start(&queue[qhead]);
+}
+
+// Called on each clock tick: start a command that found the drive busy,
+// or in case an interrupt went missing, finish one that the controller
+// says is done.
+void
+ide_tick(void)
+{
+	if (!bmbase || qlen == 0)
+		return;
+	if (!running)
+		ide_start(&queue[qhead]);
+	else if (inb(bmbase + BM_STATUS) & BM_STATUS_INTR)
+		ide_intr();
+}
+
+// Whether requests are queued, so that the clock must keep ticking.
+bool
+ide_pending(void)
+{
+	return qlen > 0;
+}
@@ -0,0 +1,17 @@
+#ifndef JOS_KERN_IDE_H
+#define JOS_KERN_IDE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <kern/pci.h>
+
+int ide_attach(struct pci_func *pcif);
+int ide_dma(int diskno, uint32_t secno, void *va, size_t nsecs, bool write,
+	    bool async);
+int ide_wait(void);
+void ide_intr(void);
+void ide_tick(void);
+bool ide_pending(void);
+
+#endif	// JOS_KERN_IDE_H
@@ -20,6 +20,7 @@
 #include <kern/picirq.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/fpu.h>
 #line 27 "../kern/init.c"
 #include <kern/time.h>
 #include <kern/pci.h>
@@ -65,6 +66,7 @@ i386_init(void)
 	// Clear the uninitialized global data (BSS) section of our program.
 	// This ensures that all static/global variables start out zero.
 	memset(edata, 0, end - edata);
+	string_init();
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
@@ -101,6 +103,7 @@ i386_init(void)
 	// Lab 3 user environment initialization functions
 	env_init();
 	trap_init();
+	fpu_init();
 #line 130 "../kern/init.c"
 
 #line 132 "../kern/init.c"
@@ -210,9 +213,10 @@ mp_main(void)
 	lcr3(boot_cr3);
 	cprintf("SMP: CPU %d starting\n", cpunum());
 
-	lapic_init();
 	env_init_percpu();
-	trap_init_percpu();
+	trap_init_percpu();	// thiscpu is usable from here on
+	fpu_init();
+	lapic_init();
 	xchg(&thiscpu->cpu_status, CPU_STARTED); // tell boot_aps() we're up
 
 	// Now that we have finished some basic setup, call sched_yield()
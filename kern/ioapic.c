@@ -0,0 +1,71 @@
+// The I/O APIC routes device interrupts to the local APICs.  Most IRQs
+// still come through the 8259A in virtual wire mode (see lapic_init);
+// a driver can ask for its IRQ to be routed here instead.
+// See the Intel 82093AA I/O APIC datasheet.
+
+#include <inc/types.h>
+#include <inc/error.h>
+#include <inc/trap.h>
+#include <inc/mmu.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/picirq.h>
+
+// Memory-mapped registers, divided by 4 for use as uint32_t[] indices.
+#define IOREGSEL  (0x00/4)   // Register select
+#define IOWIN     (0x10/4)   // Data of the selected register
+
+// Registers reached through IOREGSEL
+#define IOAPICVER  0x01        // Version; bits 16-23 hold the last pin
+#define IOREDTBL   0x10        // Redirection table, two registers per pin
+
+// Redirection table entries.  Zero means fixed delivery to a physical
+// APIC ID, edge triggered and active high, which is what ISA IRQs want.
+#define DEST_SHIFT 24          // Destination APIC ID, in the high half
+
+physaddr_t ioapicaddr;        // Initialized in mpconfig.c
+static volatile uint32_t *ioapic;
+static uint16_t ioapic_irqs;  // ISA IRQs routed through the I/O APIC
+
+static uint32_t
+ioapic_read(int reg)
+{
+	ioapic[IOREGSEL] = reg;
+	return ioapic[IOWIN];
+}
+
+static void
+ioapic_write(int reg, uint32_t data)
+{
+	ioapic[IOREGSEL] = reg;
+	ioapic[IOWIN] = data;
+}
+
+// Route ISA IRQ 'irq' through the I/O APIC to this CPU on vector
+// IRQ_OFFSET + irq, and mask it on the 8259A so that it doesn't arrive
+// twice.  The handler must then acknowledge it with lapic_eoi.
+// Returns 0 on success, -E_NOT_SUPP if there is no I/O APIC or it has
+// no pin for irq.
+int
+ioapic_enable(int irq)
+{
+	if (!ioapicaddr || irq < 0 || irq >= MAX_IRQS)
+		return -E_NOT_SUPP;
+	if (!ioapic)
+		ioapic = mmio_map_region(ioapicaddr, PGSIZE);
+	if (irq > ((ioapic_read(IOAPICVER) >> 16) & 0xFF))
+		return -E_NOT_SUPP;
+
+	ioapic_write(IOREDTBL + 2 * irq + 1, cpunum() << DEST_SHIFT);
+	ioapic_write(IOREDTBL + 2 * irq, IRQ_OFFSET + irq);
+	ioapic_irqs |= 1 << irq;
+	irq_setmask_8259A(irq_mask_8259A | (1 << irq));
+	return 0;
+}
+
+// Whether 'irq' comes through the I/O APIC rather than the 8259A.
+bool
+ioapic_routed(int irq)
+{
+	return ioapic_irqs & (1 << irq);
+}
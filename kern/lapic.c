@@ -62,6 +62,9 @@ lapic_init(void)
 	// lapicaddr is the physical address of the LAPIC's 4K MMIO
 	// region.  Map it in to virtual memory so we can access it.
 	lapic = mmio_map_region(lapicaddr, 4096);
+	// trap_init_percpu set up thiscpu before the LAPIC was mapped;
+	// make sure it picked the CpuInfo that the LAPIC ID names.
+	assert(thiscpu == &cpus[cpunum()]);
 
 	// Enable local APIC; set spurious interrupt vector.
 	lapicw(SVR, ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
@@ -72,6 +72,17 @@ struct mpproc {         // processor table entry [MP 4.3.1]
 #define MPIOINTR  0x03  // One per bus interrupt source
 #define MPLINTR   0x04  // One per system interrupt source
 
+struct mpioapic {       // I/O APIC table entry [MP 4.3.3]
+	uint8_t type;                   // entry type (2)
+	uint8_t apicno;                 // I/O APIC id
+	uint8_t version;                // I/O APIC version
+	uint8_t flags;                  // I/O APIC flags
+	uint32_t addr;                  // address of I/O APIC
+} __attribute__((__packed__));
+
+// mpioapic flags
+#define MPIOAPIC_EN 0x01
+
 static uint8_t
 sum(void *addr, int len)
 {
@@ -171,6 +182,7 @@ mp_init(void)
 	struct mp *mp;
 	struct mpconf *conf;
 	struct mpproc *proc;
+	struct mpioapic *ioa;
 	uint8_t *p;
 	unsigned int i;
 
@@ -202,8 +214,14 @@ mp_init(void)
 			}
 			p += sizeof(struct mpproc);
 			continue;
-		case MPBUS:
 		case MPIOAPIC:
+			// Use the first usable I/O APIC; it has the ISA IRQs.
+			ioa = (struct mpioapic *) p;
+			if ((ioa->flags & MPIOAPIC_EN) && !ioapicaddr)
+				ioapicaddr = ioa->addr;
+			p += sizeof(struct mpioapic);
+			continue;
+		case MPBUS:
 		case MPIOINTR:
 		case MPLINTR:
 #line 258 "../kern/mpconfig.c"
@@ -228,6 +246,7 @@ mp_init(void)
 		// Didn't like what we found; fall back to no MP.
 		ncpu = 1;
 		lapicaddr = 0;
+		ioapicaddr = 0;
 		cprintf("SMP: configuration not found, SMP disabled\n");
 		return;
 	}
@@ -6,6 +6,7 @@
 #include <kern/pcireg.h>
 #line 8 "../kern/pci.c"
 #include <kern/e1000.h>
+#include <kern/ide.h>
 #line 10 "../kern/pci.c"
 
 // Flag to do "lspci" at bootup
@@ -28,6 +29,7 @@ struct pci_driver {
 // pci_attach_class matches the class and subclass of a PCI device
 struct pci_driver pci_attach_class[] = {
 	{ PCI_CLASS_BRIDGE, PCI_SUBCLASS_BRIDGE_PCI, &pci_bridge_attach },
+	{ PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_MASS_STORAGE_IDE, &ide_attach },
 	{ 0, 0, 0 },
 };
 
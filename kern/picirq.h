@@ -27,6 +27,9 @@ void irq_setmask_8259A(uint16_t mask);
 #line 28 "../kern/picirq.h"
 void irq_eoi(void);
 #line 30 "../kern/picirq.h"
+
+int ioapic_enable(int irq);
+bool ioapic_routed(int irq);
 #endif // !__ASSEMBLER__
 
 #endif // !JOS_KERN_PICIRQ_H
@@ -14,6 +14,8 @@
 #include <kern/env.h>
 #line 17 "../kern/pmap.c"
 #include <kern/cpu.h>
+#include <kern/futex.h>
+#include <kern/time.h>
 #line 19 "../kern/pmap.c"
 
 extern uint64_t pml4phys;
@@ -290,6 +292,10 @@ x64_vm_init(void)
 	envs    = boot_alloc(sizeof(struct Env)*NENV);
 	memset(envs, 0, sizeof(struct Env)*NENV);
 
+	// Allocate the clock page (see kern/time.c).
+	clockpage = boot_alloc(PGSIZE);
+	memset(clockpage, 0, PGSIZE);
+
 #line 304 "../kern/pmap.c"
 	//////////////////////////////////////////////////////////////////////
 	// Now that we've allocated the initial kernel data structures, we set
@@ -310,6 +316,7 @@ x64_vm_init(void)
 	// Your code goes here:
 #line 322 "../kern/pmap.c"
 	n = npages*sizeof(struct PageInfo);
+	assert(n <= UCLOCK - UPAGES);
 	boot_map_region(boot_pml4e, UPAGES, n, PADDR(pages), PTE_U);
 #line 326 "../kern/pmap.c"
 
@@ -324,6 +331,10 @@ x64_vm_init(void)
 #line 336 "../kern/pmap.c"
 	n   = ROUNDUP(NENV*sizeof(struct Env), PGSIZE);
 	boot_map_region(boot_pml4e, UENVS, n, PADDR(envs), PTE_U|PTE_P);
+
+	// Map the clock page read-only by the user at UCLOCK.
+	boot_map_region(boot_pml4e, UCLOCK, PGSIZE, PADDR(clockpage),
+			PTE_U|PTE_P);
 #line 340 "../kern/pmap.c"
 
 #line 342 "../kern/pmap.c"
@@ -792,6 +803,7 @@ page_remove(pml4e_t *pml4e, void *va)
 		tlb_invalidate(pml4e, va);
 		page_decref(page);
 		*pte    = 0;
+		futex_wake_page(page2pa(page));
 	}
 #line 874 "../kern/pmap.c"
 }
@@ -917,6 +929,140 @@ user_mem_assert(struct Env *env, const void *va, size_t len, int perm)
 	}
 }
 
+//
+// Resolve a write fault on the copy-on-write page at 'va': give the
+// address space its own writable copy of the page, or, if nothing else
+// maps the page any more, simply make it writable again.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_FAULT if 'va' is not a copy-on-write user page.
+//	-E_NO_MEM if there is no memory for the copy.
+//
+int
+page_cow(pml4e_t *pml4e, void *va)
+{
+	struct PageInfo *pp, *np;
+	pte_t *ptep;
+	int perm, r;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if ((uintptr_t) va >= UTOP)
+		return -E_FAULT;
+	ptep = pml4e_walk(pml4e, va, 0);
+	if (!ptep || (*ptep & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+		return -E_FAULT;
+
+	pp = pa2page(PTE_ADDR(*ptep));
+	perm = (*ptep & PTE_SYSCALL & ~PTE_COW) | PTE_W;
+	if (pp->pp_ref == 1) {
+		*ptep = PTE_ADDR(*ptep) | perm;
+		tlb_invalidate(pml4e, va);
+		return 0;
+	}
+
+	if (!(np = page_alloc(0)))
+		return -E_NO_MEM;
+	memmove(page2kva(np), page2kva(pp), PGSIZE);
+	if ((r = page_insert(pml4e, np, va, perm)) < 0)
+		page_free(np);
+	return r;
+}
+
+//
+// Map every user page of 'src' into 'dst' at the same address, for
+// sys_env_clone.  PTE_SHARE pages and read-only pages are shared as they
+// are; writable pages become copy-on-write in both address spaces.
+// Like env_free, this looks at the low 4GB only, which holds everything
+// user environments map below UTOP.
+//
+// Returns 0 on success, -E_NO_MEM if 'dst' runs out of page tables.
+//
+int
+page_clone_cow(pml4e_t *dst, pml4e_t *src)
+{
+	pdpe_t *pdpe;
+	pde_t *pgdir;
+	pte_t *pt;
+	uint64_t pdpeno, pdeno, pteno;
+	void *va;
+	int perm, r;
+
+	if (!(src[0] & PTE_P))
+		return 0;
+	pdpe = KADDR(PTE_ADDR(src[0]));
+	for (pdpeno = 0; pdpeno <= 3; pdpeno++) {
+		if (!(pdpe[pdpeno] & PTE_P))
+			continue;
+		pgdir = KADDR(PTE_ADDR(pdpe[pdpeno]));
+		for (pdeno = 0; pdeno < NPDENTRIES; pdeno++) {
+			if (!(pgdir[pdeno] & PTE_P))
+				continue;
+			pt = KADDR(PTE_ADDR(pgdir[pdeno]));
+			for (pteno = 0; pteno < NPTENTRIES; pteno++) {
+				if (!(pt[pteno] & PTE_P))
+					continue;
+				va = PGADDR(0UL, pdpeno, pdeno, pteno, 0UL);
+				perm = pt[pteno] & PTE_SYSCALL;
+				if ((perm & PTE_W) && !(perm & PTE_SHARE)) {
+					perm = (perm & ~PTE_W) | PTE_COW;
+					pt[pteno] = PTE_ADDR(pt[pteno]) | perm;
+					tlb_invalidate(src, va);
+				}
+				r = page_insert(dst, pa2page(PTE_ADDR(pt[pteno])),
+						va, perm);
+				if (r < 0)
+					return r;
+			}
+		}
+	}
+	return 0;
+}
+
+// Check that [va, va+len) lies entirely below ULIM without wrapping.
+static bool
+user_range_ok(const void *va, size_t len)
+{
+	uintptr_t start = (uintptr_t) va;
+
+	return start + len >= start && start + len <= ULIM;
+}
+
+//
+// Copy 'len' bytes from user address 'usrc' in the current address
+// space into the kernel buffer 'dst'.
+//
+// Unlike user_mem_check, this does not walk the page tables first: it
+// just does the copy, and a page fault on the user side is turned into
+// an error by the exception table entry in copy_user (kern/usercopy.S).
+// So each user page is touched once.
+//
+// Returns 0 on success, -E_FAULT if any of the range is not readable.
+//
+int
+copy_from_user(void *dst, const void *usrc, size_t len)
+{
+	if (!user_range_ok(usrc, len))
+		return -E_FAULT;
+	return copy_user(dst, usrc, len) ? -E_FAULT : 0;
+}
+
+//
+// Copy 'len' bytes from the kernel buffer 'src' to user address 'udst'
+// in the current address space.  The kernel runs with CR0_WP set, so
+// pages the user cannot write fault too; page_fault_handler resolves
+// copy-on-write pages on the way.
+//
+// Returns 0 on success, -E_FAULT if any of the range is not writable.
+// On error a prefix of the range may already have been written.
+//
+int
+copy_to_user(void *udst, const void *src, size_t len)
+{
+	if (!user_range_ok(udst, len))
+		return -E_FAULT;
+	return copy_user(udst, src, len) ? -E_FAULT : 0;
+}
+
 #line 1006 "../kern/pmap.c"
 
 // --------------------------------------------------------------
@@ -1099,6 +1245,9 @@ check_boot_pml4e(pml4e_t *pml4e)
 		assert(check_va2pa(pml4e, UENVS + i) == PADDR(envs) + i);
 #line 1186 "../kern/pmap.c"
 
+	// check clock page
+	assert(check_va2pa(pml4e, UCLOCK) == PADDR(clockpage));
+
 	// check phys mem
 	for (i = 0; i < npages * PGSIZE; i += PGSIZE)
 		assert(check_va2pa(pml4e, KERNBASE + i) == i);
@@ -1124,6 +1273,7 @@ check_boot_pml4e(pml4e_t *pml4e)
 			//case PDX(UVPT):
 		case PDX(KSTACKTOP - 1):
 		case PDX(UPAGES):
+		case PDX(UCLOCK):
 #line 1219 "../kern/pmap.c"
 		case PDX(UENVS):
 #line 1221 "../kern/pmap.c"
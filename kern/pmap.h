@@ -60,6 +60,8 @@ int	page_insert(pml4e_t *pml4e, struct PageInfo *pp, void *va, int perm);
 void	page_remove(pml4e_t *pml4e, void *va);
 struct PageInfo *page_lookup(pml4e_t *pml4e, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
+int	page_cow(pml4e_t *pml4e, void *va);
+int	page_clone_cow(pml4e_t *dst, pml4e_t *src);
 
 void	tlb_invalidate(pml4e_t *pml4e, void *va);
 
@@ -69,6 +71,9 @@ void *	mmio_map_region(physaddr_t pa, size_t size);
 #line 71 "../kern/pmap.h"
 int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
 void	user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
+size_t	copy_user(void *dst, const void *src, size_t len);
+int	copy_from_user(void *dst, const void *usrc, size_t len);
+int	copy_to_user(void *udst, const void *src, size_t len);
 
 #line 75 "../kern/pmap.h"
 static inline ppn_t
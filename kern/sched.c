@@ -5,6 +5,10 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/futex.h>
+#include <kern/ide.h>
+#include <kern/trap.h>
+#include <kern/fpu.h>
 
 void sched_halt(void);
 
@@ -36,6 +40,10 @@ sched_yield(void)
 #line 37 "../kern/sched.c"
 	int i, j, k;
 
+	// We may not come back to this kernel stack, so make sure curenv
+	// can be resumed from its env_tf.
+	trap_save_syscall_frame();
+
 	// Determine the starting point for the search.
 	if (curenv)
 		i = curenv-envs;
@@ -52,7 +60,7 @@ sched_yield(void)
 #ifndef VMM_GUEST
 			if (envs[k].env_type == ENV_TYPE_GUEST) {
 				int r;
-				if (envs[k].env_vmxinfo.vcpunum != cpunum()) {
+				if (envs[k].env_vmxinfo.vcpunum != thiscpu->cpu_id) {
 					continue;
 				}
 				r = vmxon();
@@ -71,7 +79,7 @@ sched_yield(void)
 #line 72 "../kern/sched.c"
 #ifndef VMM_GUEST
 		if (curenv->env_type == ENV_TYPE_GUEST) {
-			if (curenv->env_vmxinfo.vcpunum != cpunum()) {
+			if (curenv->env_vmxinfo.vcpunum != thiscpu->cpu_id) {
 				return;
 			}
 			int r = vmxon();
@@ -108,13 +116,15 @@ sched_halt(void)
 		     envs[i].env_status == ENV_DYING))
 			break;
 	}
-	if (i == NENV) {
+	if (i == NENV && !futex_timeouts_pending()
+	    && !env_notify_timeouts_pending() && !ide_pending()) {
 		cprintf("No runnable environments in the system!\n");
 		while (1)
 			monitor(NULL);
 	}
 
 	// Mark that no environment is running on this CPU
+	fpu_save();
 	curenv = NULL;
 	lcr3(PADDR(boot_pml4e));
 
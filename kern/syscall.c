@@ -9,6 +9,7 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/elf.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
@@ -19,8 +20,12 @@
 #include <kern/sched.h>
 #line 22 "../kern/syscall.c"
 #include <kern/time.h>
+#include <kern/futex.h>
+#include <kern/fpu.h>
+#include <inc/sysring.h>
 #line 25 "../kern/syscall.c"
 #include <kern/e1000.h>
+#include <kern/ide.h>
 #line 28 "../kern/syscall.c"
 #ifndef VMM_GUEST
 #include <vmm/ept.h>
@@ -39,11 +44,25 @@ sys_cputs(const char *s, size_t len)
 
 	// LAB 3: Your code here.
 #line 45 "../kern/syscall.c"
-	user_mem_assert(curenv, s, len, PTE_U);
+	char buf[256];
+	size_t n;
+
+	// Copy the string in a piece at a time; copy_from_user checks
+	// the memory as it goes.  On a fault, user_mem_assert finds and
+	// reports the bad page and destroys the environment.
+	while (len > 0) {
+		n = MIN(len, sizeof(buf));
+		if (copy_from_user(buf, s, n) < 0) {
+			user_mem_assert(curenv, s, n, PTE_U);
+			return;
+		}
 #line 47 "../kern/syscall.c"
 
-	// Print the string supplied by the user.
-	cprintf("%.*s", len, s);
+		// Print the string supplied by the user.
+		cprintf("%.*s", n, buf);
+		s += n;
+		len -= n;
+	}
 }
 
 // Read a character from the system console without blocking.
@@ -61,7 +80,28 @@ sys_getenvid(void)
 	return curenv->env_id;
 }
 
+// Whether 'ancestor' is e itself or one of e's living ancestors.  A
+// stale parent id, left behind by a parent that has gone away, ends
+// the chain.
+static bool
+env_descends(struct Env *e, envid_t ancestor)
+{
+	envid_t id;
+	int i;
+
+	for (i = 0; i < NENV && e->env_id != ancestor; i++) {
+		id = e->env_parent_id;
+		e = &envs[ENVX(id)];
+		if (!id || e->env_id != id || e->env_status == ENV_FREE
+		    || e->env_status == ENV_ZOMBIE)
+			return 0;
+	}
+	return e->env_id == ancestor;
+}
+
 // Destroy a given environment (possibly the currently running environment).
+// Besides its parent, any descendant of a template's parent may destroy
+// the template, as with sys_env_clone.
 //
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
@@ -72,14 +112,85 @@ sys_env_destroy(envid_t envid)
 	int r;
 	struct Env *e;
 
-	if ((r = envid2env(envid, &e, 1)) < 0)
+	if ((r = envid2env(envid, &e, 0)) < 0)
 		return r;
+	if (e != curenv && e->env_parent_id != curenv->env_id
+	    && (e->env_status != ENV_TEMPLATE
+		|| !env_descends(curenv, e->env_parent_id)))
+		return -E_BAD_ENV;
 #line 87 "../kern/syscall.c"
 	env_destroy(e);
 	return 0;
 }
 #line 91 "../kern/syscall.c"
 
+// Destroy the current environment, reporting 'status' to any env
+// waiting for it in sys_env_wait.  Envs destroyed any other way
+// (sys_env_destroy, a fault) report -1.
+static void
+sys_env_exit(int status)
+{
+	curenv->env_exit_status = status;
+	env_destroy(curenv);
+}
+
+// Wait for environment envid, a descendant of the caller, to exit, and
+// store the exit status it passed to sys_env_exit, or -1 if it was
+// killed, in the caller's env_wait_status.  If the caller keeps zombies
+// (sys_env_keep_zombies), a child that has already exited is a zombie
+// until the caller waits for it, so its status is never missed; other
+// ancestors see a zombie's status without reaping it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist (including
+//		a child that has exited and was not kept as a zombie) or
+//		doesn't descend from the caller.
+//	-E_INVAL if envid is the current environment.
+static int
+sys_env_wait(envid_t envid)
+{
+	struct Env *e;
+
+	e = &envs[ENVX(envid)];
+	if (e->env_status == ENV_FREE || e->env_id != envid)
+		return -E_BAD_ENV;
+	if (e == curenv)
+		return -E_INVAL;
+	if (!env_descends(e, curenv->env_id))
+		return -E_BAD_ENV;
+	if (e->env_status == ENV_ZOMBIE) {
+		curenv->env_wait_status = e->env_exit_status;
+		if (e->env_parent_id == curenv->env_id)
+			env_reap(e);
+		return 0;
+	}
+
+	curenv->env_wait_envid = e->env_id;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Set whether the current environment's children stay zombies after
+// they exit, until it collects their status with sys_env_wait.  Off by
+// default, so that envs that never wait don't fill up envs[] with
+// zombies; turning it off reaps any zombie children now.
+static int
+sys_env_keep_zombies(bool keep)
+{
+	struct Env *e;
+	int i;
+
+	curenv->env_keep_zombies = keep;
+	if (!keep)
+		for (i = 0; i < NENV; i++) {
+			e = &envs[i];
+			if (e->env_status == ENV_ZOMBIE
+			    && e->env_parent_id == curenv->env_id)
+				env_reap(e);
+		}
+	return 0;
+}
+
 // Deschedule current environment and pick a different one to run.
 static void
 sys_yield(void)
@@ -100,6 +211,11 @@ sys_exofork(void)
 
 	if ((r = env_alloc(&e, curenv->env_id)) < 0)
 		return r;
+	trap_save_syscall_frame();
+	if ((r = fpu_copy(e, curenv)) < 0) {
+		env_free(e);
+		return r;
+	}
 	e->env_status = ENV_NOT_RUNNABLE;
 	e->env_tf = curenv->env_tf;
 	e->env_tf.tf_regs.reg_rax = 0;
@@ -107,8 +223,191 @@ sys_exofork(void)
 #line 126 "../kern/syscall.c"
 }
 
-// Set envid's env_status to status, which must be ENV_RUNNABLE
-// or ENV_NOT_RUNNABLE.
+// Allocate a new environment that is a copy of the template environment
+// 'tmplid' (see sys_env_set_status): the same trap frame and the same
+// pages, with writable pages shared copy-on-write.  Only descendants of
+// the template's parent, which owns it, may clone it.  The new
+// environment is a child of the caller and is left ENV_NOT_RUNNABLE, so
+// the caller can give it a stack first.
+//
+// Returns envid of new environment, or < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment tmplid doesn't currently exist, or the
+//		caller does not descend from its parent.
+//	-E_INVAL if tmplid is not a template.
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_env_clone(envid_t tmplid)
+{
+	struct Env *t, *e;
+	int r;
+
+	if ((r = envid2env(tmplid, &t, 0)) < 0)
+		return r;
+	if (t->env_status != ENV_TEMPLATE)
+		return -E_INVAL;
+	if (!env_descends(curenv, t->env_parent_id))
+		return -E_BAD_ENV;
+	if ((r = env_alloc(&e, curenv->env_id)) < 0)
+		return r;
+	if ((r = page_clone_cow(e->env_pml4e, t->env_pml4e)) < 0) {
+		env_free(e);
+		return r;
+	}
+	e->env_status = ENV_NOT_RUNNABLE;
+	e->env_tf = t->env_tf;
+	e->env_pgfault_upcall = t->env_pgfault_upcall;
+	return e->env_id;
+}
+
+// Hand the caller's child 'envid' to 'parentid', which must be the
+// caller itself or one of its living ancestors.  spawn_template uses
+// this to leave a template with the environment that owns the template
+// table rather than with the short-lived child that made it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist or is not
+//		a child of the caller, or parentid is not an ancestor of
+//		the caller.
+static int
+sys_env_set_parent(envid_t envid, envid_t parentid)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (!env_descends(curenv, parentid))
+		return -E_BAD_ENV;
+	e->env_parent_id = parentid;
+	return 0;
+}
+
+// Return the page the file server has at upages[i], the i'th page of
+// the file being loaded by sys_spawn_from_pages, or NULL if there is
+// no such page.  If 'share' is set, the page is about to be mapped into
+// the new program, so make the file server's mapping copy-on-write:
+// a later write to the file then gets a copy of the page (see
+// page_cow) instead of changing the running program.
+static struct PageInfo *
+spawn_file_page(void *const *upages, size_t npages, size_t i, bool share)
+{
+	void *va;
+	pte_t *ptep;
+	struct PageInfo *pp;
+
+	if (i >= npages || copy_from_user(&va, &upages[i], sizeof(va)) < 0)
+		return NULL;
+	if ((uintptr_t) va >= UTOP || PGOFF(va))
+		return NULL;
+	pp = page_lookup(curenv->env_pml4e, va, &ptep);
+	if (!pp || !(*ptep & PTE_U))
+		return NULL;
+	if (share && (*ptep & PTE_W)) {
+		*ptep = (*ptep & ~PTE_W) | PTE_COW;
+		tlb_invalidate(curenv->env_pml4e, va);
+	}
+	return pp;
+}
+
+// Load an ELF program into the new environment 'envid' from the pages
+// of its file: upages[i] is the address in the caller (the file
+// server's block cache) of the i'th page of the file.  Whole pages of
+// read-only segments are mapped into envid read-only, and whole pages
+// of writable segments copy-on-write; either way, the file server's
+// own mapping becomes copy-on-write.  Partial pages and bss are copied
+// into fresh zeroed pages.  Sets envid's entry point; the
+// caller's client still has to give it a stack and make it runnable.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if the caller is not the file server, or envid doesn't
+//		exist, or has already run.
+//	-E_NOT_EXEC if the pages do not hold a valid ELF executable.
+//	-E_INVAL if a segment lies above UTOP.
+//	-E_NO_MEM on memory exhaustion.
+// On error, envid may be partly loaded; the client destroys it.
+static int
+sys_spawn_from_pages(envid_t envid, void *const *upages, size_t npages)
+{
+	struct Env *e;
+	struct PageInfo *pp, *np;
+	struct Elf *elf;
+	struct Proghdr ph;
+	uintptr_t va, memsz, filesz, i;
+	size_t fbytes;
+	bool share;
+	int perm, r, n;
+
+	if (curenv->env_type != ENV_TYPE_FS)
+		return -E_BAD_ENV;
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	if (e->env_status != ENV_NOT_RUNNABLE || e->env_runs > 0
+	    || e->env_type != ENV_TYPE_USER)
+		return -E_BAD_ENV;
+
+	if (!(pp = spawn_file_page(upages, npages, 0, 0)))
+		return -E_NOT_EXEC;
+	elf = page2kva(pp);
+	// Check e_phoff alone first, so the sum cannot wrap.
+	if (elf->e_magic != ELF_MAGIC || elf->e_phoff > PGSIZE
+	    || elf->e_phoff + elf->e_phnum * sizeof(ph) > PGSIZE)
+		return -E_NOT_EXEC;
+
+	for (n = 0; n < elf->e_phnum; n++) {
+		ph = ((struct Proghdr *) ((uint8_t *) elf + elf->e_phoff))[n];
+		if (ph.p_type != ELF_PROG_LOAD)
+			continue;
+		if (PGOFF(ph.p_offset) != PGOFF(ph.p_va)
+		    || ph.p_filesz > ph.p_memsz)
+			return -E_NOT_EXEC;
+		va = ROUNDDOWN(ph.p_va, PGSIZE);
+		memsz = ph.p_memsz + PGOFF(ph.p_va);
+		filesz = ph.p_filesz + PGOFF(ph.p_va);
+		if (va + memsz < va || va + memsz > UTOP)
+			return -E_INVAL;
+		perm = PTE_P | PTE_U;
+		if (ph.p_flags & ELF_PROG_FLAG_WRITE)
+			perm |= PTE_W;
+
+		for (i = 0; i < memsz; i += PGSIZE) {
+			fbytes = i < filesz ? MIN(filesz - i, PGSIZE) : 0;
+			// Share the file's page if all of this page of the
+			// segment comes from the file.
+			share = fbytes > 0 && fbytes >= MIN(memsz - i, PGSIZE);
+			pp = NULL;
+			if (fbytes > 0) {
+				pp = spawn_file_page(upages, npages,
+					(ROUNDDOWN(ph.p_offset, PGSIZE) + i) / PGSIZE,
+					share);
+				if (!pp)
+					return -E_NOT_EXEC;
+			}
+			if (share) {
+				r = page_insert(e->env_pml4e, pp, (void *) (va + i),
+						(perm & PTE_W) ? (perm & ~PTE_W) | PTE_COW
+							       : perm);
+			} else {
+				if (!(np = page_alloc(ALLOC_ZERO)))
+					return -E_NO_MEM;
+				if (fbytes > 0)
+					memmove(page2kva(np), page2kva(pp), fbytes);
+				r = page_insert(e->env_pml4e, np, (void *) (va + i), perm);
+				if (r < 0)
+					page_free(np);
+			}
+			if (r < 0)
+				return r;
+		}
+	}
+	e->env_tf.tf_rip = elf->e_entry;
+	return 0;
+}
+
+// Set envid's env_status to status, which must be ENV_RUNNABLE,
+// ENV_NOT_RUNNABLE, or ENV_TEMPLATE.  Only an environment that has
+// never run can become a template, and a template stays one until it
+// is destroyed.
 //
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
@@ -123,7 +422,13 @@ sys_env_set_status(envid_t envid, int status)
 
 	if ((r = envid2env(envid, &e, 1)) < 0)
 		return r;
-	if (status != ENV_RUNNABLE && status != ENV_NOT_RUNNABLE)
+	if (status != ENV_RUNNABLE && status != ENV_NOT_RUNNABLE
+	    && status != ENV_TEMPLATE)
+		return -E_INVAL;
+	if (e->env_status == ENV_TEMPLATE)
+		return -E_INVAL;
+	if (status == ENV_TEMPLATE
+	    && (e->env_runs > 0 || e->env_type != ENV_TYPE_USER))
 		return -E_INVAL;
 	e->env_status = status;
 	return 0;
@@ -138,6 +443,7 @@ sys_env_set_status(envid_t envid, int status)
 // Returns 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
 //		or the caller doesn't have permission to change envid.
+//	-E_FAULT if tf is not readable.
 static int
 sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 {
@@ -146,13 +452,15 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	struct Env *e;
 	struct Trapframe ltf;
 
-	user_mem_assert(curenv, tf, sizeof(struct Trapframe), PTE_U);
-	ltf = *tf;
+	if ((r = copy_from_user(&ltf, tf, sizeof(ltf))) < 0)
+		return r;
 	ltf.tf_eflags |= FL_IF;
 	ltf.tf_cs |= 3;
 
 	if ((r = envid2env(envid, &e, 1)) < 0)
 		return r;
+	if (e == curenv)
+		trap_save_syscall_frame();
 	e->env_tf = ltf;
 	return 0;
 #line 191 "../kern/syscall.c"
@@ -290,6 +598,138 @@ sys_page_unmap(envid_t envid, void *va)
 #line 351 "../kern/syscall.c"
 }
 
+// Find the kernel address of 'va' in e's address space, for
+// sys_env_write and sys_env_read.  For a guest, 'va' is a guest
+// physical address.  If 'write' is set, the page must be writable; a
+// copy-on-write page is copied first, and a missing page is allocated
+// zeroed with permission 'perm' (full access in a guest).
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if va >= UTOP, or is beyond a guest's physical memory.
+//	-E_FAULT if the page is missing or, for a write, read-only.
+//	-E_NO_MEM on memory exhaustion.
+static int
+env_va2kva(struct Env *e, uintptr_t va, bool write, int perm, void **kva_store)
+{
+	struct PageInfo *pp;
+	pte_t *ptep;
+	int r;
+
+#ifndef VMM_GUEST
+	if (e->env_type == ENV_TYPE_GUEST) {
+		void *hva;
+
+		if (ROUNDDOWN(va, PGSIZE) + PGSIZE > e->env_vmxinfo.phys_sz)
+			return -E_INVAL;
+		ept_gpa2hva(e->env_pml4e, (void *) ROUNDDOWN(va, PGSIZE), &hva);
+		if (!hva) {
+			if (!write)
+				return -E_FAULT;
+			if (!(pp = page_alloc(ALLOC_ZERO)))
+				return -E_NO_MEM;
+			if ((r = ept_map_hva2gpa(e->env_pml4e, page2kva(pp),
+						 (void *) ROUNDDOWN(va, PGSIZE),
+						 __EPTE_FULL, 0)) < 0) {
+				page_free(pp);
+				return r;
+			}
+			pp->pp_ref++;
+			hva = page2kva(pp);
+		}
+		*kva_store = (char *) hva + PGOFF(va);
+		return 0;
+	}
+#endif
+
+	if (va >= UTOP)
+		return -E_INVAL;
+	pp = page_lookup(e->env_pml4e, (void *) va, &ptep);
+	if (pp && write && !(*ptep & PTE_W)) {
+		if ((r = page_cow(e->env_pml4e, (void *) va)) < 0)
+			return r;
+		pp = page_lookup(e->env_pml4e, (void *) va, &ptep);
+	}
+	if (!pp) {
+		if (!write)
+			return -E_FAULT;
+		if (!(pp = page_alloc(ALLOC_ZERO)))
+			return -E_NO_MEM;
+		if ((r = page_insert(e->env_pml4e, pp,
+				     (void *) ROUNDDOWN(va, PGSIZE), perm)) < 0) {
+			page_free(pp);
+			return r;
+		}
+	}
+	*kva_store = (char *) page2kva(pp) + PGOFF(va);
+	return 0;
+}
+
+// Copy 'len' bytes from 'src' in the current environment to 'dstva' in
+// envid's address space, which may cross pages.  Missing destination
+// pages are allocated with permission 'perm' (same restrictions as in
+// sys_page_alloc); existing ones must be writable or copy-on-write.
+// For a guest, 'dstva' is a guest physical address and 'perm' is
+// ignored.  This replaces building pages at UTEMP and mapping them.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if perm is inappropriate, or the range is above UTOP.
+//	-E_FAULT if src is not readable or a destination page is read-only.
+//	-E_NO_MEM on memory exhaustion.
+static int
+sys_env_write(envid_t envid, uintptr_t dstva, const void *src, size_t len,
+	      int perm)
+{
+	struct Env *e;
+	void *kva;
+	size_t n;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	if (e->env_type != ENV_TYPE_GUEST
+	    && ((~perm & (PTE_U|PTE_P)) || (perm & ~PTE_SYSCALL)))
+		return -E_INVAL;
+	for (; len > 0; len -= n, dstva += n, src = (const char *) src + n) {
+		n = MIN(len, PGSIZE - PGOFF(dstva));
+		if ((r = env_va2kva(e, dstva, 1, perm, &kva)) < 0)
+			return r;
+		if ((r = copy_from_user(kva, src, n)) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Copy 'len' bytes from 'srcva' in envid's address space to 'dst' in
+// the current environment.  For a guest, 'srcva' is a guest physical
+// address.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if the range is above UTOP.
+//	-E_FAULT if a source page is missing or dst is not writable.
+static int
+sys_env_read(envid_t envid, uintptr_t srcva, void *dst, size_t len)
+{
+	struct Env *e;
+	void *kva;
+	size_t n;
+	int r;
+
+	if ((r = envid2env(envid, &e, 1)) < 0)
+		return r;
+	for (; len > 0; len -= n, srcva += n, dst = (char *) dst + n) {
+		n = MIN(len, PGSIZE - PGOFF(srcva));
+		if ((r = env_va2kva(e, srcva, 0, 0, &kva)) < 0)
+			return r;
+		if ((r = copy_to_user(dst, kva, n)) < 0)
+			return r;
+	}
+	return 0;
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If srcva < UTOP, then also send page currently mapped at 'srcva',
 // so that receiver gets a duplicate mapping of the same page.
@@ -410,8 +850,11 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 		} else {
 			e->env_ipc_perm = 0;
 		}
+		e->env_ipc_npages = e->env_ipc_perm ? 1 : 0;
 
 		e->env_ipc_recving = 0;
+		e->env_notify_mask = 0;
+		e->env_notify_deadline = 0;
 		e->env_ipc_from = curenv->env_id;
 		e->env_ipc_value = value;
 		e->env_tf.tf_regs.reg_rax = 0;
@@ -445,14 +888,308 @@ sys_ipc_recv(void *dstva)
 	
 	curenv->env_ipc_recving = 1;
 	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_maxpages = 1;
 	curenv->env_status = ENV_NOT_RUNNABLE;
 	sched_yield();
 	return 0;
 #line 521 "../kern/syscall.c"
 }
 
+// Vectored form of sys_ipc_try_send: send 'value' together with the
+// 'npages' page mappings described by the user array 'pages'.
+// Page i is mapped in the receiver at env_ipc_dstva + i*PGSIZE with
+// permissions pages[i].ip_perm, so the receiver must be blocked in
+// sys_ipc_recvv with a window of at least 'npages' pages.
+// Either every page is transferred or none is.  If the receiver isn't
+// asking for pages, only the value is sent, as in sys_ipc_try_send.
+//
+// On success the target's ipc fields are updated as in sys_ipc_try_send,
+// with env_ipc_perm set to the permissions of the first page and
+// env_ipc_npages set to the number of pages transferred.
+//
+// Returns 0 on success, < 0 on error.
+// Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//	-E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv
+//		or sys_ipc_recvv, or another environment managed to send first.
+//	-E_INVAL if npages > IPC_MAXPAGES, or npages is larger than the
+//		receive window.
+//	-E_INVAL if any element of 'pages' fails the checks that
+//		sys_ipc_try_send applies to srcva and perm.
+//	-E_INVAL if either environment is a VMX guest.
+//	-E_NO_MEM if there's not enough memory to map the pages in envid's
+//		address space.
+//	-E_FAULT if 'pages' is not readable.
+static int
+sys_ipc_try_sendv(envid_t envid, uint32_t value,
+		  const struct IpcPage *upages, size_t npages)
+{
+	struct IpcPage pages[IPC_MAXPAGES];
+	struct PageInfo *pps[IPC_MAXPAGES];
+	struct Env *e;
+	pte_t *ppte;
+	size_t i;
+	int r;
+
+	if (npages > IPC_MAXPAGES)
+		return -E_INVAL;
+	if ((r = copy_from_user(pages, upages,
+				npages * sizeof(struct IpcPage))) < 0)
+		return r;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	if (!e->env_ipc_recving)
+		return -E_IPC_NOT_RECV;
+	if (curenv->env_type == ENV_TYPE_GUEST || e->env_type == ENV_TYPE_GUEST)
+		return -E_INVAL;
+
+	if (e->env_ipc_dstva >= (void*) UTOP)
+		npages = 0;
+	else if (npages > e->env_ipc_maxpages)
+		return -E_INVAL;
+
+	// Check every page before mapping any of them.
+	for (i = 0; i < npages; i++) {
+		if (pages[i].ip_va >= (void*) UTOP || PGOFF(pages[i].ip_va))
+			return -E_INVAL;
+		if ((~pages[i].ip_perm & (PTE_U|PTE_P))
+		    || (pages[i].ip_perm & ~PTE_SYSCALL))
+			return -E_INVAL;
+		if (!(pps[i] = page_lookup(curenv->env_pml4e, pages[i].ip_va, &ppte)))
+			return -E_INVAL;
+		if ((pages[i].ip_perm & PTE_W) && !(*ppte & PTE_W))
+			return -E_INVAL;
+	}
+
+	for (i = 0; i < npages; i++) {
+		r = page_insert(e->env_pml4e, pps[i],
+				(char*) e->env_ipc_dstva + i * PGSIZE,
+				pages[i].ip_perm);
+		if (r < 0) {
+			while (i-- > 0)
+				page_remove(e->env_pml4e,
+					    (char*) e->env_ipc_dstva + i * PGSIZE);
+			return r;
+		}
+	}
+
+	e->env_ipc_perm = npages ? pages[0].ip_perm : 0;
+	e->env_ipc_npages = npages;
+	e->env_ipc_recving = 0;
+	e->env_notify_mask = 0;
+	e->env_notify_deadline = 0;
+	e->env_ipc_from = curenv->env_id;
+	e->env_ipc_value = value;
+	e->env_tf.tf_regs.reg_rax = 0;
+	e->env_status = ENV_RUNNABLE;
+	return 0;
+}
+
+// Like sys_ipc_recv, but willing to receive up to 'npages' page mappings
+// from sys_ipc_try_sendv, mapped at consecutive pages starting at 'dstva'.
+// Single-page senders (sys_ipc_try_send) map their page at 'dstva'.
+//
+// This function only returns on error, but the system call will eventually
+// return 0 on success.
+// Return < 0 on error.  Errors are:
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if dstva < UTOP and npages is 0, larger than IPC_MAXPAGES,
+//		or the window extends above UTOP.
+static int
+sys_ipc_recvv(void *dstva, size_t npages)
+{
+	if (curenv->env_ipc_recving)
+		panic("already recving!");
+
+	if (dstva < (void*) UTOP) {
+		if (PGOFF(dstva))
+			return -E_INVAL;
+		if (npages == 0 || npages > IPC_MAXPAGES
+		    || npages > ((uintptr_t) UTOP - (uintptr_t) dstva) / PGSIZE)
+			return -E_INVAL;
+	}
+
+	curenv->env_ipc_recving = 1;
+	curenv->env_ipc_dstva = dstva;
+	curenv->env_ipc_maxpages = npages;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+	return 0;
+}
+
+// Set 'bits' in envid's pending notification word.  Unlike IPC this
+// never blocks: bits sent before the target takes them are OR-merged.
+// If the target is blocked in sys_notify_wait for any of the now
+// pending bits, it wakes up (and does not receive IPC).
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_notify(envid_t envid, uint64_t bits)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+	env_notify(e, bits);
+	return 0;
+}
+
+// Block until a notification bit in 'mask' is pending.  If 'ipc' is
+// true, also accept an IPC message as sys_ipc_recvv(dstva, npages)
+// would, whichever comes first.  The pending bits are left for
+// sys_notify_take.  If 'timeout' is nonzero, give up after that many
+// milliseconds.
+//
+// Returns 1 immediately if a bit in 'mask' is already pending.
+// Otherwise only returns on error, but the system call will eventually
+// return 1 if woken by a notification, 0 if an IPC message arrived, or
+// -E_TIMEOUT if the timeout expired first.
+// Return < 0 on error.  Errors are:
+//	-E_INVAL if mask is 0 and ipc is false.
+//	-E_INVAL if ipc is true and dstva and npages are not acceptable
+//		to sys_ipc_recvv.
+static int
+sys_notify_wait(uint64_t mask, bool ipc, void *dstva, size_t npages,
+		unsigned timeout)
+{
+	int r;
+
+	if (mask == 0 && !ipc)
+		return -E_INVAL;
+	if (curenv->env_notify_bits & mask)
+		return 1;
+	curenv->env_notify_mask = mask;
+	env_notify_timeout(curenv, timeout);
+	if (!ipc) {
+		curenv->env_status = ENV_NOT_RUNNABLE;
+		sched_yield();
+	}
+	r = sys_ipc_recvv(dstva, npages);
+	curenv->env_notify_mask = 0;
+	curenv->env_notify_deadline = 0;
+	return r;
+}
+
+// Clear and return the pending notification bits in 'mask'.
+static uint64_t
+sys_notify_take(uint64_t mask)
+{
+	uint64_t bits = curenv->env_notify_bits & mask;
+
+	curenv->env_notify_bits &= ~bits;
+	return bits;
+}
+
 #line 524 "../kern/syscall.c"
 
+// Block until another env calls sys_futex_wake on 'va', as long as the
+// 32-bit word at 'va' still equals 'expected' when checked.  Envs that map
+// the same physical page share its futexes.  If 'timeout' is nonzero,
+// give up after 'timeout' milliseconds.  Waiters are also woken when a
+// mapping of the futex's page is removed anywhere.
+//
+// Like sys_ipc_recv, this only returns on error; the system call
+// eventually returns 0 when woken or -E_TIMEOUT when the timeout expires.
+// Return < 0 on error.  Errors are:
+//	-E_INVAL if va is not 4-byte aligned or va >= ULIM.
+//	-E_FAULT if va is not mapped user-accessible.
+//	-E_AGAIN if the word at va does not equal 'expected'.
+static int
+sys_futex_wait(const uint32_t *va, uint32_t expected, unsigned timeout)
+{
+	return futex_wait(curenv, va, expected, timeout);
+}
+
+// Wake up to 'n' envs blocked in sys_futex_wait on 'va'.
+// Returns the number of envs woken, < 0 on error.  Errors are:
+//	-E_INVAL if va is not 4-byte aligned or va >= ULIM.
+//	-E_FAULT if va is not mapped user-accessible.
+static int
+sys_futex_wake(const uint32_t *va, int n)
+{
+	return futex_wake(curenv, va, n);
+}
+
+// Returns true if system call 'num' may be queued on a Sysring.
+// Calls that block, switch environments, or might not return are
+// excluded.
+static bool
+sysring_allowed(uint32_t num)
+{
+	switch (num) {
+	case SYS_cputs:
+	case SYS_getenvid:
+	case SYS_page_alloc:
+	case SYS_page_map:
+	case SYS_page_unmap:
+	case SYS_env_set_status:
+	case SYS_env_set_trapframe:
+	case SYS_env_set_pgfault_upcall:
+	case SYS_env_write:
+	case SYS_env_read:
+	case SYS_ipc_try_send:
+	case SYS_ipc_try_sendv:
+	case SYS_futex_wake:
+	case SYS_notify:
+	case SYS_notify_take:
+	case SYS_time_msec:
+#ifndef VMM_GUEST
+	case SYS_ept_map:
+#endif
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Run the system calls queued on 'ring' between sr_head and sr_tail,
+// at most SYSRING_SIZE of them, storing each return value in se_result
+// and advancing sr_head past it.  An entry with SYSRING_ARG(i) set gets
+// the previous entry's result as argument i.  After an entry flagged
+// SYSRING_LINK fails, the following entries of its chain complete
+// with -E_CANCELED without running.
+//
+// Returns the number of entries run.  The ring must be mapped
+// user-writable; an entry may not unmap it.
+static int
+sys_ring_enter(struct Sysring *ring)
+{
+	struct SysringEntry *ent;
+	uint64_t a[5];
+	int64_t r;
+	int n, i;
+
+	for (n = 0; n < SYSRING_SIZE; n++) {
+		// Check every time around: the previous entry may have
+		// changed our mappings.
+		user_mem_assert(curenv, ring, sizeof(*ring), PTE_U|PTE_W);
+		if (ring->sr_head == ring->sr_tail)
+			break;
+
+		ent = &ring->sr_ent[ring->sr_head % SYSRING_SIZE];
+		if (ring->sr_cancel)
+			r = -E_CANCELED;
+		else if (!sysring_allowed(ent->se_num))
+			r = -E_INVAL;
+		else {
+			for (i = 0; i < 5; i++)
+				a[i] = (ent->se_flags & SYSRING_ARG(i + 1))
+					? ring->sr_prev : ent->se_args[i];
+			r = syscall(ent->se_num, a[0], a[1], a[2], a[3], a[4]);
+			user_mem_assert(curenv, ring, sizeof(*ring), PTE_U|PTE_W);
+		}
+
+		ent->se_result = r;
+		ring->sr_prev = r;
+		ring->sr_cancel = (ent->se_flags & SYSRING_LINK) && r < 0;
+		ring->sr_head++;
+	}
+	return n;
+}
+
 // Return the current time.
 static int
 sys_time_msec(void)
@@ -465,19 +1202,43 @@ sys_time_msec(void)
 
 #line 539 "../kern/syscall.c"
 
+// The driver copies straight between the user buffer and its DMA
+// buffers with copy_from_user/copy_to_user, so a bad buffer gives
+// -E_FAULT.
 static int
 sys_net_transmit(const void *data, size_t len)
 {
-	user_mem_assert(curenv, data, len, 0);
 	return e1000_transmit(data, len);
 }
 
 static int
 sys_net_receive(void *buf, size_t len)
 {
-	user_mem_assert(curenv, buf, len, PTE_W);
 	return e1000_receive(buf, len);
 }
+
+// The controller transfers straight to and from the physical pages
+// behind the page-aligned buffer, and the caller sleeps until the
+// drive interrupts, unless an asynchronous write lets it go on and
+// collect the result with sys_disk_wait.  See ide_dma for the errors.
+static int
+sys_disk_read(int diskno, uint32_t secno, void *dst, size_t nsecs)
+{
+	return ide_dma(diskno, secno, dst, nsecs, 0, 0);
+}
+
+static int
+sys_disk_write(int diskno, uint32_t secno, const void *src, size_t nsecs,
+	       bool async)
+{
+	return ide_dma(diskno, secno, (void *) src, nsecs, 1, async);
+}
+
+static int
+sys_disk_wait(void)
+{
+	return ide_wait();
+}
 #line 554 "../kern/syscall.c"
 
 #line 556 "../kern/syscall.c"
@@ -621,6 +1382,39 @@ syscall(uint64_t syscallno, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4,
 	case SYS_ipc_recv:
 		sys_ipc_recv((void*) a1);
 		return 0;
+	case SYS_ipc_try_sendv:
+		return sys_ipc_try_sendv(a1, a2, (const struct IpcPage*) a3, a4);
+	case SYS_ipc_recvv:
+		return sys_ipc_recvv((void*) a1, a2);
+	case SYS_futex_wait:
+		return sys_futex_wait((const uint32_t*) a1, a2, a3);
+	case SYS_futex_wake:
+		return sys_futex_wake((const uint32_t*) a1, a2);
+	case SYS_ring_enter:
+		return sys_ring_enter((struct Sysring*) a1);
+	case SYS_notify:
+		return sys_notify(a1, a2);
+	case SYS_notify_wait:
+		return sys_notify_wait(a1, a2, (void*) a3, a4, a5);
+	case SYS_notify_take:
+		return sys_notify_take(a1);
+	case SYS_env_clone:
+		return sys_env_clone(a1);
+	case SYS_env_set_parent:
+		return sys_env_set_parent(a1, a2);
+	case SYS_spawn_from_pages:
+		return sys_spawn_from_pages(a1, (void *const *) a2, a3);
+	case SYS_env_write:
+		return sys_env_write(a1, a2, (const void *) a3, a4, a5);
+	case SYS_env_read:
+		return sys_env_read(a1, a2, (void *) a3, a4);
+	case SYS_env_exit:
+		sys_env_exit(a1);
+		return 0;
+	case SYS_env_wait:
+		return sys_env_wait(a1);
+	case SYS_env_keep_zombies:
+		return sys_env_keep_zombies(a1);
 #line 723 "../kern/syscall.c"
 	case SYS_time_msec:
 		return sys_time_msec();
@@ -628,6 +1422,12 @@ syscall(uint64_t syscallno, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4,
 		return sys_net_transmit((const void*)a1, a2);
 	case SYS_net_receive:
 		return sys_net_receive((void*)a1, a2);
+	case SYS_disk_read:
+		return sys_disk_read(a1, a2, (void*)a3, a4);
+	case SYS_disk_write:
+		return sys_disk_write(a1, a2, (const void*)a3, a4, a5);
+	case SYS_disk_wait:
+		return sys_disk_wait();
 #line 731 "../kern/syscall.c"
 #ifndef VMM_GUEST
 	case SYS_ept_map:
@@ -1,13 +1,75 @@
 #line 2 "../kern/time.c"
 #include <kern/time.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
+
+// The clock page shared with user space (see inc/clock.h).
+// Allocated and mapped at UCLOCK by x64_vm_init.
+struct ClockPage *clockpage;
 
 static unsigned int ticks;
 
+// PIT channel 2, which is gated through the keyboard controller's
+// port B rather than wired to an interrupt.
+#define PIT_HZ		1193182
+#define PIT_CH2		0x42
+#define PIT_MODE	0x43
+#define PIT_PORTB	0x61
+#define PORTB_GATE2	0x01
+#define PORTB_SPKR	0x02
+#define PORTB_OUT2	0x20
+
+#define CALIBRATE_MS	50
+
+// Measure the TSC frequency against PIT channel 2, in Hz.
+static uint64_t
+tsc_calibrate(void)
+{
+	uint32_t count = PIT_HZ / (1000 / CALIBRATE_MS);
+	uint64_t start, end;
+
+	// Enable the channel 2 gate with the speaker off, then start a
+	// one-shot count (mode 0, lobyte/hibyte).  OUT2 goes high when
+	// the count runs out.
+	outb(PIT_PORTB, (inb(PIT_PORTB) & ~PORTB_SPKR) | PORTB_GATE2);
+	outb(PIT_MODE, 0xB0);
+	outb(PIT_CH2, count & 0xFF);
+	outb(PIT_CH2, count >> 8);
+
+	start = read_tsc();
+	while (!(inb(PIT_PORTB) & PORTB_OUT2))
+		;
+	end = read_tsc();
+	return (end - start) * (1000 / CALIBRATE_MS);
+}
+
+// Move the clock page's base up to the current TSC, keeping the time it
+// reports continuous.  Only CPU 0 updates the page.
+static void
+clock_rebase(uint64_t ns)
+{
+	clockpage->cp_seq++;
+	asm volatile("" : : : "memory");
+	clockpage->cp_tsc_base = read_tsc();
+	clockpage->cp_ns_base = ns;
+	asm volatile("" : : : "memory");
+	clockpage->cp_seq++;
+}
+
 void
 time_init(void)
 {
+	uint64_t hz;
+
 	ticks = 0;
+
+	hz = tsc_calibrate();
+	if (hz == 0)
+		return;
+	clockpage->cp_tsc_hz = hz;
+	clockpage->cp_mult = (1000000000ULL << 32) / hz;
+	clock_rebase(0);
+	cprintf("TSC: %llu MHz\n", hz / 1000000);
 }
 
 // This should be called once per timer interrupt.  A timer interrupt
@@ -18,10 +80,21 @@ time_tick(void)
 	ticks++;
 	if (ticks * 10 < ticks)
 		panic("time_tick: time overflowed");
+	if (clockpage->cp_mult)
+		clock_rebase(time_nsec());
+}
+
+// Nanoseconds since boot, or 0 if the TSC is not calibrated.
+uint64_t
+time_nsec(void)
+{
+	return clock_page_ns(clockpage);
 }
 
 unsigned int
 time_msec(void)
 {
+	if (clockpage->cp_mult)
+		return time_nsec() / 1000000;
 	return ticks * 10;
 }
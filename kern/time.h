@@ -5,8 +5,13 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/clock.h>
+
+extern struct ClockPage *clockpage;	// Mapped read-only at UCLOCK
+
 void time_init(void);
 void time_tick(void);
 unsigned int time_msec(void);
+uint64_t time_nsec(void);
 
 #endif /* JOS_KERN_TIME_H */
@@ -18,6 +18,9 @@
 #include <kern/spinlock.h>
 #line 22 "../kern/trap.c"
 #include <kern/time.h>
+#include <kern/futex.h>
+#include <kern/ide.h>
+#include <kern/fpu.h>
 #line 25 "../kern/trap.c"
 #include <inc/vmx.h>
 #line 27 "../kern/trap.c"
@@ -182,16 +185,45 @@ trap_init_percpu(void)
 
 #line 190 "../kern/trap.c"
 	int gd_tss = (GD_TSS0 >> 3) + cpunum()*2;
-
-	thiscpu->cpu_ts.ts_esp0 = KSTACKTOP 
+	struct CpuInfo *c = &cpus[cpunum()];
+
+	// Point GS at this CPU's CpuInfo, which makes thiscpu usable.
+	// User mode starts out with a GS base of 0 (see cpu_self).
+	static_assert(offsetof(struct CpuInfo, cpu_self) == CPUINFO_SELF);
+	static_assert(offsetof(struct CpuInfo, cpu_kstacktop)
+		      == CPUINFO_KSTACKTOP);
+	c->cpu_self = c;
+#ifndef VMM_GUEST
+	write_msr(MSR_GS_BASE, (uint64_t) c);
+	write_msr(MSR_KERNEL_GS_BASE, 0);
+#endif
+
+	c->cpu_kstacktop = KSTACKTOP 
 		- (KSTKSIZE + KSTKGAP) * cpunum();
+	c->cpu_ts.ts_esp0 = c->cpu_kstacktop;
 
-	SETTSS((struct SystemSegdesc64 *)((gdt_pd>>16)+40+cpunum()*16),STS_T64A, (uint64_t) (&thiscpu->cpu_ts),sizeof(struct Taskstate), 0);
+	SETTSS((struct SystemSegdesc64 *)((gdt_pd>>16)+40+cpunum()*16),STS_T64A, (uint64_t) (&c->cpu_ts),sizeof(struct Taskstate), 0);
 
 	// Load the TSS
 	ltr(gd_tss << 3);
 #line 222 "../kern/trap.c"
 
+#ifndef VMM_GUEST
+	extern char Xsyscall_fast;
+
+	// Set up the SYSCALL/SYSRET fast path (see Xsyscall_fast).
+	// SYSCALL loads CS from STAR[47:32] and SS from the next descriptor.
+	// SYSRET loads SS and CS from the two descriptors after
+	// STAR[63:48], which is why GD_UD sits just below GD_UT.
+	// The guest kernel leaves this off, since its VMM doesn't handle
+	// these MSRs.
+	write_msr(EFER_MSR, read_msr(EFER_MSR) | EFER_SCE);
+	write_msr(MSR_STAR, ((uint64_t) (GD_KD | 3) << 48)
+		  | ((uint64_t) GD_KT << 32));
+	write_msr(MSR_LSTAR, (uint64_t) &Xsyscall_fast);
+	write_msr(MSR_FMASK, FL_IF | FL_DF | FL_TF | FL_AC | FL_NT);
+#endif
+
 	// Load the IDT
 	lidt(&idt_pd);
 }
@@ -262,6 +294,11 @@ trap_dispatch(struct Trapframe *tf)
 		page_fault_handler(tf);
 		return;
 	}
+	if (tf->tf_trapno == T_DEVICE && (tf->tf_cs & 3) == 3) {
+		// First FPU use this time slice; see kern/fpu.c.
+		fpu_trap();
+		return;
+	}
 	if (tf->tf_trapno == T_SYSCALL) {
 		// handle system call
 		tf->tf_regs.reg_rax =
@@ -304,8 +341,12 @@ trap_dispatch(struct Trapframe *tf)
 	if (tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER) {
 		// irq 0 -- clock interrupt
 #line 340 "../kern/trap.c"
-		if (cpunum() == 0)
+		if (thiscpu->cpu_id == 0) {
 			time_tick();
+			futex_tick();
+			ide_tick();
+			env_notify_tick();
+		}
 #line 350 "../kern/trap.c"
 		lapic_eoi();
 #line 352 "../kern/trap.c"
@@ -325,6 +366,16 @@ trap_dispatch(struct Trapframe *tf)
 		serial_intr();
 		return;
 	}
+	// IRQ 14 comes through the I/O APIC if there is one, and otherwise
+	// through the slave PIC, which needs an explicit EOI.
+	if (tf->tf_trapno == IRQ_OFFSET + IRQ_IDE) {
+		ide_intr();
+		if (ioapic_routed(IRQ_IDE))
+			lapic_eoi();
+		else
+			irq_eoi();
+		return;
+	}
 #line 370 "../kern/trap.c"
 
 #line 372 "../kern/trap.c"
@@ -410,13 +461,89 @@ trap(struct Trapframe *tf)
 #line 461 "../kern/trap.c"
 }
 
+// Handle a system call that entered through SYSCALL (Xsyscall_fast).
+// 'tf' lives on the kernel stack and is not copied into curenv->env_tf
+// unless something needs it there (see trap_save_syscall_frame).
+// Returns the system call result, which Xsyscall_fast hands back to the
+// environment with SYSRET.
+int64_t
+syscall_fast(struct Trapframe *tf)
+{
+	int64_t r;
+
+	lock_kernel();
+	assert(curenv);
+
+	// Garbage collect if current enviroment is a zombie
+	if (curenv->env_status == ENV_DYING) {
+		env_free(curenv);
+		curenv = NULL;
+		sched_yield();
+	}
+
+	thiscpu->cpu_syscall_tf = tf;
+	r = syscall(tf->tf_regs.reg_rax, tf->tf_regs.reg_rdx,
+		    tf->tf_regs.reg_rcx, tf->tf_regs.reg_rbx,
+		    tf->tf_regs.reg_rdi, tf->tf_regs.reg_rsi);
+
+	if (!thiscpu->cpu_syscall_tf) {
+		// The system call saved the frame to curenv->env_tf, and
+		// may have changed it, so return through env_tf.
+		curenv->env_tf.tf_regs.reg_rax = r;
+		if (curenv->env_status == ENV_RUNNING)
+			env_run(curenv);
+		else
+			sched_yield();
+	}
+	thiscpu->cpu_syscall_tf = NULL;
+	if (curenv->env_status != ENV_RUNNING) {
+		curenv->env_tf = *tf;
+		curenv->env_tf.tf_regs.reg_rax = r;
+		sched_yield();
+	}
+	unlock_kernel();
+	return r;
+}
+
+// If this CPU is in the middle of a SYSCALL-entered system call, copy
+// its trap frame into curenv->env_tf, so that curenv can be resumed (or
+// its registers inspected) without returning through Xsyscall_fast.
+// Must be called before anything reads or writes curenv->env_tf, or
+// leaves the current kernel stack behind.
+void
+trap_save_syscall_frame(void)
+{
+	struct Trapframe *tf = thiscpu->cpu_syscall_tf;
+
+	if (!tf)
+		return;
+	thiscpu->cpu_syscall_tf = NULL;
+	if (curenv)
+		curenv->env_tf = *tf;
+}
+
+
+// Return the fixup address for a kernel fault at 'rip',
+// or 0 if 'rip' is not in the exception table.
+static uintptr_t
+extable_lookup(uintptr_t rip)
+{
+	extern const struct ExTableEntry __ex_table_start[], __ex_table_end[];
+	const struct ExTableEntry *ex;
+
+	for (ex = __ex_table_start; ex < __ex_table_end; ex++)
+		if (ex->ex_insn == rip)
+			return ex->ex_fixup;
+	return 0;
+}
 
 void
 page_fault_handler(struct Trapframe *tf)
 {
 	uint64_t fault_va;
 #line 469 "../kern/trap.c"
-	struct UTrapframe *utf;
+	struct UTrapframe *utf, lutf;
+	uintptr_t fixup;
 #line 471 "../kern/trap.c"
 
 	// Read processor's CR2 register to find the faulting address
@@ -424,12 +551,26 @@ page_fault_handler(struct Trapframe *tf)
 
 #line 476 "../kern/trap.c"
 	if ((tf->tf_cs & 3) == 0) {
+		// A user access through copy_user: resolve copy-on-write
+		// and retry, or else let it fail.
+		if ((fixup = extable_lookup(tf->tf_rip)) != 0) {
+			if (!((tf->tf_err & FEC_WR) && curenv
+			      && page_cow(curenv->env_pml4e,
+					  (void *) fault_va) == 0))
+				tf->tf_rip = fixup;
+			trap_kernel_return(tf);
+		}
 		print_trapframe(tf);
 		panic("page fault");
 	}
 #line 485 "../kern/trap.c"
 
 #line 487 "../kern/trap.c"
+	// Copy-on-write pages are handled here, without an upcall.
+	if ((tf->tf_err & FEC_WR) && page_cow(curenv->env_pml4e,
+					      (void *) fault_va) == 0)
+		env_run(curenv);
+
 	// See if the environment has installed a user page fault handler.
 	if (curenv->env_pgfault_upcall == 0) {
 		cprintf("[%08x] user fault va %08x ip %08x\n",
@@ -457,18 +598,20 @@ page_fault_handler(struct Trapframe *tf)
 					   - sizeof(struct UTrapframe));
 	}
 
+	// fill utf
+	lutf.utf_fault_va = fault_va;
+	lutf.utf_err = tf->tf_err;
+	lutf.utf_regs = tf->tf_regs;
+	lutf.utf_rip = tf->tf_rip;
+	lutf.utf_eflags = tf->tf_eflags;
+	lutf.utf_rsp = tf->tf_rsp;
+
 	// If we can't write to the exception stack,
 	// it means the user environment is seriously screwed up,
-	// so just terminate it.
-	user_mem_assert(curenv, utf, sizeof(struct UTrapframe), PTE_U | PTE_W);
-
-	// fill utf
-	utf->utf_fault_va = fault_va;
-	utf->utf_err = tf->tf_err;
-	utf->utf_regs = tf->tf_regs;
-	utf->utf_rip = tf->tf_rip;
-	utf->utf_eflags = tf->tf_eflags;
-	utf->utf_rsp = tf->tf_rsp;
+	// so just terminate it.  user_mem_assert finds and reports
+	// the bad page.
+	if (copy_to_user(utf, &lutf, sizeof(lutf)) < 0)
+		user_mem_assert(curenv, utf, sizeof(lutf), PTE_U | PTE_W);
 
  	// set user registers so that env_run switches to fault handler
 	tf->tf_rsp = (uintptr_t) utf;
@@ -10,6 +10,13 @@
 #include <inc/trap.h>
 #include <inc/mmu.h>
 
+/* An exception table entry: a fault at 'ex_insn' in the kernel resumes
+ * at 'ex_fixup' instead of panicking.  See kern/usercopy.S. */
+struct ExTableEntry {
+	uintptr_t ex_insn;
+	uintptr_t ex_fixup;
+};
+
 /* The kernel's interrupt descriptor table */
 extern struct Gatedesc idt[];
 extern struct Pseudodesc idt_pd;
@@ -19,6 +26,9 @@ void trap_init_percpu(void);
 void print_regs(struct PushRegs *regs);
 void print_trapframe(struct Trapframe *tf);
 void page_fault_handler(struct Trapframe *);
+int64_t syscall_fast(struct Trapframe *tf);
+void trap_save_syscall_frame(void);
+void trap_kernel_return(struct Trapframe *tf) __attribute__((noreturn));
 void backtrace(struct Trapframe *);
 
 #endif /* JOS_KERN_TRAP_H */
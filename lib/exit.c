@@ -4,10 +4,17 @@
 
 void
 exit(void)
+{
+	exit_with(0);
+}
+
+// Exits, reporting 'status' to anyone in sys_env_wait for this env.
+void
+exit_with(int status)
 {
 #line 9 "../lib/exit.c"
 	close_all();
 #line 11 "../lib/exit.c"
-	sys_env_destroy(0);
+	sys_env_exit(status);
 }
 
@@ -11,14 +11,18 @@
 #define MAXFD		32
 // Bottom of file descriptor area
 #define FDTABLE		0xD0000000
-// Bottom of file data area.  We reserve one data page for each FD,
-// which devices can use if they choose.
+// Bottom of file data area.  We reserve FDDATAPAGES data pages for
+// each FD, which devices can use if they choose.
 #define FILEDATA	(FDTABLE + MAXFD*PGSIZE)
 
 // Return the 'struct Fd*' for file descriptor index i
 #define INDEX2FD(i)	((struct Fd*) (FDTABLE + ((uint64_t)i)*PGSIZE))
-// Return the file data page for file descriptor index i
-#define INDEX2DATA(i)	((char*) (FILEDATA + (i)*PGSIZE))
+// Return the first file data page for file descriptor index i
+#define INDEX2DATA(i)	((char*) (FILEDATA + (i)*FDDATAPAGES*PGSIZE))
+
+// Window through which splice moves data pages
+#define SPLICEVA	0xE4000000
+#define SPLICE_MAXPAGES	16
 
 
 // --------------------------------------------------------------
@@ -182,7 +186,7 @@ close_all(void)
 int
 dup(int oldfdnum, int newfdnum)
 {
-	int r;
+	int r, i;
 	char *ova, *nva;
 	pte_t pte;
 	struct Fd *oldfd, *newfd;
@@ -195,9 +199,14 @@ dup(int oldfdnum, int newfdnum)
 	ova = fd2data(oldfd);
 	nva = fd2data(newfd);
 
-	if ((uvpd[VPD(ova)] & PTE_P) && (uvpt[PGNUM(ova)] & PTE_P))
-		if ((r = sys_page_map(0, ova, 0, nva, uvpt[PGNUM(ova)] & PTE_SYSCALL)) < 0)
-			goto err;
+	// Map the data pages before the fd page, so that the data pages
+	// never have fewer references than the fd (see _pipeisclosed).
+	for (i = 0; i < FDDATAPAGES; i++, ova += PGSIZE, nva += PGSIZE)
+		if ((uvpd[VPD(ova)] & PTE_P) && (uvpt[PGNUM(ova)] & PTE_P))
+			sysring_push(SYS_page_map, SYSRING_LINK, 0, (uint64_t) ova,
+				     0, (uint64_t) nva, uvpt[PGNUM(ova)] & PTE_SYSCALL);
+	if ((r = sysring_submit()) < 0)
+		goto err;
 	if ((r = sys_page_map(0, oldfd, 0, newfd, uvpt[PGNUM(oldfd)] & PTE_SYSCALL)) < 0)
 		goto err;
 
@@ -205,7 +214,11 @@ dup(int oldfdnum, int newfdnum)
 
 err:
 	sys_page_unmap(0, newfd);
-	sys_page_unmap(0, nva);
+	nva = fd2data(newfd);
+	for (i = 0; i < FDDATAPAGES; i++)
+		sysring_push(SYS_page_unmap, 0, 0, (uint64_t) (nva + i * PGSIZE),
+			     0, 0, 0);
+	sysring_submit();
 	return r;
 }
 
@@ -265,6 +278,259 @@ write(int fdnum, const void *buf, size_t n)
 	return (*dev->dev_write)(fd, buf, n);
 }
 
+// Return the total length of the iovecs.
+size_t
+iov_total(const struct iovec *iov, int iovcnt)
+{
+	size_t n = 0;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		n += iov[i].iov_len;
+	return n;
+}
+
+// Copy the first 'n' bytes described by the iovecs to 'dst'.
+// Returns the number of bytes copied, which is less than 'n' if the
+// iovecs are shorter.
+size_t
+iov_gather(void *dst, const struct iovec *iov, int iovcnt, size_t n)
+{
+	size_t c, done = 0;
+	int i;
+
+	for (i = 0; i < iovcnt && done < n; i++) {
+		c = MIN(iov[i].iov_len, n - done);
+		memmove((char*) dst + done, iov[i].iov_base, c);
+		done += c;
+	}
+	return done;
+}
+
+// Copy 'n' bytes from 'src' into the buffers described by the iovecs,
+// which must hold at least that much.
+void
+iov_scatter(const struct iovec *iov, int iovcnt, const void *src, size_t n)
+{
+	size_t c;
+	int i;
+
+	for (i = 0; i < iovcnt && n > 0; i++) {
+		c = MIN(iov[i].iov_len, n);
+		memmove(iov[i].iov_base, src, c);
+		src = (const char*) src + c;
+		n -= c;
+	}
+}
+
+// Read into the 'iovcnt' buffers in 'iov' in order, filling each
+// before moving on to the next.  Like read, this may return less than
+// the total length; it stops early only where a read would.
+ssize_t
+readv(int fdnum, const struct iovec *iov, int iovcnt)
+{
+	int r, i;
+	size_t tot = 0;
+	struct Dev *dev;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0
+	    || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
+		return r;
+	if ((fd->fd_omode & O_ACCMODE) == O_WRONLY) {
+		cprintf("[%08x] readv %d -- bad mode\n", thisenv->env_id, fdnum);
+		return -E_INVAL;
+	}
+	if (iovcnt < 0 || iovcnt > IOV_MAX)
+		return -E_INVAL;
+	if (dev->dev_readv)
+		return (*dev->dev_readv)(fd, iov, iovcnt);
+	if (!dev->dev_read)
+		return -E_NOT_SUPP;
+	for (i = 0; i < iovcnt; i++) {
+		if ((r = (*dev->dev_read)(fd, iov[i].iov_base, iov[i].iov_len)) < 0)
+			return tot ? tot : r;
+		tot += r;
+		if (r < iov[i].iov_len)
+			break;
+	}
+	return tot;
+}
+
+// Write the 'iovcnt' buffers in 'iov' in order.  Devices with
+// dev_writev send them all in one request where they fit.
+ssize_t
+writev(int fdnum, const struct iovec *iov, int iovcnt)
+{
+	int r, i;
+	size_t tot = 0;
+	struct Dev *dev;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0
+	    || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
+		return r;
+	if ((fd->fd_omode & O_ACCMODE) == O_RDONLY) {
+		cprintf("[%08x] writev %d -- bad mode\n", thisenv->env_id, fdnum);
+		return -E_INVAL;
+	}
+	if (iovcnt < 0 || iovcnt > IOV_MAX)
+		return -E_INVAL;
+	if (dev->dev_writev)
+		return (*dev->dev_writev)(fd, iov, iovcnt);
+	if (!dev->dev_write)
+		return -E_NOT_SUPP;
+	for (i = 0; i < iovcnt; i++) {
+		if ((r = (*dev->dev_write)(fd, iov[i].iov_base, iov[i].iov_len)) < 0)
+			return tot ? tot : r;
+		tot += r;
+		if (r < iov[i].iov_len)
+			break;
+	}
+	return tot;
+}
+
+// Like readv and writev, but at 'offset' rather than the current
+// position, which is left alone.  Devices without a position, such as
+// pipes and sockets, ignore 'offset'.  The position lives in the Fd
+// page, so envs sharing the fd should not seek it at the same time.
+ssize_t
+preadv(int fdnum, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	int r;
+	off_t pos;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	pos = fd->fd_offset;
+	fd->fd_offset = offset;
+	r = readv(fdnum, iov, iovcnt);
+	fd->fd_offset = pos;
+	return r;
+}
+
+ssize_t
+pwritev(int fdnum, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	int r;
+	off_t pos;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	pos = fd->fd_offset;
+	fd->fd_offset = offset;
+	r = writev(fdnum, iov, iovcnt);
+	fd->fd_offset = pos;
+	return r;
+}
+
+// Unmap the pages in splice's window.
+static void
+splice_unmap(void)
+{
+	int i;
+
+	for (i = 0; i < SPLICE_MAXPAGES; i++)
+		sysring_push(SYS_page_unmap, 0, 0, SPLICEVA + i * PGSIZE, 0, 0, 0);
+	sysring_submit();
+}
+
+// Copy up to 'len' bytes from 'in' to 'out' through a bounce buffer,
+// for green threads, which can't share splice's window.
+static ssize_t
+splice_copy(int fdin, int fdout, size_t len)
+{
+	size_t total = 0;
+	ssize_t r = 0, w;
+	char *buf;
+
+	if ((buf = malloc(PGSIZE)) == 0)
+		return -E_NO_MEM;
+	while (total < len) {
+		if ((r = read(fdin, buf, MIN(len - total, PGSIZE))) <= 0)
+			break;
+		if ((w = write(fdout, buf, r)) != r) {
+			r = w < 0 ? w : 0;
+			total += MAX(w, 0);
+			break;
+		}
+		total += r;
+	}
+	free(buf);
+	return total ? total : r;
+}
+
+// Move up to 'len' bytes from 'fdin' to 'fdout', stopping early at end
+// of file.  Devices with dev_readpages/dev_writepages pass whole pages
+// along by remapping them: a file sent to a socket goes from the file
+// server's block cache to the network server without being copied in
+// between.  Other devices, and partial pages, fall back to copying
+// through the same pages.
+// Returns the number of bytes moved, or < 0 on error if none were.
+ssize_t
+splice(int fdin, int fdout, size_t len)
+{
+	int r;
+	ssize_t n, w = 0;
+	size_t total = 0, off, i, npages;
+	struct Dev *din, *dout;
+	struct Fd *in, *out;
+	char *va = (char*) SPLICEVA;
+
+	if ((r = fd_lookup(fdin, &in)) < 0
+	    || (r = dev_lookup(in->fd_dev_id, &din)) < 0
+	    || (r = fd_lookup(fdout, &out)) < 0
+	    || (r = dev_lookup(out->fd_dev_id, &dout)) < 0)
+		return r;
+	if ((in->fd_omode & O_ACCMODE) == O_WRONLY
+	    || (out->fd_omode & O_ACCMODE) == O_RDONLY)
+		return -E_INVAL;
+	if (!din->dev_read || !dout->dev_write)
+		return -E_NOT_SUPP;
+	if (thread_active())
+		return splice_copy(fdin, fdout, len);
+
+	while (total < len) {
+		n = MIN(len - total, SPLICE_MAXPAGES * PGSIZE);
+		if (din->dev_readpages)
+			n = (*din->dev_readpages)(in, va, n);
+		else {
+			npages = ROUNDUP(n, PGSIZE) / PGSIZE;
+			for (i = 0; i < npages; i++)
+				sysring_push(SYS_page_alloc, SYSRING_LINK, 0,
+					     (uint64_t) va + i * PGSIZE,
+					     PTE_P|PTE_U|PTE_W, 0, 0);
+			if ((r = sysring_submit()) == 0)
+				n = (*din->dev_read)(in, va, n);
+			else
+				n = r;
+		}
+		if (n <= 0) {
+			splice_unmap();
+			r = n;
+			break;
+		}
+
+		for (off = 0; off < n; off += w) {
+			if (dout->dev_writepages && off % PGSIZE == 0)
+				w = (*dout->dev_writepages)(out, va + off, n - off);
+			else
+				w = (*dout->dev_write)(out, va + off, n - off);
+			if (w <= 0)
+				break;
+		}
+		splice_unmap();
+		total += off;
+		if (w <= 0) {
+			r = w;
+			break;
+		}
+	}
+	return total ? total : r;
+}
+
 int
 seek(int fdnum, off_t offset)
 {
@@ -311,6 +577,7 @@ fstat(int fdnum, struct Stat *stat)
 	stat->st_name[0] = 0;
 	stat->st_size = 0;
 	stat->st_isdir = 0;
+	stat->st_version = 0;
 	stat->st_dev = dev;
 	return (*dev->dev_stat)(fd, stat);
 }
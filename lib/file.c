@@ -11,7 +11,7 @@
 
 #define debug 0
 
-union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
+union Fsipc fsipcbuf THREAD_LOCAL __attribute__((aligned(PGSIZE)));
 
 // Send an inter-environment request to the file server, and wait for
 // a reply.  The request body should be in fsipcbuf, and parts of the
@@ -31,15 +31,61 @@ fsipc(unsigned type, void *dstva)
 	if (debug)
 		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
+	// Green threads keep running while this one waits for the reply.
+	if (thread_active())
+		return thread_ipc_call(fsenv, type, &fsipcbuf, dstva);
+
 	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
 	return ipc_recv(NULL, dstva, NULL);
 }
 
+// Window at which bulk data pages are staged for FSREQ_WRITE_BULK
+// and received from FSREQ_READ_BULK.
+#define FSBULKVA	0xE0000000
+
+// Like fsipc, but sends the 'ndata' pages at 'va' after the request
+// page and receives up to FSBULK_MAXPAGES reply pages at 'va', storing
+// the number received in *npages_store.  The pages sent are lent to
+// the server rather than copied, so leave them alone until this returns.
+static int
+fsipcv(unsigned type, void *va, size_t ndata, size_t *npages_store)
+{
+	static envid_t fsenv;
+	struct IpcPage pages[1 + FSBULK_MAXPAGES];
+	size_t i;
+
+	if (fsenv == 0)
+		fsenv = ipc_find_env(ENV_TYPE_FS);
+
+	if (debug)
+		cprintf("[%08x] fsipcv %d %08x +%d\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf, (int) ndata);
+
+	pages[0].ip_va = &fsipcbuf;
+	pages[0].ip_perm = PTE_P | PTE_W | PTE_U;
+	for (i = 0; i < ndata; i++) {
+		pages[1 + i].ip_va = (char*) va + i * PGSIZE;
+		pages[1 + i].ip_perm = PTE_P | PTE_U;
+	}
+	ipc_sendv(fsenv, type, pages, 1 + ndata);
+	return ipc_recvv(NULL, va, FSBULK_MAXPAGES, npages_store);
+}
+
 static int devfile_flush(struct Fd *fd);
 static ssize_t devfile_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devfile_write(struct Fd *fd, const void *buf, size_t n);
+static ssize_t devfile_readv(struct Fd *fd, const struct iovec *iov, int iovcnt);
+static ssize_t devfile_writev(struct Fd *fd, const struct iovec *iov, int iovcnt);
 static int devfile_stat(struct Fd *fd, struct Stat *stat);
 static int devfile_trunc(struct Fd *fd, off_t newsize);
+static ssize_t devfile_readpages(struct Fd *fd, void *va, size_t n);
+static ssize_t devfile_writepages(struct Fd *fd, void *va, size_t n);
+static ssize_t file_rawreadv(struct Fd *fd, const struct iovec *iov, int iovcnt);
+static ssize_t file_rawwritev(struct Fd *fd, const struct iovec *iov, int iovcnt);
+static int filebuf_alloc(struct Fd *fd);
+static void filebuf_free(struct Fd *fd);
+static int filebuf_flush(struct Fd *fd);
+static ssize_t filebuf_readv(struct Fd *fd, const struct iovec *iov, int iovcnt);
+static ssize_t filebuf_writev(struct Fd *fd, const struct iovec *iov, int iovcnt);
 
 struct Dev devfile =
 {
@@ -49,7 +95,11 @@ struct Dev devfile =
 	.dev_close =	devfile_flush,
 	.dev_stat =	devfile_stat,
 	.dev_write =	devfile_write,
-	.dev_trunc =	devfile_trunc
+	.dev_trunc =	devfile_trunc,
+	.dev_readv =	devfile_readv,
+	.dev_writev =	devfile_writev,
+	.dev_readpages = devfile_readpages,
+	.dev_writepages = devfile_writepages
 };
 
 // Open a file (or directory).
@@ -92,6 +142,10 @@ open(const char *path, int mode)
 		fd_close(fd, 0);
 		return r;
 	}
+	if ((mode & O_BUFFERED) && (r = filebuf_alloc(fd)) < 0) {
+		fd_close(fd, 0);
+		return r;
+	}
 
 	return fd2num(fd);
 #line 101 "../lib/file.c"
@@ -108,6 +162,31 @@ open(const char *path, int mode)
 static int
 devfile_flush(struct Fd *fd)
 {
+	int r, r2;
+
+	r = filebuf_flush(fd);
+	if (fd->fd_omode & O_BUFFERED)
+		filebuf_free(fd);
+	fsipcbuf.flush.req_fileid = fd->fd_file.id;
+	r2 = fsipc(FSREQ_FLUSH, NULL);
+	return r < 0 ? r : r2;
+}
+
+// Write out the buffered writes of file 'fdnum' and have the file
+// server flush the file to disk.
+// Returns 0 on success, < 0 on error.
+int
+fsync(int fdnum)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	if ((r = filebuf_flush(fd)) < 0)
+		return r;
 	fsipcbuf.flush.req_fileid = fd->fd_file.id;
 	return fsipc(FSREQ_FLUSH, NULL);
 }
@@ -125,17 +204,52 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 	// bytes read will be written back to fsipcbuf by the file
 	// system server.
 #line 131 "../lib/file.c"
+	struct iovec iov = { buf, n };
+
+	return devfile_readv(fd, &iov, 1);
+#line 145 "../lib/file.c"
+}
+
+static ssize_t
+devfile_readv(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
+	if (fd->fd_omode & O_BUFFERED)
+		return filebuf_readv(fd, iov, iovcnt);
+	return file_rawreadv(fd, iov, iovcnt);
+}
+
+// Read into the buffers described by 'iov' with a single request.
+static ssize_t
+file_rawreadv(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
 	int r;
+	size_t n, npages, i;
+
+	n = iov_total(iov, iovcnt);
+
+	// Large reads move the data in whole pages with one bulk IPC.
+	// Green threads share the bulk window, so they stick to one page.
+	if (n > PGSIZE && !thread_active()) {
+		fsipcbuf.bulk.req_fileid = fd->fd_file.id;
+		fsipcbuf.bulk.req_n = MIN(n, FSBULK_MAXPAGES * PGSIZE);
+		r = fsipcv(FSREQ_READ_BULK, (void*) FSBULKVA, 0, &npages);
+		if (r > 0) {
+			assert(r <= n);
+			iov_scatter(iov, iovcnt, (void*) FSBULKVA, r);
+		}
+		for (i = 0; i < npages; i++)
+			sys_page_unmap(0, (void*) (FSBULKVA + i * PGSIZE));
+		return r;
+	}
 
 	fsipcbuf.read.req_fileid = fd->fd_file.id;
-	fsipcbuf.read.req_n = n;
+	fsipcbuf.read.req_n = MIN(n, PGSIZE);
 	if ((r = fsipc(FSREQ_READ, NULL)) < 0)
 		return r;
 	assert(r <= n);
 	assert(r <= PGSIZE);
-	memmove(buf, &fsipcbuf, r);
+	iov_scatter(iov, iovcnt, &fsipcbuf, r);
 	return r;
-#line 145 "../lib/file.c"
 }
 
 // Write at most 'n' bytes from 'buf' to 'fd' at the current seek position.
@@ -151,17 +265,91 @@ devfile_write(struct Fd *fd, const void *buf, size_t n)
 	// remember that write is always allowed to write *fewer*
 	// bytes than requested.
 #line 160 "../lib/file.c"
+	struct iovec iov = { (void*) buf, n };
+
+	return devfile_writev(fd, &iov, 1);
+#line 174 "../lib/file.c"
+}
+
+static ssize_t
+devfile_writev(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
+	if (fd->fd_omode & O_BUFFERED)
+		return filebuf_writev(fd, iov, iovcnt);
+	return file_rawwritev(fd, iov, iovcnt);
+}
+
+// Write the buffers described by 'iov', gathered into one request.
+static ssize_t
+file_rawwritev(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
 	int r;
+	size_t n, npages, i;
+
+	n = iov_total(iov, iovcnt);
+
+	// Writes that don't fit in the request page go as a bulk IPC
+	// (except from green threads, as in devfile_readv).
+	if (n > sizeof(fsipcbuf.write.req_buf) && !thread_active()) {
+		n = MIN(n, FSBULK_MAXPAGES * PGSIZE);
+		npages = ROUNDUP(n, PGSIZE) / PGSIZE;
+		for (i = 0; i < npages; i++)
+			if ((r = sys_page_alloc(0, (void*) (FSBULKVA + i * PGSIZE),
+						PTE_P | PTE_U | PTE_W)) < 0) {
+				while (i-- > 0)
+					sys_page_unmap(0, (void*) (FSBULKVA + i * PGSIZE));
+				return r;
+			}
+		iov_gather((void*) FSBULKVA, iov, iovcnt, n);
+		fsipcbuf.bulk.req_fileid = fd->fd_file.id;
+		fsipcbuf.bulk.req_n = n;
+		r = fsipcv(FSREQ_WRITE_BULK, (void*) FSBULKVA, npages, NULL);
+		for (i = 0; i < npages; i++)
+			sys_page_unmap(0, (void*) (FSBULKVA + i * PGSIZE));
+		assert(r <= n);
+		return r;
+	}
 
 	n = MIN(n, sizeof(fsipcbuf.write.req_buf));
 	fsipcbuf.write.req_fileid = fd->fd_file.id;
 	fsipcbuf.write.req_n = n;
-	memmove(fsipcbuf.write.req_buf, buf, n);
+	iov_gather(fsipcbuf.write.req_buf, iov, iovcnt, n);
 	if ((r = fsipc(FSREQ_WRITE, NULL)) < 0)
 		return r;
 	assert(r <= n);
 	return r;
-#line 174 "../lib/file.c"
+}
+
+// Map pages holding at most 'n' bytes from 'fd' at the current position
+// at 'va'.  Whole blocks at a block-aligned position come straight from
+// the file server's block cache, read-only.
+// Returns the number of bytes read, or < 0 on error.
+static ssize_t
+devfile_readpages(struct Fd *fd, void *va, size_t n)
+{
+	int r;
+
+	if ((r = filebuf_flush(fd)) < 0)
+		return r;
+	fsipcbuf.bulk.req_fileid = fd->fd_file.id;
+	fsipcbuf.bulk.req_n = MIN(n, FSBULK_MAXPAGES * PGSIZE);
+	return fsipcv(FSREQ_READ_BULK, va, 0, NULL);
+}
+
+// Write at most 'n' bytes from the pages at 'va' to 'fd' at the
+// current position by sending the pages to the file server.
+// Returns the number of bytes written, or < 0 on error.
+static ssize_t
+devfile_writepages(struct Fd *fd, void *va, size_t n)
+{
+	int r;
+
+	if ((r = filebuf_flush(fd)) < 0)
+		return r;
+	n = MIN(n, FSBULK_MAXPAGES * PGSIZE);
+	fsipcbuf.bulk.req_fileid = fd->fd_file.id;
+	fsipcbuf.bulk.req_n = n;
+	return fsipcv(FSREQ_WRITE_BULK, va, ROUNDUP(n, PGSIZE) / PGSIZE, NULL);
 }
 
 static int
@@ -169,12 +357,15 @@ devfile_stat(struct Fd *fd, struct Stat *st)
 {
 	int r;
 
+	if ((r = filebuf_flush(fd)) < 0)
+		return r;
 	fsipcbuf.stat.req_fileid = fd->fd_file.id;
 	if ((r = fsipc(FSREQ_STAT, NULL)) < 0)
 		return r;
 	strcpy(st->st_name, fsipcbuf.statRet.ret_name);
 	st->st_size = fsipcbuf.statRet.ret_size;
 	st->st_isdir = fsipcbuf.statRet.ret_isdir;
+	st->st_version = fsipcbuf.statRet.ret_version;
 	return 0;
 }
 
@@ -182,11 +373,205 @@ devfile_stat(struct Fd *fd, struct Stat *st)
 static int
 devfile_trunc(struct Fd *fd, off_t newsize)
 {
+	int r;
+
+	if ((r = filebuf_flush(fd)) < 0)
+		return r;
 	fsipcbuf.set_size.req_fileid = fd->fd_file.id;
 	fsipcbuf.set_size.req_size = newsize;
 	return fsipc(FSREQ_SET_SIZE, NULL);
 }
 
+// Client-side buffering for files opened with O_BUFFERED.
+//
+// The buffer is FILEBUFPAGES of the fd's data pages, and its state
+// (which file bytes it holds, and whether they are reads or pending
+// writes) lives in fd_file in the Fd page.  Both are shared, so envs
+// that share the fd through fork, spawn or dup share one buffer and
+// see each other's buffered writes.  fd_offset stays the logical
+// position, which the server only sees while we fill or flush the
+// buffer, so seek needs no help: the buffer is keyed by file offset
+// and simply stops matching.
+//
+// Reads fill the whole buffer from a page-aligned offset at a time.
+// Writes collect in the buffer as long as they follow on from each
+// other and go out when it fills, on a non-contiguous write or any
+// read, on fsync and on close.  Changes other envs make to the file
+// through their own fds are not seen by read-ahead already buffered.
+
+#define FILEBUFPAGES	8
+#define FILEBUFSIZ	(FILEBUFPAGES * PGSIZE)
+
+static int
+filebuf_alloc(struct Fd *fd)
+{
+	size_t i;
+	int r;
+
+	for (i = 0; i < FILEBUFPAGES; i++)
+		sysring_push(SYS_page_alloc, SYSRING_LINK, 0,
+			     (uint64_t) fd2data(fd) + i * PGSIZE,
+			     PTE_P|PTE_W|PTE_U|PTE_SHARE, 0, 0);
+	if ((r = sysring_submit()) < 0) {
+		filebuf_free(fd);
+		return r;
+	}
+	fd->fd_file.buf_off = 0;
+	fd->fd_file.buf_len = 0;
+	fd->fd_file.buf_dirty = 0;
+	fd->fd_omode |= O_BUFFERED;
+	return 0;
+}
+
+static void
+filebuf_free(struct Fd *fd)
+{
+	size_t i;
+
+	for (i = 0; i < FILEBUFPAGES; i++)
+		sysring_push(SYS_page_unmap, 0, 0,
+			     (uint64_t) fd2data(fd) + i * PGSIZE, 0, 0, 0);
+	sysring_submit();
+}
+
+// Write out any buffered writes and empty the buffer, so that the file
+// server's view of the file is the whole story.
+static int
+filebuf_flush(struct Fd *fd)
+{
+	struct FdFile *f = &fd->fd_file;
+	struct iovec iov;
+	off_t pos = fd->fd_offset;
+	size_t done;
+	ssize_t r;
+
+	if (!(fd->fd_omode & O_BUFFERED))
+		return 0;
+	if (f->buf_dirty) {
+		fd->fd_offset = f->buf_off;
+		for (done = 0; done < f->buf_len; done += r) {
+			iov.iov_base = fd2data(fd) + done;
+			iov.iov_len = f->buf_len - done;
+			if ((r = file_rawwritev(fd, &iov, 1)) <= 0) {
+				// Keep the writes buffered for a later try.
+				fd->fd_offset = pos;
+				return r < 0 ? r : -E_NO_DISK;
+			}
+		}
+		fd->fd_offset = pos;
+	}
+	f->buf_len = 0;
+	f->buf_dirty = 0;
+	return 0;
+}
+
+// Fill the buffer with the file's bytes from 'off' on, up to EOF.
+static int
+filebuf_fill(struct Fd *fd, off_t off)
+{
+	struct FdFile *f = &fd->fd_file;
+	struct iovec iov;
+	off_t pos = fd->fd_offset;
+	size_t len = 0;
+	ssize_t r;
+
+	f->buf_off = off;
+	f->buf_len = 0;
+	fd->fd_offset = off;
+	// Green threads read a page per request, so it can take a few.
+	// A read ending mid-page has hit EOF.
+	do {
+		iov.iov_base = fd2data(fd) + len;
+		iov.iov_len = FILEBUFSIZ - len;
+		if ((r = file_rawreadv(fd, &iov, 1)) < 0) {
+			fd->fd_offset = pos;
+			return r;
+		}
+		len += r;
+	} while (r > 0 && r % PGSIZE == 0 && len < FILEBUFSIZ);
+	fd->fd_offset = pos;
+	f->buf_len = len;
+	return 0;
+}
+
+static ssize_t
+filebuf_readv(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
+	struct FdFile *f = &fd->fd_file;
+	off_t pos = fd->fd_offset, end;
+	size_t n;
+	int r;
+
+	n = iov_total(iov, iovcnt);
+	if (f->buf_dirty && (r = filebuf_flush(fd)) < 0)
+		return r;
+	end = f->buf_off + f->buf_len;
+	if (pos < f->buf_off || pos >= end) {
+		// Reads as big as the buffer gain nothing from it.
+		if (n >= FILEBUFSIZ)
+			return file_rawreadv(fd, iov, iovcnt);
+		if ((r = filebuf_fill(fd, ROUNDDOWN(pos, PGSIZE))) < 0)
+			return r;
+		end = f->buf_off + f->buf_len;
+		if (pos >= end)
+			return 0;
+	}
+	n = MIN(n, (size_t) (end - pos));
+	iov_scatter(iov, iovcnt, fd2data(fd) + (pos - f->buf_off), n);
+	fd->fd_offset = pos + n;
+	return n;
+}
+
+// Buffer all of the write, sending the buffer on whenever it fills.
+static ssize_t
+filebuf_writev(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
+	struct FdFile *f = &fd->fd_file;
+	size_t n, c, done = 0;
+	int i, r;
+
+	for (i = 0; i < iovcnt; i++)
+		for (n = 0; n < iov[i].iov_len; n += c) {
+			// Start over unless this write carries on from
+			// the buffered ones and there is room for it.
+			if (!f->buf_dirty || f->buf_len == FILEBUFSIZ
+			    || fd->fd_offset != f->buf_off + f->buf_len) {
+				if ((r = filebuf_flush(fd)) < 0)
+					return done ? done : r;
+				f->buf_off = fd->fd_offset;
+				f->buf_dirty = 1;
+			}
+			c = MIN(iov[i].iov_len - n, FILEBUFSIZ - f->buf_len);
+			memmove(fd2data(fd) + f->buf_len,
+				(char*) iov[i].iov_base + n, c);
+			f->buf_len += c;
+			fd->fd_offset += c;
+			done += c;
+		}
+	return done;
+}
+
+// Ask the file server to load the program in the open file 'fdnum'
+// into 'child', which must be a new child of ours, straight from its
+// block cache (see sys_spawn_from_pages).
+// Returns 0 on success, < 0 on error.
+int
+file_load_program(int fdnum, envid_t child)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	if ((r = filebuf_flush(fd)) < 0)
+		return r;
+	fsipcbuf.spawn.req_fileid = fd->fd_file.id;
+	fsipcbuf.spawn.req_envid = child;
+	return fsipc(FSREQ_SPAWN, NULL);
+}
+
 // Delete a file
 int
 remove(const char *path)
@@ -197,6 +582,19 @@ remove(const char *path)
 	return fsipc(FSREQ_REMOVE, NULL);
 }
 
+// Get the file server's block cache counters.
+// Returns 0 on success, < 0 on error.
+int
+fs_cachestat(struct CacheStat *cs)
+{
+	int r;
+
+	if ((r = fsipc(FSREQ_CACHESTAT, NULL)) < 0)
+		return r;
+	*cs = fsipcbuf.cachestatRet.ret_stat;
+	return 0;
+}
+
 // Synchronize disk with buffer cache
 int
 sync(void)
@@ -8,10 +8,6 @@
 #define debug 0
 #line 10 "../lib/fork.c"
 
-// PTE_COW marks copy-on-write page table entries.
-// It is one of the bits explicitly allocated to user processes (PTE_AVAIL).
-#define PTE_COW		0x800
-
 //
 // Custom page fault handler - if faulting page is copy-on-write,
 // map in our own private writable copy.
@@ -170,10 +166,81 @@ fork(void)
 #line 204 "../lib/fork.c"
 }
 
-// Challenge!
-int
+//
+// Map our page pn into envid at the same address, sharing it: writes
+// by either env are seen by both.  A copy-on-write page is first made
+// private to us (by writing to it) so that there is something to share.
+//
+static int
+sharepage(envid_t envid, unsigned pn)
+{
+	volatile uint8_t *addr = (uint8_t *) ((uintptr_t) pn << PGSHIFT);
+	int r;
+
+	if (uvpt[pn] & PTE_COW)
+		*addr = *addr;
+	if ((r = sys_page_map(0, (void *) addr, envid, (void *) addr,
+			      uvpt[pn] & PTE_SYSCALL)) < 0)
+		panic("sys_page_map: %e", r);
+	return 0;
+}
+
+//
+// Shared-memory fork: like fork, but the child shares every page with
+// the parent except the user stack, which is copy-on-write as in fork,
+// the exception stack, and the THREAD_LOCAL variables (such as thisenv),
+// which each env gets its own copy of.
+//
+// Only pages mapped at the time of the sfork are shared; pages either
+// env maps later are its own.  malloc_share maps the malloc heap up
+// front for this reason.
+//
+// Returns: child's envid to the parent, 0 to the child, < 0 on error.
+//
+envid_t
 sfork(void)
 {
-	panic("sfork not implemented");
-	return -E_INVAL;
+	extern unsigned char thread_start[], thread_end[];
+	envid_t envid;
+	uintptr_t va;
+	int pn, end_pn, r;
+
+	set_pgfault_handler(pgfault);
+
+	envid = sys_exofork();
+	if (envid < 0)
+		return envid;
+	if (envid == 0) {
+		thisenv = &envs[ENVX(sys_getenvid())];
+		return 0;
+	}
+
+	for (pn = 0; pn < PGNUM(UTOP); ) {
+		if (!(uvpde[pn >> 18] & PTE_P && uvpd[pn >> 9] & PTE_P)) {
+			pn += NPTENTRIES;
+			continue;
+		}
+		for (end_pn = pn + NPTENTRIES; pn < end_pn; pn++) {
+			if ((uvpt[pn] & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+				continue;
+			if (pn == PPN(UXSTACKTOP - 1))
+				continue;
+			va = (uintptr_t) pn << PGSHIFT;
+			if ((va >= USTACKTOP - PTSIZE && va < USTACKTOP)
+			    || (va >= (uintptr_t) thread_start
+				&& va < (uintptr_t) thread_end))
+				duppage(envid, pn);
+			else
+				sharepage(envid, pn);
+		}
+	}
+
+	if ((r = sys_page_alloc(envid, (void*) (UXSTACKTOP - PGSIZE), PTE_P|PTE_U|PTE_W)) < 0)
+		panic("allocating exception stack: %e", r);
+	if ((r = sys_env_set_pgfault_upcall(envid, thisenv->env_pgfault_upcall)) < 0)
+		panic("sys_env_set_pgfault_upcall: %e", r);
+	if ((r = sys_env_set_status(envid, ENV_RUNNABLE)) < 0)
+		panic("sys_env_set_status: %e", r);
+
+	return envid;
 }
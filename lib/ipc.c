@@ -72,6 +72,98 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 #line 80 "../lib/ipc.c"
 }
 
+// Receive a value and up to 'maxpages' page mappings via IPC.
+// Pages sent with ipc_sendv are mapped at consecutive pages starting
+// at 'pg'; a page sent with ipc_send is mapped at 'pg'.
+// If 'npages_store' is nonnull, then store the number of pages
+//	received in *npages_store.
+// Otherwise behaves like ipc_recv.
+int32_t
+ipc_recvv(envid_t *from_env_store, void *pg, size_t maxpages,
+	  size_t *npages_store)
+{
+	int r;
+
+	if (!pg)
+		pg = (void*) UTOP;
+	if ((r = sys_ipc_recvv(pg, maxpages)) < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (npages_store)
+			*npages_store = 0;
+		return r;
+	}
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (npages_store)
+		*npages_store = thisenv->env_ipc_npages;
+	return thisenv->env_ipc_value;
+}
+
+// Send 'val' and the 'npages' page mappings described by 'pages' to
+// 'toenv' in a single IPC.  The receiver must be waiting in ipc_recvv
+// with a window of at least 'npages' pages.
+// Like ipc_send, keeps trying until it succeeds and panics on any
+// error other than -E_IPC_NOT_RECV.
+void
+ipc_sendv(envid_t to_env, uint32_t val, const struct IpcPage *pages,
+	  size_t npages)
+{
+	int r;
+
+	while ((r = sys_ipc_try_sendv(to_env, val, pages, npages)) == -E_IPC_NOT_RECV) {
+		sys_yield();
+	}
+	if (r < 0)
+		panic("error in ipc_sendv: %e", r);
+}
+
+// Wait for either an IPC message, as ipc_recvv would receive it, or a
+// notification bit in 'mask' from sys_notify, whichever comes first.
+// On a notification, take the pending bits in 'mask', store them in
+// *bits_store, store 0 in *from_env_store and *npages_store (if
+// they're nonnull), and return 0.  On an IPC message, store 0 in
+// *bits_store and otherwise behave like ipc_recvv.
+int32_t
+ipc_recv_notify(envid_t *from_env_store, void *pg, size_t maxpages,
+		size_t *npages_store, uint64_t mask, uint64_t *bits_store)
+{
+	int r;
+
+	if (!pg)
+		pg = (void*) UTOP;
+	*bits_store = 0;
+	if ((r = sys_notify_wait(mask, 1, pg, maxpages, 0)) != 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (npages_store)
+			*npages_store = 0;
+		if (r < 0)
+			return r;
+		*bits_store = sys_notify_take(mask);
+		return 0;
+	}
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (npages_store)
+		*npages_store = thisenv->env_ipc_npages;
+	return thisenv->env_ipc_value;
+}
+
+// Wait until a notification bit in 'mask' is pending, then take and
+// return the pending bits in 'mask'.  IPC messages are not received.
+uint64_t
+notify_wait(uint64_t mask)
+{
+	uint64_t bits;
+	int r;
+
+	while (!(bits = sys_notify_take(mask)))
+		if ((r = sys_notify_wait(mask, 0, 0, 0, 0)) < 0)
+			panic("sys_notify_wait: %e", r);
+	return bits;
+}
+
 #line 83 "../lib/ipc.c"
 #ifdef VMM_GUEST
 
@@ -6,7 +6,7 @@
 
 extern void umain(int argc, char **argv);
 
-const volatile struct Env *thisenv;
+const volatile struct Env *thisenv THREAD_LOCAL;
 const char *binaryname = "<unknown>";
 
 void
@@ -16,6 +16,7 @@ libmain(int argc, char **argv)
 #line 17 "../lib/libmain.c"
 	thisenv = &envs[ENVX(sys_getenvid())];
 #line 22 "../lib/libmain.c"
+	string_init();
 
 	// save the name of the program so that panic() can use it
 	if (argc > 0)
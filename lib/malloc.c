@@ -3,139 +3,483 @@
 #include <inc/lib.h>
 
 /*
- * Simple malloc/free.
+ * Size-class malloc/free.
  *
- * Uses the address space to do most of the hard work.
- * The address space from mbegin to mend is scanned
- * in order.  Pages are allocated, used to fill successive
- * malloc requests, and then left alone.  Free decrements
- * a ref count maintained in the page; the page is freed
- * when the ref count hits zero.
+ * Requests of up to SLAB_MAXSIZE bytes are rounded up to one of the
+ * sizes[] classes and carved out of slabs: single pages that start
+ * with a struct Slab and hold objects of one class, with the free ones
+ * chained through their first word.  Each class keeps a list of the
+ * slabs that have free objects, so malloc and free are a few pointer
+ * operations and never scan the address space.
  *
- * If we need to allocate a large amount (more than a page)
- * we can't put a ref count at the end of each page,
- * so we mark the pte entry with the bit PTE_CONTINUED.
+ * Larger requests get a page-aligned run of whole pages.  The length
+ * of each run is kept in runmap, a two-level radix map from heap page
+ * number to run length whose leaves are heap pages themselves.
+ *
+ * Heap pages lie between MBEGIN and MEND.  A bitmap in the first heap
+ * page records which of them are in use, and new address space is
+ * found by searching it onwards from the last allocation.  Pages are
+ * mapped and unmapped several at a time through the syscall ring:
+ * slabs are allocated SLAB_BATCH pages at a time, and empty slabs are
+ * kept around until more than SLAB_KEEP pile up and then handed back
+ * to the kernel in one batch.
+ *
+ * Threads made with sfork share only the pages mapped when they are
+ * created, so before the first one, sthread_create calls malloc_share:
+ * it maps a fixed stretch of the heap once and for all, and from then
+ * on malloc and free only mark pages in the bitmap.  A mutex keeps the
+ * threads out of each other's way; uncontended, it costs one atomic
+ * instruction.
  */
-enum
-{
-	MAXMALLOC = 1024*1024	/* max size of one allocated chunk */
+
+#define MBEGIN		0x08000000
+#define MEND		0x10000000
+#define HEAP_NPAGES	((MEND - MBEGIN) / PGSIZE)
+
+#define SLAB_MAGIC	0x51ab51ab
+#define SLAB_HDRSIZE	ROUNDUP(sizeof(struct Slab), 16)
+#define SLAB_MAXSIZE	2032		// Largest size class (two per slab)
+#define SLAB_BATCH	4		// Slab pages to map at once
+#define SLAB_KEEP	16		// Empty slabs to hold on to
+#define SLAB_NOBJ(c)	((PGSIZE - SLAB_HDRSIZE) / sizes[c])
+
+#define RUNMAP_LEAF	(PGSIZE / sizeof(uint32_t))	// Pages per leaf
+#define RUNMAP_NLEAF	(HEAP_NPAGES / RUNMAP_LEAF)
+
+struct Slab {
+	uint32_t sl_magic;
+	uint16_t sl_class;		// Index into sizes[]
+	uint16_t sl_nfree;		// Number of free objects
+	void *sl_free;			// Free objects, linked through word 0
+	struct Slab *sl_next;		// Next in partial[] or empty list
+	struct Slab **sl_pprev;		// Pointer to the link pointing here
 };
 
-#define PTE_CONTINUED 0x400
+// Object sizes, all multiples of 16 so that every object is aligned.
+static const uint16_t sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1008, SLAB_MAXSIZE
+};
+#define NCLASS		(sizeof(sizes) / sizeof(sizes[0]))
+
+static struct Slab *partial[NCLASS];	// Slabs with free objects
+static struct Slab *empty;		// Slabs with no objects in use
+static uint32_t *runmap[RUNMAP_NLEAF];
+static uint64_t *used;			// Bitmap of allocated heap pages
+static size_t rover;			// Where to look for free pages next
+static size_t heap_npages = HEAP_NPAGES;	// Heap pages in use or usable
+static bool heap_shared;		// Heap pages stay mapped (malloc_share)
+static struct Mutex lock;
+static struct MallocStats stats;
+
+static void
+slab_link(struct Slab **head, struct Slab *s)
+{
+	if ((s->sl_next = *head) != 0)
+		s->sl_next->sl_pprev = &s->sl_next;
+	s->sl_pprev = head;
+	*head = s;
+}
+
+static void
+slab_unlink(struct Slab *s)
+{
+	if (s->sl_next)
+		s->sl_next->sl_pprev = s->sl_pprev;
+	*s->sl_pprev = s->sl_next;
+}
+
+// Find npages consecutive unused pages among heap pages [from, to).
+// Returns the first one's number, or 0 if there are none.
+static size_t
+va_find(size_t from, size_t to, size_t npages)
+{
+	size_t pn, n = 0;
+
+	for (pn = from; pn < to; pn++) {
+		if (pn % 64 == 0 && used[pn / 64] == ~0ULL) {
+			n = 0;
+			pn += 63;
+		} else if (used[pn / 64] & (1ULL << (pn % 64)))
+			n = 0;
+		else if (++n == npages)
+			return pn + 1 - npages;
+	}
+	return 0;
+}
 
-static uint8_t *mbegin = (uint8_t*) 0x08000000;
-static uint8_t *mend   = (uint8_t*) 0x10000000;
-static uint8_t *mptr;
+static void
+va_mark(size_t pn, size_t npages, bool set)
+{
+	for (; npages > 0; pn++, npages--)
+		if (set)
+			used[pn / 64] |= 1ULL << (pn % 64);
+		else
+			used[pn / 64] &= ~(1ULL << (pn % 64));
+}
 
+// Map the bitmap page, if that hasn't been done yet.
 static int
-isfree(void *v, size_t n)
+va_init(void)
 {
-	uintptr_t va, end_va = (uintptr_t) v + n;
+	int r;
 
-	for (va = (uintptr_t) v; va < end_va; va += PGSIZE)
-		if (va >= (uintptr_t) mend
-		    || ((uvpd[VPD(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P)))
-			return 0;
-	return 1;
+	static_assert(HEAP_NPAGES / 8 <= PGSIZE);
+	if (used)
+		return 0;
+	if ((r = sys_page_alloc(0, (void *) MBEGIN, PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	used = (uint64_t *) MBEGIN;
+	va_mark(0, 1, 1);
+	rover = 1;
+	return 0;
 }
 
-void*
-malloc(size_t n)
+// Find address space for npages pages, searching onwards from where
+// the last search left off.  Returns 0 if there is none.
+static uintptr_t
+va_take(size_t npages)
 {
-	int i, cont;
-	int nwrap;
-	uint32_t *ref;
-	void *v;
+	size_t pn;
 
-	if (mptr == 0)
-		mptr = mbegin;
+	if (va_init() < 0)
+		return 0;
+	if (!(pn = va_find(rover, heap_npages, npages))
+	    && !(pn = va_find(1, MIN(rover + npages, heap_npages), npages)))
+		return 0;
+	va_mark(pn, npages, 1);
+	rover = pn + npages;
+	return MBEGIN + pn * PGSIZE;
+}
 
-	n = ROUNDUP(n, 4);
+// Map npages fresh zeroed pages in one ring submission.
+// Returns their address, or 0 if out of address space or memory.
+static void *
+pages_alloc(size_t npages)
+{
+	uintptr_t va;
+	size_t i;
 
-	if (n >= MAXMALLOC)
+	if ((va = va_take(npages)) == 0)
 		return 0;
+	if (heap_shared) {
+		memset((void *) va, 0, npages * PGSIZE);
+		return (void *) va;
+	}
+	for (i = 0; i < npages; i++)
+		sysring_push(SYS_page_alloc, SYSRING_LINK, 0, va + i * PGSIZE,
+			     PTE_P|PTE_U|PTE_W, 0, 0);
+	stats.ms_mapcalls++;
+	if (sysring_submit() < 0) {
+		for (i = 0; i < npages; i++)
+			sysring_push(SYS_page_unmap, 0, 0, va + i * PGSIZE,
+				     0, 0, 0);
+		sysring_submit();
+		va_mark((va - MBEGIN) / PGSIZE, npages, 0);
+		return 0;
+	}
+	return (void *) va;
+}
 
-	if ((uintptr_t) mptr % PGSIZE){
-		/*
-		 * we're in the middle of a partially
-		 * allocated page - can we add this chunk?
-		 * the +4 below is for the ref count.
-		 */
-		ref = (uint32_t*) (ROUNDUP(mptr, PGSIZE) - 4);
-		if ((uintptr_t) mptr / PGSIZE == (uintptr_t) (mptr + n - 1 + 4) / PGSIZE) {
-			(*ref)++;
-			v = mptr;
-			mptr += n;
-			return v;
-		}
-		/*
-		 * stop working on this page and move on.
-		 */
-		free(mptr);	/* drop reference to this page */
-		mptr = ROUNDDOWN(mptr + PGSIZE, PGSIZE);
+// Queue the unmapping of npages pages at va and give back their
+// address space.  The caller submits the ring.  A shared heap keeps
+// the pages mapped.
+static void
+pages_free(uintptr_t va, size_t npages)
+{
+	size_t i;
+
+	for (i = 0; i < npages && !heap_shared; i++)
+		sysring_push(SYS_page_unmap, 0, 0, va + i * PGSIZE, 0, 0, 0);
+	va_mark((va - MBEGIN) / PGSIZE, npages, 0);
+}
+
+// Return the runmap entry for the page at va, allocating its leaf
+// if 'create' is set.  Returns 0 if there is no such entry.
+static uint32_t *
+runmap_entry(uintptr_t va, bool create)
+{
+	size_t pn = (va - MBEGIN) / PGSIZE;
+	uint32_t **leaf = &runmap[pn / RUNMAP_LEAF];
+
+	if (!*leaf && (!create || !(*leaf = pages_alloc(1))))
+		return 0;
+	return &(*leaf)[pn % RUNMAP_LEAF];
+}
+
+static int
+size_class(size_t n)
+{
+	int c;
+
+	for (c = 0; sizes[c] < n; c++)
+		;
+	return c;
+}
+
+// Set up the page at s as an empty slab for class c.
+static void
+slab_init(struct Slab *s, int c)
+{
+	uint8_t *obj = (uint8_t *) s + SLAB_HDRSIZE;
+	void **link = &s->sl_free;
+	int i;
+
+	s->sl_magic = SLAB_MAGIC;
+	s->sl_class = c;
+	s->sl_nfree = SLAB_NOBJ(c);
+	for (i = 0; i < s->sl_nfree; i++, obj += sizes[c]) {
+		*link = obj;
+		link = (void **) obj;
 	}
+	*link = 0;
+}
 
-	/*
-	 * now we need to find some address space for this chunk.
-	 * if it's less than a page we leave it open for allocation.
-	 * runs of more than a page can't have ref counts so we
-	 * flag the PTE entries instead.
-	 */
-	nwrap = 0;
-	while (1) {
-		if (isfree(mptr, n + 4))
-			break;
-		mptr += PGSIZE;
-		if (mptr == mend) {
-			mptr = mbegin;
-			if (++nwrap == 2)
-				return 0;	/* out of address space */
+// Get a slab with free objects for class c.
+static struct Slab *
+slab_get(int c)
+{
+	struct Slab *s;
+	int i;
+
+	if (!empty) {
+		if (!(s = pages_alloc(SLAB_BATCH)))
+			return 0;
+		for (i = 0; i < SLAB_BATCH; i++) {
+			slab_link(&empty, (struct Slab *) ((uint8_t *) s + i * PGSIZE));
+			stats.ms_emptyslabs++;
 		}
+		stats.ms_slabpages += SLAB_BATCH;
 	}
+	s = empty;
+	slab_unlink(s);
+	stats.ms_emptyslabs--;
+	slab_init(s, c);
+	slab_link(&partial[c], s);
+	return s;
+}
 
-	/*
-	 * allocate at mptr - the +4 makes sure we allocate a ref count.
-	 */
-	for (i = 0; i < n + 4; i += PGSIZE){
-		cont = (i + PGSIZE < n + 4) ? PTE_CONTINUED : 0;
-		if (sys_page_alloc(0, mptr + i, PTE_P|PTE_U|PTE_W|cont) < 0){
-			for (; i >= 0; i -= PGSIZE)
-				sys_page_unmap(0, mptr + i);
-			return 0;	/* out of physical memory */
+// Hand empty slabs back to the kernel once too many have piled up,
+// leaving SLAB_KEEP / 2 for the next burst of allocations.
+static void
+slab_trim(void)
+{
+	struct Slab *s;
+
+	if (stats.ms_emptyslabs <= SLAB_KEEP)
+		return;
+	while (stats.ms_emptyslabs > SLAB_KEEP / 2) {
+		s = empty;
+		slab_unlink(s);
+		pages_free((uintptr_t) s, 1);
+		stats.ms_emptyslabs--;
+		stats.ms_slabpages--;
+	}
+	if (!heap_shared) {
+		stats.ms_mapcalls++;
+		sysring_submit();
+	}
+}
+
+static void *
+run_alloc(size_t n)
+{
+	size_t npages = ROUNDUP(n, PGSIZE) / PGSIZE;
+	uint32_t *ent;
+	void *v;
+
+	if (n > MEND - MBEGIN || !(v = pages_alloc(npages)))
+		return 0;
+	if (!(ent = runmap_entry((uintptr_t) v, 1))) {
+		pages_free((uintptr_t) v, npages);
+		sysring_submit();
+		return 0;
+	}
+	*ent = npages;
+	stats.ms_runpages += npages;
+	stats.ms_inuse += npages * PGSIZE;
+	return v;
+}
+
+// Return the usable size of the block at v, which must be allocated.
+static size_t
+block_size(void *v)
+{
+	struct Slab *s;
+	uint32_t *ent;
+
+	assert(MBEGIN <= (uintptr_t) v && (uintptr_t) v < MEND);
+	if ((uintptr_t) v % PGSIZE == 0) {
+		ent = runmap_entry((uintptr_t) v, 0);
+		assert(ent && *ent);
+		return *ent * PGSIZE;
+	}
+	s = ROUNDDOWN(v, PGSIZE);
+	assert(s->sl_magic == SLAB_MAGIC);
+	return sizes[s->sl_class];
+}
+
+static void *
+malloc_locked(size_t n)
+{
+	struct Slab *s;
+	void *v;
+	int c;
+
+	if (n > SLAB_MAXSIZE) {
+		if (!(v = run_alloc(n)))
+			return 0;
+		stats.ms_nmalloc++;
+		return v;
+	}
+
+	c = size_class(n);
+	if (!(s = partial[c]) && !(s = slab_get(c)))
+		return 0;
+	v = s->sl_free;
+	s->sl_free = *(void **) v;
+	if (--s->sl_nfree == 0)
+		slab_unlink(s);
+	stats.ms_nmalloc++;
+	stats.ms_inuse += sizes[c];
+	return v;
+}
+
+static void
+free_locked(void *v)
+{
+	struct Slab *s;
+	uint32_t *ent;
+
+	assert(MBEGIN <= (uintptr_t) v && (uintptr_t) v < MEND);
+	stats.ms_nfree++;
+
+	if ((uintptr_t) v % PGSIZE == 0) {
+		ent = runmap_entry((uintptr_t) v, 0);
+		assert(ent && *ent);
+		pages_free((uintptr_t) v, *ent);
+		if (!heap_shared) {
+			stats.ms_mapcalls++;
+			sysring_submit();
 		}
+		stats.ms_runpages -= *ent;
+		stats.ms_inuse -= *ent * PGSIZE;
+		*ent = 0;
+		return;
+	}
+
+	s = ROUNDDOWN(v, PGSIZE);
+	assert(s->sl_magic == SLAB_MAGIC);
+	stats.ms_inuse -= sizes[s->sl_class];
+	*(void **) v = s->sl_free;
+	s->sl_free = v;
+	if (s->sl_nfree++ == 0)
+		slab_link(&partial[s->sl_class], s);
+	if (s->sl_nfree == SLAB_NOBJ(s->sl_class)) {
+		slab_unlink(s);
+		s->sl_magic = 0;
+		slab_link(&empty, s);
+		stats.ms_emptyslabs++;
+		slab_trim();
 	}
+}
 
-	ref = (uint32_t*) (mptr + i - 4);
-	*ref = 2;	/* reference for mptr, reference for returned block */
-	v = mptr;
-	mptr += n;
+void *
+malloc(size_t n)
+{
+	void *v;
+
+	mutex_lock(&lock);
+	v = malloc_locked(n);
+	mutex_unlock(&lock);
 	return v;
 }
 
 void
 free(void *v)
 {
-	uint8_t *c;
-	uint32_t *ref;
-
 	if (v == 0)
 		return;
-	assert(mbegin <= (uint8_t*) v && (uint8_t*) v < mend);
+	mutex_lock(&lock);
+	free_locked(v);
+	mutex_unlock(&lock);
+}
 
-	c = ROUNDDOWN(v, PGSIZE);
+void *
+calloc(size_t nmemb, size_t size)
+{
+	void *v;
 
-	while (uvpt[PGNUM(c)] & PTE_CONTINUED) {
-		sys_page_unmap(0, c);
-		c += PGSIZE;
-		assert(mbegin <= c && c < mend);
+	if (size && nmemb > (size_t) -1 / size)
+		return 0;
+	if ((v = malloc(nmemb * size)) != 0)
+		memset(v, 0, nmemb * size);
+	return v;
+}
+
+// Resize the block at v to n bytes, moving it if it doesn't fit.
+// Behaves like malloc if v is null and like free if n is 0.
+void *
+realloc(void *v, size_t n)
+{
+	size_t old;
+	void *nv;
+
+	if (v == 0)
+		return malloc(n);
+	if (n == 0) {
+		free(v);
+		return 0;
 	}
+	mutex_lock(&lock);
+	old = block_size(v);
+	mutex_unlock(&lock);
+	// Keep the block unless it is a run that could shrink to a slab
+	// or by at least a page.
+	if (n <= old && (old <= SLAB_MAXSIZE
+			 || (n > SLAB_MAXSIZE && ROUNDUP(n, PGSIZE) == old)))
+		return v;
+	if ((nv = malloc(n)) == 0)
+		return 0;
+	memmove(nv, v, MIN(n, old));
+	free(v);
+	return nv;
+}
 
-	/*
-	 * c is just a piece of this page, so dec the ref count
-	 * and maybe free the page.
-	 */
-	ref = (uint32_t*) (c + PGSIZE - 4);
-	if (--(*ref) == 0)
-		sys_page_unmap(0, c);
+// Copy the allocator's counters into *ms.
+void
+malloc_stats(struct MallocStats *ms)
+{
+	mutex_lock(&lock);
+	*ms = stats;
+	mutex_unlock(&lock);
 }
 
+// Map the first 'npages' pages of the heap, or as many of them as are
+// not in use yet, and keep every heap page mapped from now on, so that
+// threads created by sfork afterwards all see the whole heap.  Blocks
+// allocated before stay where they are; new ones come from the first
+// 'npages' pages.  Does nothing if the heap is already shared.
+// Returns 0 on success, < 0 on failure.
+int
+malloc_share(size_t npages)
+{
+	size_t pn;
+	int r = 0;
+
+	mutex_lock(&lock);
+	if (heap_shared || (r = va_init()) < 0)
+		goto out;
+	npages = MIN(npages, HEAP_NPAGES);
+	for (pn = 1; pn < npages; pn++)
+		if (!(used[pn / 64] & (1ULL << (pn % 64))))
+			sysring_push(SYS_page_alloc, 0, 0, MBEGIN + pn * PGSIZE,
+				     PTE_P|PTE_U|PTE_W, 0, 0);
+	stats.ms_mapcalls++;
+	if ((r = sysring_submit()) < 0)
+		goto out;
+	heap_npages = npages;
+	heap_shared = 1;
+out:
+	mutex_unlock(&lock);
+	return heap_shared ? 0 : r;
+}
@@ -7,7 +7,7 @@
 
 // Virtual address at which to receive page mappings containing client requests.
 #define REQVA		0x0ffff000
-union Nsipc nsipcbuf __attribute__((aligned(PGSIZE)));
+union Nsipc nsipcbuf THREAD_LOCAL __attribute__((aligned(PGSIZE)));
 
 // Send an IP request to the network server, and wait for a reply.
 // The request body should be in nsipcbuf, and parts of the response
@@ -26,10 +26,45 @@ nsipc(unsigned type)
 	if (debug)
 		cprintf("[%08x] nsipc %d\n", thisenv->env_id, type);
 
+	// Green threads keep running while this one waits for the reply.
+	if (thread_active())
+		return thread_ipc_call(nsenv, type, &nsipcbuf, NULL);
+
 	ipc_send(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
 	return ipc_recv(NULL, NULL, NULL);
 }
 
+// Window at which bulk data pages are staged for NSREQ_SEND_BULK
+// and received from NSREQ_RECV_BULK.
+#define NSBULKVA	0xE1000000
+
+// Like nsipc, but sends the 'ndata' pages at 'va' after the request
+// page and receives up to NSBULK_MAXPAGES reply pages at 'va', storing
+// the number received in *npages_store.  The pages sent are lent to
+// the server rather than copied.
+static int
+nsipcv(unsigned type, void *va, size_t ndata, size_t *npages_store)
+{
+	static envid_t nsenv;
+	struct IpcPage pages[1 + NSBULK_MAXPAGES];
+	size_t i;
+
+	if (nsenv == 0)
+		nsenv = ipc_find_env(ENV_TYPE_NS);
+
+	if (debug)
+		cprintf("[%08x] nsipcv %d +%d\n", thisenv->env_id, type, (int) ndata);
+
+	pages[0].ip_va = &nsipcbuf;
+	pages[0].ip_perm = PTE_P|PTE_W|PTE_U;
+	for (i = 0; i < ndata; i++) {
+		pages[1 + i].ip_va = (char *) va + i * PGSIZE;
+		pages[1 + i].ip_perm = PTE_P|PTE_U;
+	}
+	ipc_sendv(nsenv, type, pages, 1 + ndata);
+	return ipc_recvv(NULL, va, NSBULK_MAXPAGES, npages_store);
+}
+
 int
 nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 {
@@ -88,15 +123,40 @@ nsipc_listen(int s, int backlog)
 int
 nsipc_recv(int s, void *mem, int len, unsigned int flags)
 {
-	int r;
+	struct iovec iov = { mem, len };
+
+	return nsipc_recvv(s, &iov, 1, flags);
+}
 
+// Receive into the buffers described by 'iov' with a single request.
+int
+nsipc_recvv(int s, const struct iovec *iov, int iovcnt, unsigned int flags)
+{
+	int r, len;
+	size_t npages, i;
+
+	len = MIN(iov_total(iov, iovcnt), NSBULK_MAXPAGES * PGSIZE);
 	nsipcbuf.recv.req_s = s;
 	nsipcbuf.recv.req_len = len;
 	nsipcbuf.recv.req_flags = flags;
 
+	// Large receives get their data back as whole pages, except in
+	// green threads, which share the bulk window.
+	if (len > PGSIZE && !thread_active()) {
+		r = nsipcv(NSREQ_RECV_BULK, (void *) NSBULKVA, 0, &npages);
+		if (r > 0) {
+			assert(r <= len);
+			iov_scatter(iov, iovcnt, (void *) NSBULKVA, r);
+		}
+		for (i = 0; i < npages; i++)
+			sys_page_unmap(0, (void *) (NSBULKVA + i * PGSIZE));
+		return r;
+	}
+
+	nsipcbuf.recv.req_len = MIN(len, PGSIZE);
 	if ((r = nsipc(NSREQ_RECV)) >= 0) {
 		assert(r < 1600 && r <= len);
-		memmove(mem, nsipcbuf.recvRet.ret_buf, r);
+		iov_scatter(iov, iovcnt, nsipcbuf.recvRet.ret_buf, r);
 	}
 
 	return r;
@@ -105,14 +165,73 @@ nsipc_recv(int s, void *mem, int len, unsigned int flags)
 int
 nsipc_send(int s, const void *buf, int size, unsigned int flags)
 {
+	struct iovec iov = { (void *) buf, size };
+
+	return nsipc_sendv(s, &iov, 1, flags);
+}
+
+// Send the buffers described by 'iov', gathered into one request.
+int
+nsipc_sendv(int s, const struct iovec *iov, int iovcnt, unsigned int flags)
+{
+	size_t npages, i;
+	int r, size;
+
+	size = MIN(iov_total(iov, iovcnt), NSBULK_MAXPAGES * PGSIZE);
 	nsipcbuf.send.req_s = s;
-	assert(size < 1600);
-	memmove(&nsipcbuf.send.req_buf, buf, size);
+
+	// Sends that don't fit in one lwIP buffer go as a bulk IPC,
+	// except in green threads, which share the bulk window.
+	if (size >= 1600 && !thread_active()) {
+		size = MIN(size, NSBULK_MAXPAGES * PGSIZE);
+		npages = ROUNDUP(size, PGSIZE) / PGSIZE;
+		for (i = 0; i < npages; i++)
+			if ((r = sys_page_alloc(0, (void *) (NSBULKVA + i * PGSIZE),
+						PTE_P|PTE_U|PTE_W)) < 0) {
+				while (i-- > 0)
+					sys_page_unmap(0, (void *) (NSBULKVA + i * PGSIZE));
+				return r;
+			}
+		iov_gather((void *) NSBULKVA, iov, iovcnt, size);
+		nsipcbuf.send.req_size = size;
+		nsipcbuf.send.req_flags = flags;
+		r = nsipcv(NSREQ_SEND_BULK, (void *) NSBULKVA, npages, NULL);
+		for (i = 0; i < npages; i++)
+			sys_page_unmap(0, (void *) (NSBULKVA + i * PGSIZE));
+		return r;
+	}
+
+	size = MIN(size, PGSIZE - (int) sizeof(nsipcbuf.send));
+	iov_gather(&nsipcbuf.send.req_buf, iov, iovcnt, size);
 	nsipcbuf.send.req_size = size;
 	nsipcbuf.send.req_flags = flags;
 	return nsipc(NSREQ_SEND);
 }
 
+// Receive at most 'len' bytes from socket 's' as whole pages mapped
+// at 'va'.  Returns the number of bytes received, or < 0 on error.
+int
+nsipc_recvpages(int s, void *va, int len)
+{
+	nsipcbuf.recv.req_s = s;
+	nsipcbuf.recv.req_len = MIN(len, NSBULK_MAXPAGES * PGSIZE);
+	nsipcbuf.recv.req_flags = 0;
+	return nsipcv(NSREQ_RECV_BULK, va, 0, NULL);
+}
+
+// Send at most 'size' bytes from the pages at 'va' on socket 's',
+// lending the pages to the network server instead of copying them.
+// Returns the number of bytes sent, or < 0 on error.
+int
+nsipc_sendpages(int s, void *va, int size)
+{
+	size = MIN(size, NSBULK_MAXPAGES * PGSIZE);
+	nsipcbuf.send.req_s = s;
+	nsipcbuf.send.req_size = size;
+	nsipcbuf.send.req_flags = 0;
+	return nsipcv(NSREQ_SEND_BULK, va, ROUNDUP(size, PGSIZE) / PGSIZE, NULL);
+}
+
 int
 nsipc_socket(int domain, int type, int protocol)
 {
@@ -9,6 +9,8 @@
 
 static ssize_t devpipe_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devpipe_write(struct Fd *fd, const void *buf, size_t n);
+static ssize_t devpipe_readv(struct Fd *fd, const struct iovec *iov, int iovcnt);
+static ssize_t devpipe_writev(struct Fd *fd, const struct iovec *iov, int iovcnt);
 static int devpipe_stat(struct Fd *fd, struct Stat *stat);
 static int devpipe_close(struct Fd *fd);
 
@@ -20,23 +22,71 @@ struct Dev devpipe =
 	.dev_write =	devpipe_write,
 	.dev_close =	devpipe_close,
 	.dev_stat =	devpipe_stat,
+	.dev_readv =	devpipe_readv,
+	.dev_writev =	devpipe_writev,
 };
 
-#define PIPEBUFSIZ 32		// small to provoke races
+// The pipe header sits in the first data page of both fds, and the
+// ring buffer in the p_size / PGSIZE data pages that follow it.  p_size
+// is a power of two so that the free-running positions can wrap.
+#define PIPEBUFSIZ	(4*PGSIZE)			// default ring size
+#define PIPEMAXBUF	((FDDATAPAGES / 2) * PGSIZE)	// largest ring size
 
 struct Pipe {
-	off_t p_rpos;		// read position
-	off_t p_wpos;		// write position
-	uint8_t p_buf[PIPEBUFSIZ];	// data buffer
+	uint32_t p_rpos;	// read position
+	uint32_t p_wpos;	// write position
+	uint32_t p_seq;		// futex word, bumped when rpos or wpos moves
+	uint32_t p_nwait;	// number of envs sleeping on p_seq
+	uint32_t p_size;	// ring size in bytes
 };
 
+#define pipebuf(p)	((uint8_t*) (p) + PGSIZE)
+
+// Sleep until the pipe changes state, given the value of p_seq read
+// before the caller last checked the pipe.  A closing end bumps p_seq too,
+// and the kernel wakes us when a mapping of the pipe page goes away, so
+// _pipeisclosed gets rechecked whenever the other end might be gone.
+static void
+pipe_wait(struct Pipe *p, uint32_t seq)
+{
+	__sync_fetch_and_add(&p->p_nwait, 1);
+	sys_futex_wait(&p->p_seq, seq, 0);
+	__sync_fetch_and_sub(&p->p_nwait, 1);
+}
+
+// Note that the pipe changed state, waking anyone in pipe_wait.
+static void
+pipe_notify(struct Pipe *p)
+{
+	// The locked add orders the rpos/wpos update and the p_seq bump
+	// before our read of p_nwait.
+	__sync_fetch_and_add(&p->p_seq, 1);
+	if (p->p_nwait)
+		sys_futex_wake(&p->p_seq, NENV);
+}
+
 int
 pipe(int pfd[2])
+{
+	return pipesize(pfd, PIPEBUFSIZ);
+}
+
+// Like pipe, but with a ring buffer of at least 'size' bytes,
+// rounded up to a power-of-two number of pages up to PIPEMAXBUF.
+int
+pipesize(int pfd[2], size_t size)
 {
 	int r;
+	size_t npages, i;
 	struct Fd *fd0, *fd1;
+	struct Pipe *p;
 	void *va;
 
+	if (size > PIPEMAXBUF)
+		return -E_INVAL;
+	for (npages = 1; npages * PGSIZE < size; npages *= 2)
+		;
+
 	// allocate the file descriptor table entries
 	if ((r = fd_alloc(&fd0)) < 0
             || (r = sys_page_alloc(0, fd0, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
@@ -46,12 +96,22 @@ pipe(int pfd[2])
             || (r = sys_page_alloc(0, fd1, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
 		goto err1;
 
-	// allocate the pipe structure as first data page in both
+	// allocate the pipe structure and the ring after it as data pages
+	// in both
 	va = fd2data(fd0);
-	if ((r = sys_page_alloc(0, va, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
-		goto err2;
-	if ((r = sys_page_map(0, va, 0, fd2data(fd1), PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
+	for (i = 0; i <= npages; i++) {
+		sysring_push(SYS_page_alloc, SYSRING_LINK, 0,
+			     (uint64_t) va + i * PGSIZE,
+			     PTE_P|PTE_W|PTE_U|PTE_SHARE, 0, 0);
+		sysring_push(SYS_page_map, SYSRING_LINK, 0,
+			     (uint64_t) va + i * PGSIZE, 0,
+			     (uint64_t) fd2data(fd1) + i * PGSIZE,
+			     PTE_P|PTE_W|PTE_U|PTE_SHARE);
+	}
+	if ((r = sysring_submit()) < 0)
 		goto err3;
+	p = (struct Pipe*) va;
+	p->p_size = npages * PGSIZE;
 
 	// set up fd structures
 	fd0->fd_dev_id = devpipe.dev_id;
@@ -68,8 +128,13 @@ pipe(int pfd[2])
 	return 0;
 
 err3:
-	sys_page_unmap(0, va);
-err2:
+	for (i = 0; i <= npages; i++) {
+		sysring_push(SYS_page_unmap, 0, 0, (uint64_t) va + i * PGSIZE,
+			     0, 0, 0);
+		sysring_push(SYS_page_unmap, 0, 0,
+			     (uint64_t) fd2data(fd1) + i * PGSIZE, 0, 0, 0);
+	}
+	sysring_submit();
 	sys_page_unmap(0, fd1);
 err1:
 	sys_page_unmap(0, fd0);
@@ -112,74 +177,132 @@ static ssize_t
 devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 {
 #line 134 "../lib/pipe.c"
-	uint8_t *buf;
-	size_t i;
+	struct iovec iov = { vbuf, n };
+
+	return devpipe_readv(fd, &iov, 1);
+#line 178 "../lib/pipe.c"
+}
+
+static ssize_t
+devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
+{
+#line 184 "../lib/pipe.c"
+	struct iovec iov = { (void*) vbuf, n };
+
+	return devpipe_writev(fd, &iov, 1);
+#line 226 "../lib/pipe.c"
+}
+
+// Copy n bytes out of the ring starting at position pos,
+// in two pieces if they wrap around.
+static void
+pipe_copyout(struct Pipe *p, uint32_t pos, void *dst, size_t n)
+{
+	size_t off = pos % p->p_size, c = MIN(n, p->p_size - off);
+
+	memcpy(dst, pipebuf(p) + off, c);
+	memcpy((uint8_t*) dst + c, pipebuf(p), n - c);
+}
+
+static void
+pipe_copyin(struct Pipe *p, uint32_t pos, const void *src, size_t n)
+{
+	size_t off = pos % p->p_size, c = MIN(n, p->p_size - off);
+
+	memcpy(pipebuf(p) + off, src, c);
+	memcpy(pipebuf(p), (const uint8_t*) src + c, n - c);
+}
+
+static ssize_t
+devpipe_readv(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
+	size_t n, done, c;
+	uint32_t seq;
 	struct Pipe *p;
+	int i;
 
 	p = (struct Pipe*)fd2data(fd);
+	n = iov_total(iov, iovcnt);
 	if (debug)
-		cprintf("[%08x] devpipe_read %08x %d rpos %d wpos %d\n",
+		cprintf("[%08x] devpipe_readv %08x %d rpos %d wpos %d\n",
 			thisenv->env_id, uvpt[PGNUM(p)], n, p->p_rpos, p->p_wpos);
 
-	buf = vbuf;
-	for (i = 0; i < n; i++) {
-		while (p->p_rpos == p->p_wpos) {
-			// pipe is empty
-			// if we got any data, return it
-			if (i > 0)
-				return i;
-			// if all the writers are gone, note eof
-			if (_pipeisclosed(fd, p))
-				return 0;
-			// yield and see what happens
-			if (debug)
-				cprintf("devpipe_read yield\n");
-			sys_yield();
-		}
-		// there's a byte.  take it.
-		// wait to increment rpos until the byte is taken!
-		buf[i] = p->p_buf[p->p_rpos % PIPEBUFSIZ];
-		p->p_rpos++;
+	if (n == 0)
+		return 0;
+	while (seq = p->p_seq, p->p_rpos == p->p_wpos) {
+		// pipe is empty
+		// if all the writers are gone, note eof
+		if (_pipeisclosed(fd, p))
+			return 0;
+		// sleep until a writer does something
+		if (debug)
+			cprintf("devpipe_readv wait\n");
+		pipe_wait(p, seq);
 	}
-	return i;
-#line 178 "../lib/pipe.c"
+
+	// take as much as is there, filling the buffers in order.
+	// wait to advance rpos until the bytes are taken!
+	n = MIN(n, p->p_wpos - p->p_rpos);
+	for (i = 0, done = 0; done < n; i++, done += c) {
+		c = MIN(iov[i].iov_len, n - done);
+		pipe_copyout(p, p->p_rpos + done, iov[i].iov_base, c);
+	}
+	__sync_synchronize();
+	p->p_rpos += n;
+	pipe_notify(p);
+	return n;
 }
 
 static ssize_t
-devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
+devpipe_writev(struct Fd *fd, const struct iovec *iov, int iovcnt)
 {
-#line 184 "../lib/pipe.c"
 	const uint8_t *buf;
-	size_t i;
+	size_t i, c, tot = 0, told = 0;
+	uint32_t seq;
 	struct Pipe *p;
+	int j;
 
 	p = (struct Pipe*) fd2data(fd);
 	if (debug)
-		cprintf("[%08x] devpipe_write %08x %d rpos %d wpos %d\n",
-			thisenv->env_id, uvpt[PGNUM(p)], n, p->p_rpos, p->p_wpos);
+		cprintf("[%08x] devpipe_writev %08x %d rpos %d wpos %d\n",
+			thisenv->env_id, uvpt[PGNUM(p)], iov_total(iov, iovcnt),
+			p->p_rpos, p->p_wpos);
 
-	buf = vbuf;
-	for (i = 0; i < n; i++) {
-		while (p->p_wpos >= p->p_rpos + sizeof(p->p_buf)) {
-			// pipe is full
-			// if all the readers are gone
-			// (it's only writers like us now),
-			// note eof
-			if (_pipeisclosed(fd, p))
-				return 0;
-			// yield and see what happens
-			if (debug)
-				cprintf("devpipe_write yield\n");
-			sys_yield();
+	for (j = 0; j < iovcnt; j++) {
+		buf = iov[j].iov_base;
+		for (i = 0; i < iov[j].iov_len; i += c) {
+			while (p->p_wpos - p->p_rpos == p->p_size) {
+				// pipe is full
+				// let the readers at what we've written so far
+				if (tot > told) {
+					pipe_notify(p);
+					told = tot;
+				}
+				seq = p->p_seq;
+				if (p->p_wpos - p->p_rpos < p->p_size)
+					break;
+				// if all the readers are gone
+				// (it's only writers like us now),
+				// note eof
+				if (_pipeisclosed(fd, p))
+					return 0;
+				// sleep until a reader does something
+				if (debug)
+					cprintf("devpipe_writev wait\n");
+				pipe_wait(p, seq);
+			}
+			// store as much as fits.
+			// wait to advance wpos until the bytes are stored!
+			c = MIN(iov[j].iov_len - i, p->p_size - (p->p_wpos - p->p_rpos));
+			pipe_copyin(p, p->p_wpos, buf + i, c);
+			__sync_synchronize();
+			p->p_wpos += c;
+			tot += c;
 		}
-		// there's room for a byte.  store it.
-		// wait to increment wpos until the byte is stored!
-		p->p_buf[p->p_wpos % PIPEBUFSIZ] = buf[i];
-		p->p_wpos++;
 	}
 
-	return i;
-#line 226 "../lib/pipe.c"
+	pipe_notify(p);
+	return tot;
 }
 
 static int
@@ -196,9 +319,19 @@ devpipe_stat(struct Fd *fd, struct Stat *stat)
 static int
 devpipe_close(struct Fd *fd)
 {
+	struct Pipe *p = (struct Pipe*) fd2data(fd);
+	size_t i;
+
 #line 243 "../lib/pipe.c"
 	(void) sys_page_unmap(0, fd);
 #line 245 "../lib/pipe.c"
-	return sys_page_unmap(0, fd2data(fd));
+	// Wake the other end so it rechecks _pipeisclosed; unmapping the
+	// pipe page last wakes anyone who goes to sleep in between.
+	pipe_notify(p);
+	for (i = 0; i < p->p_size; i += PGSIZE)
+		sysring_push(SYS_page_unmap, 0, 0, (uint64_t) pipebuf(p) + i,
+			     0, 0, 0);
+	sysring_submit();
+	return sys_page_unmap(0, p);
 }
 
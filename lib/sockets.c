@@ -6,6 +6,10 @@ static ssize_t devsock_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devsock_write(struct Fd *fd, const void *buf, size_t n);
 static int devsock_close(struct Fd *fd);
 static int devsock_stat(struct Fd *fd, struct Stat *stat);
+static ssize_t devsock_readv(struct Fd *fd, const struct iovec *iov, int iovcnt);
+static ssize_t devsock_writev(struct Fd *fd, const struct iovec *iov, int iovcnt);
+static ssize_t devsock_readpages(struct Fd *fd, void *va, size_t n);
+static ssize_t devsock_writepages(struct Fd *fd, void *va, size_t n);
 
 struct Dev devsock =
 {
@@ -15,6 +19,10 @@ struct Dev devsock =
 	.dev_write =	devsock_write,
 	.dev_close =	devsock_close,
 	.dev_stat =	devsock_stat,
+	.dev_readv =	devsock_readv,
+	.dev_writev =	devsock_writev,
+	.dev_readpages = devsock_readpages,
+	.dev_writepages = devsock_writepages,
 };
 
 static int
@@ -116,6 +124,30 @@ devsock_write(struct Fd *fd, const void *buf, size_t n)
 	return nsipc_send(fd->fd_sock.sockid, buf, n, 0);
 }
 
+static ssize_t
+devsock_readv(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
+	return nsipc_recvv(fd->fd_sock.sockid, iov, iovcnt, 0);
+}
+
+static ssize_t
+devsock_writev(struct Fd *fd, const struct iovec *iov, int iovcnt)
+{
+	return nsipc_sendv(fd->fd_sock.sockid, iov, iovcnt, 0);
+}
+
+static ssize_t
+devsock_readpages(struct Fd *fd, void *va, size_t n)
+{
+	return nsipc_recvpages(fd->fd_sock.sockid, va, n);
+}
+
+static ssize_t
+devsock_writepages(struct Fd *fd, void *va, size_t n)
+{
+	return nsipc_sendpages(fd->fd_sock.sockid, va, n);
+}
+
 static int
 devsock_stat(struct Fd *fd, struct Stat *stat)
 {
@@ -2,11 +2,33 @@
 #include <inc/lib.h>
 #include <inc/elf.h>
 
-#define UTEMP2USTACK(addr)	((void*) (addr) + (USTACKTOP - PGSIZE) - UTEMP)
-#define UTEMP2			(UTEMP + PGSIZE)
-#define UTEMP3			(UTEMP2 + PGSIZE)
+// Spawn templates are listed in a PTE_SHARE page just below the file
+// descriptor table (see fd.c).  spawn_template_init maps it before the
+// owner forks, so that a shell's forked children all see the templates
+// any one of them made.  Programs spawned from there get the table
+// read-only (see copy_shared_pages): they may use the templates, but
+// only the owner's own forked line adds to the table.  Each template is
+// handed to the table's owner, and the kernel destroys it when the
+// owner goes away.
+#define TMPLTABLE		0xCFFFF000
+#define NTEMPLATE		16
+#define TMPL_PATHLEN		120
+
+struct SpawnTemplate {
+	envid_t st_envid;
+	uint32_t st_version;		// f_version of the file it came from
+	char st_path[TMPL_PATHLEN];
+};
+
+struct TemplateTable {
+	envid_t tt_owner;
+	struct SpawnTemplate tt_slot[NTEMPLATE];
+};
 
 // Helper functions for spawn.
+static int load_program(const char *prog, struct Trapframe *child_tf);
+static int start_child(envid_t child, struct Trapframe *child_tf,
+		       const char **argv);
 static int init_stack(envid_t child, const char **argv, uintptr_t *init_esp);
 static int map_segment(envid_t child, uintptr_t va, size_t memsz,
 		       int fd, size_t filesz, off_t fileoffset, int perm);
@@ -22,9 +44,144 @@ static int copy_shared_pages(envid_t child);
 int
 spawn(const char *prog, const char **argv)
 {
-	unsigned char elf_buf[512];
 	struct Trapframe child_tf;
 	envid_t child;
+	int r;
+
+	if ((r = load_program(prog, &child_tf)) < 0)
+		return r;
+	child = r;
+	if ((r = start_child(child, &child_tf, argv)) < 0)
+		return r;
+	return child;
+}
+
+// Map an empty template table owned by this environment, so that
+// spawn_template in it and in children forked afterwards caches
+// templates.  Returns 0 on success, < 0 on failure.
+int
+spawn_template_init(void)
+{
+	struct TemplateTable *tt = (struct TemplateTable *) TMPLTABLE;
+	int r;
+
+	if ((r = sys_page_alloc(0, tt, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		return r;
+	tt->tt_owner = thisenv->env_id;
+	return 0;
+}
+
+// Return the envid of the cached template for version 'version' of
+// 'prog', or 0 if none.  A template of an older version is destroyed
+// if the table is writable here.
+static envid_t
+template_lookup(struct SpawnTemplate *st, const char *prog, uint32_t version)
+{
+	const volatile struct Env *e;
+	int i;
+
+	for (i = 0; i < NTEMPLATE; i++) {
+		if (!st[i].st_envid || strcmp(st[i].st_path, prog) != 0)
+			continue;
+		e = &envs[ENVX(st[i].st_envid)];
+		if (e->env_id != st[i].st_envid
+		    || e->env_status != ENV_TEMPLATE)
+			continue;
+		if (st[i].st_version == version)
+			return st[i].st_envid;
+		if (uvpt[PGNUM(st)] & PTE_W) {
+			sys_env_destroy(st[i].st_envid);
+			st[i].st_envid = 0;
+		}
+	}
+	return 0;
+}
+
+// Load version 'version' of 'prog' into a new template environment,
+// give it to the table's owner, and remember it in a free slot of the
+// table.  Returns the template's envid, 0 if the table is full, or < 0
+// on failure.
+static envid_t
+template_create(struct TemplateTable *tt, const char *prog, uint32_t version)
+{
+	struct SpawnTemplate *st = tt->tt_slot;
+	const volatile struct Env *e;
+	struct Trapframe tmpl_tf;
+	envid_t tmpl;
+	int i, r;
+
+	for (i = 0; i < NTEMPLATE; i++) {
+		e = &envs[ENVX(st[i].st_envid)];
+		if (!st[i].st_envid || e->env_id != st[i].st_envid
+		    || e->env_status != ENV_TEMPLATE)
+			break;
+	}
+	if (i == NTEMPLATE)
+		return 0;
+
+	if ((r = load_program(prog, &tmpl_tf)) < 0)
+		return r;
+	tmpl = r;
+	if ((r = sys_env_set_trapframe(tmpl, &tmpl_tf)) < 0
+	    || (r = sys_env_set_status(tmpl, ENV_TEMPLATE)) < 0
+	    || (r = sys_env_set_parent(tmpl, tt->tt_owner)) < 0) {
+		sys_env_destroy(tmpl);
+		return r;
+	}
+
+	st[i].st_envid = 0;
+	strcpy(st[i].st_path, prog);
+	st[i].st_version = version;
+	st[i].st_envid = tmpl;
+	return tmpl;
+}
+
+// Like spawn, but start the child from a cached template of 'prog'
+// instead of reading the program from the file system: the kernel
+// copies the template's loaded image copy-on-write (sys_env_clone), and
+// only the stack and shared pages are set up here.  The first
+// spawn_template of a program makes its template, and so does the first
+// one after the program's file has changed, going by its st_version.
+// Falls back on spawn if no template can be made, including when no
+// ancestor has called spawn_template_init and when this env only has
+// the table read-only.
+int
+spawn_template(const char *prog, const char **argv)
+{
+	struct TemplateTable *tt = (struct TemplateTable *) TMPLTABLE;
+	struct Trapframe child_tf;
+	struct Stat st;
+	envid_t tmpl, child;
+	int r;
+
+	if (strlen(prog) >= TMPL_PATHLEN
+	    || !(uvpd[VPD(tt)] & PTE_P) || !(uvpt[PGNUM(tt)] & PTE_P))
+		return spawn(prog, argv);
+	if ((r = stat(prog, &st)) < 0)
+		return r;
+
+	if (!(tmpl = template_lookup(tt->tt_slot, prog, st.st_version))
+	    && (uvpt[PGNUM(tt)] & PTE_W)
+	    && (tmpl = template_create(tt, prog, st.st_version)) < 0)
+		return tmpl;
+	if (!tmpl || (r = sys_env_clone(tmpl)) < 0)
+		return spawn(prog, argv);
+	child = r;
+
+	child_tf = envs[ENVX(child)].env_tf;
+	if ((r = start_child(child, &child_tf, argv)) < 0)
+		return r;
+	return child;
+}
+
+// Create a new, not yet runnable environment and load program 'prog'
+// into it.  On success, returns its envid and sets *child_tf to its
+// initial trap frame, minus the stack pointer.  Returns < 0 on failure.
+static int
+load_program(const char *prog, struct Trapframe *child_tf)
+{
+	unsigned char elf_buf[512];
+	envid_t child;
 
 	int fd, i, r;
 	struct Elf *elf;
@@ -106,12 +263,16 @@ spawn(const char *prog, const char **argv)
 		return r;
 	child = r;
 
-	// Set up trap frame, including initial stack.
-	child_tf = envs[ENVX(child)].env_tf;
-	child_tf.tf_rip = elf->e_entry;
+	// Set up trap frame; start_child sets up the initial stack.
+	*child_tf = envs[ENVX(child)].env_tf;
+	child_tf->tf_rip = elf->e_entry;
 
-	if ((r = init_stack(child, argv, &child_tf.tf_rsp)) < 0)
-		return r;
+	// Usually the file server can map the program's pages from its
+	// block cache straight into the child.  If it can't, read them in.
+	if (file_load_program(fd, child) == 0) {
+		close(fd);
+		return child;
+	}
 
 	// Set up program segments as defined in ELF header.
 	ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
@@ -128,24 +289,39 @@ spawn(const char *prog, const char **argv)
 	close(fd);
 	fd = -1;
 
+	return child;
+
+error:
+	sys_env_destroy(child);
+	close(fd);
+	return r;
+}
+
+// Give a loaded child its stack and shared pages and start it running.
+// Destroys the child and returns < 0 on failure.
+static int
+start_child(envid_t child, struct Trapframe *child_tf, const char **argv)
+{
+	int r;
+
+	if ((r = init_stack(child, argv, &child_tf->tf_rsp)) < 0) {
+		sys_env_destroy(child);
+		return r;
+	}
+
 #line 132 "../lib/spawn.c"
 	// Copy shared library state.
 	if ((r = copy_shared_pages(child)) < 0)
 		panic("copy_shared_pages: %e", r);
 
 #line 137 "../lib/spawn.c"
-	if ((r = sys_env_set_trapframe(child, &child_tf)) < 0)
+	if ((r = sys_env_set_trapframe(child, child_tf)) < 0)
 		panic("sys_env_set_trapframe: %e", r);
 
 	if ((r = sys_env_set_status(child, ENV_RUNNABLE)) < 0)
 		panic("sys_env_set_status: %e", r);
 
-	return child;
-
-error:
-	sys_env_destroy(child);
-	close(fd);
-	return r;
+	return 0;
 }
 
 // Spawn, taking command-line arguments array directly on the stack.
@@ -184,16 +360,20 @@ spawnl(const char *prog, const char *arg0, ...)
 // using the arguments array pointed to by 'argv',
 // which is a null-terminated array of pointers to null-terminated strings.
 //
+// The strings go at the top of the child's stack page, with the argv
+// array below them and argc and argv below that.  Each piece is
+// written straight into the child with sys_env_write, which allocates
+// the page; the writes are batched on the sysring.
+//
 // On success, returns 0 and sets *init_esp
 // to the initial stack pointer with which the child should start.
 // Returns < 0 on failure.
 static int
 init_stack(envid_t child, const char **argv, uintptr_t *init_esp)
 {
-	size_t string_size;
-	int argc, i, r;
-	char *string_store;
-	uintptr_t *argv_store;
+	size_t string_size, len;
+	int argc, i;
+	uintptr_t string_store, argv_store, sp;
 
 	// Count the number of arguments (argc)
 	// and the total amount of space needed for strings (string_size).
@@ -201,74 +381,43 @@ init_stack(envid_t child, const char **argv, uintptr_t *init_esp)
 	for (argc = 0; argv[argc] != 0; argc++)
 		string_size += strlen(argv[argc]) + 1;
 
-	// Determine where to place the strings and the argv array.
-	// Set up pointers into the temporary page 'UTEMP'; we'll map a page
-	// there later, then remap that page into the child environment
-	// at (USTACKTOP - PGSIZE).
-	// strings is the topmost thing on the stack.
-	string_store = (char*) UTEMP + PGSIZE - string_size;
-	// argv is below that.  There's one argument pointer per argument, plus
-	// a null pointer.
-	argv_store = (uintptr_t*) (ROUNDDOWN(string_store, 8) - 8 * (argc + 1));
+	// Determine where to place the strings and the argv array in the
+	// child.  strings is the topmost thing on the stack; argv is below
+	// that.  There's one argument pointer per argument, plus a null
+	// pointer, and below them the 2 words that hold 'argc' and 'argv'.
+	string_store = USTACKTOP - string_size;
+	argv_store = ROUNDDOWN(string_store, 8) - 8 * (argc + 1);
+	sp = argv_store - 16;
 
 	// Make sure that argv, strings, and the 2 words that hold 'argc'
 	// and 'argv' themselves will all fit in a single stack page.
-	if ((void*) (argv_store - 2) < (void*) UTEMP)
+	if (sp < USTACKTOP - PGSIZE)
 		return -E_NO_MEM;
 
-	// Allocate the single stack page at UTEMP.
-	if ((r = sys_page_alloc(0, (void*) UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
-		return r;
-
-
-	//	* Initialize 'argv_store[i]' to point to argument string i,
-	//	  for all 0 <= i < argc.
-	//	  Also, copy the argument strings from 'argv' into the
-	//	  newly-allocated stack page.
-	//
-	//	* Set 'argv_store[argc]' to 0 to null-terminate the args array.
-	//
-	//	* Push two more words onto the child's stack below 'args',
-	//	  containing the argc and argv parameters to be passed
-	//	  to the child's umain() function.
-	//	  argv should be below argc on the stack.
-	//	  (Again, argv should use an address valid in the child's
-	//	  environment.)
-	//
-	//	* Set *init_esp to the initial stack pointer for the child,
-	//	  (Again, use an address valid in the child's environment.)
+	uintptr_t words[argc + 3];
+	words[0] = argc;
+	words[1] = argv_store;
 	for (i = 0; i < argc; i++) {
-		argv_store[i] = UTEMP2USTACK(string_store);
-		strcpy(string_store, argv[i]);
-		string_store += strlen(argv[i]) + 1;
+		len = strlen(argv[i]) + 1;
+		words[2 + i] = string_store;
+		sysring_push(SYS_env_write, 0, child, string_store,
+			     (uint64_t) argv[i], len, PTE_P|PTE_U|PTE_W);
+		string_store += len;
 	}
-	argv_store[argc] = 0;
-	assert(string_store == (char*)UTEMP + PGSIZE);
-
-	argv_store[-1] = UTEMP2USTACK(argv_store);
-	argv_store[-2] = argc;
-
-	*init_esp = UTEMP2USTACK(&argv_store[-2]);
-
-	// After completing the stack, map it into the child's address space
-	// and unmap it from ours!
-	if ((r = sys_page_map(0, UTEMP, child, (void*) (USTACKTOP - PGSIZE), PTE_P | PTE_U | PTE_W)) < 0)
-		goto error;
-	if ((r = sys_page_unmap(0, UTEMP)) < 0)
-		goto error;
+	words[2 + argc] = 0;
+	assert(string_store == USTACKTOP);
+	sysring_push(SYS_env_write, 0, child, sp, (uint64_t) words,
+		     sizeof(words), PTE_P|PTE_U|PTE_W);
 
-	return 0;
-
-error:
-	sys_page_unmap(0, UTEMP);
-	return r;
+	*init_esp = sp;
+	return sysring_submit();
 }
 
 static int
 map_segment(envid_t child, uintptr_t va, size_t memsz,
 	    int fd, size_t filesz, off_t fileoffset, int perm)
 {
-	int i, r;
+	int i, r, r2;
 	void *blk;
 
 	//cprintf("map_segment %x+%x\n", va, memsz);
@@ -280,25 +429,35 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 		fileoffset -= i;
 	}
 
+	// File pages are read into one staging page at UTEMP and copied
+	// into fresh pages in the child with sys_env_write, so each costs
+	// one kernel entry.  The blank pages share a few on the sysring.
+	if (filesz > 0 && (r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
 	for (i = 0; i < memsz; i += PGSIZE) {
 		if (i >= filesz) {
 			// allocate a blank page
-			if ((r = sys_page_alloc(child, (void*) (va + i), perm)) < 0)
-				return r;
+			sysring_push(SYS_page_alloc, 0, child, va + i, perm, 0, 0);
 		} else {
 			// from file
-			if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
-				return r;
-			if ((r = seek(fd, fileoffset + i)) < 0)
-				return r;
-			if ((r = readn(fd, UTEMP, MIN(PGSIZE, filesz-i))) < 0)
-				return r;
-			if ((r = sys_page_map(0, UTEMP, child, (void*) (va + i), perm)) < 0)
-				panic("spawn: sys_page_map data: %e", r);
-			sys_page_unmap(0, UTEMP);
+			if ((r = seek(fd, fileoffset + i)) < 0
+			    || (r = readn(fd, UTEMP, MIN(PGSIZE, filesz-i))) < 0)
+				goto out;
+			// A file cut short still gets the page, blank.
+			if (r == 0)
+				sysring_push(SYS_page_alloc, 0, child, va + i, perm, 0, 0);
+			else if ((r = sys_env_write(child, va + i, UTEMP, r, perm)) < 0)
+				goto out;
 		}
 	}
-	return 0;
+	r = 0;
+out:
+	// Run what is queued even after an error, so that it does not
+	// spill into someone else's submit.
+	if ((r2 = sysring_submit()) < 0 && r >= 0)
+		r = r2;
+	sys_page_unmap(0, UTEMP);
+	return r;
 }
 
 #line 305 "../lib/spawn.c"
@@ -309,6 +468,7 @@ copy_shared_pages(envid_t child)
 #line 310 "../lib/spawn.c"
 	int64_t pn, last_pn, r;
 	void* va;
+	int perm;
 
 	for (pn = 0; pn < PGNUM(UTOP); ) {
 		if (!(uvpde[pn>>18] & PTE_P && uvpd[pn >> 9] & PTE_P))
@@ -318,13 +478,18 @@ copy_shared_pages(envid_t child)
 			for (; pn < last_pn; pn++)
 				if ((uvpt[pn] & (PTE_P | PTE_SHARE)) == (PTE_P | PTE_SHARE)) {
 					va = (void*) (pn << PGSHIFT);
-					if ((r = sys_page_map(0, va, child, va, uvpt[pn] & PTE_SYSCALL)) < 0)
-						return r;
+					perm = uvpt[pn] & PTE_SYSCALL;
+					// The spawned program may only read
+					// the template table.
+					if (va == (void*) TMPLTABLE)
+						perm &= ~PTE_W;
+					sysring_push(SYS_page_map, 0, 0, (uint64_t) va,
+						     child, (uint64_t) va, perm);
 				}
 		}
 	}
 #line 329 "../lib/spawn.c"
-	return 0;
+	return sysring_submit();
 }
 #line 332 "../lib/spawn.c"
 
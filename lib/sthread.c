@@ -0,0 +1,136 @@
+// Threads that share an address space, built on sfork, with mutexes
+// and condition variables built on futexes.
+//
+// Each thread is an env of its own, so it runs on whatever CPU the
+// scheduler picks and is joined like any child, with sthread_join.
+// Because sfork only shares pages that are already mapped, allocate
+// anything else the threads share before creating them.  The malloc
+// heap is taken care of: the first sthread_create maps STHREAD_HEAP
+// bytes of it for good (see malloc_share), and threads may malloc and
+// free from it freely.  Call malloc_share first for a bigger heap.
+
+#include <inc/x86.h>
+#include <inc/lib.h>
+
+#define STHREAD_HEAP	(4 << 20)
+
+// Start a thread running fn(arg) and store its id in *tid.
+// The thread exits with fn's return value when fn returns.
+// Returns 0 on success, < 0 on error.
+int
+sthread_create(envid_t *tid, int (*fn)(void *), void *arg)
+{
+	envid_t envid;
+	int r;
+
+	if ((r = malloc_share(STHREAD_HEAP / PGSIZE)) < 0
+	    || (r = sys_env_keep_zombies(1)) < 0)
+		return r;
+	if ((envid = sfork()) < 0)
+		return envid;
+	if (envid == 0)
+		sthread_exit(fn(arg));
+	*tid = envid;
+	return 0;
+}
+
+// Exit the calling thread with 'status'.  Unlike exit, this leaves the
+// file descriptors alone, since the other threads share them.
+void
+sthread_exit(int status)
+{
+	sys_env_exit(status);
+	panic("sthread_exit: still running");
+}
+
+// Wait for thread 'tid', which this thread created, to exit and store
+// its exit status in *status (if status is nonnull).  A thread that
+// exits first is kept until it is joined (sthread_create has the
+// kernel keep zombies), so the order of joins doesn't matter.
+// Returns 0 on success, < 0 on error.
+int
+sthread_join(envid_t tid, int *status)
+{
+	return sys_env_wait(tid, status);
+}
+
+// Mutexes: m_state is 0 when unlocked, 1 when locked, and 2 when locked
+// and some thread may be sleeping on it, so that an uncontended
+// lock/unlock pair never enters the kernel.
+
+void
+mutex_init(struct Mutex *m)
+{
+	m->m_state = 0;
+}
+
+void
+mutex_lock(struct Mutex *m)
+{
+	uint32_t c;
+
+	if ((c = __sync_val_compare_and_swap(&m->m_state, 0, 1)) == 0)
+		return;
+	if (c != 2)
+		c = xchg(&m->m_state, 2);
+	while (c != 0) {
+		sys_futex_wait(&m->m_state, 2, 0);
+		c = xchg(&m->m_state, 2);
+	}
+}
+
+// Returns 0 if m was taken, -E_AGAIN if it is already locked.
+int
+mutex_trylock(struct Mutex *m)
+{
+	if (__sync_val_compare_and_swap(&m->m_state, 0, 1) != 0)
+		return -E_AGAIN;
+	return 0;
+}
+
+void
+mutex_unlock(struct Mutex *m)
+{
+	if (__sync_fetch_and_sub(&m->m_state, 1) != 1) {
+		m->m_state = 0;
+		sys_futex_wake(&m->m_state, 1);
+	}
+}
+
+// Condition variables: waiters sleep until c_seq moves on from the
+// value they saw before dropping the mutex, so a signal sent between
+// the unlock and the sleep is not lost.
+
+void
+cond_init(struct Cond *c)
+{
+	c->c_seq = 0;
+}
+
+// Atomically release m and wait for c to be signaled, then re-acquire m.
+// As with any condition variable, recheck the condition on return.
+void
+cond_wait(struct Cond *c, struct Mutex *m)
+{
+	uint32_t seq = c->c_seq;
+
+	mutex_unlock(m);
+	sys_futex_wait(&c->c_seq, seq, 0);
+	mutex_lock(m);
+}
+
+// Wake one thread waiting on c.
+void
+cond_signal(struct Cond *c)
+{
+	__sync_fetch_and_add(&c->c_seq, 1);
+	sys_futex_wake(&c->c_seq, 1);
+}
+
+// Wake every thread waiting on c.
+void
+cond_broadcast(struct Cond *c)
+{
+	__sync_fetch_and_add(&c->c_seq, 1);
+	sys_futex_wake(&c->c_seq, NENV);
+}
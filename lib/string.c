@@ -1,7 +1,8 @@
 #line 2 "../lib/string.c"
-// Basic string routines.  Not hardware optimized, but not shabby.
+// Basic string routines, with word-at-a-time and rep movs/stos fast paths.
 
 #include <inc/string.h>
+#include <inc/x86.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
@@ -9,14 +10,51 @@
 // Primespipe runs 3x faster this way.
 #define ASM 1
 
+// Word-at-a-time helpers.  HASZERO(v) is nonzero iff some byte of v
+// is zero.  Aligned word reads never cross into an unmapped page, so
+// the scanning functions may read a little past the end of a string.
+typedef uint64_t __attribute__((__may_alias__)) word_t;
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) uword_t;
+#define ONES		0x0101010101010101ULL
+#define HASZERO(v)	(((v) - ONES) & ~(v) & (ONES << 7))
+
+// On CPUs with enhanced rep movsb/stosb, a single "rep movsb" or
+// "rep stosb" is the fastest way to handle a large copy or fill.
+#define CPUID7_EBX_ERMS	(1 << 9)
+#define ERMS_MIN	256
+
+static bool string_erms;
+
+// Pick the fastest memmove/memset paths for this CPU with CPUID.
+// The defaults work everywhere, so this is just an optimization.
+void
+string_init(void)
+{
+#ifndef VMM_GUEST	// cpuid traps to the VMM, which does not emulate it
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(0, &eax, NULL, NULL, NULL);
+	if (eax >= 7) {
+		cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+		string_erms = (ebx & CPUID7_EBX_ERMS) != 0;
+	}
+#endif
+}
+
 int
 strlen(const char *s)
 {
-	int n;
+	const char *p;
+	const word_t *w;
 
-	for (n = 0; *s != '\0'; s++)
-		n++;
-	return n;
+	for (p = s; (uintptr_t) p % 8 != 0; p++)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p; !HASZERO(*w); w++)
+		/* do nothing */;
+	for (p = (const char *) w; *p != '\0'; p++)
+		/* do nothing */;
+	return p - s;
 }
 
 int
@@ -122,20 +160,24 @@ strfind(const char *s, char c)
 void *
 memset(void *v, int c, size_t n)
 {
-	char *p;
-
-	if (n == 0)
-		return v;
-	if ((int64_t)v%4 == 0 && n%4 == 0) {
-		c &= 0xFF;
-		c = (c<<24)|(c<<16)|(c<<8)|c;
-		asm volatile("cld; rep stosl\n"
-			     :: "D" (v), "a" (c), "c" (n/4)
-			     : "cc", "memory");
-	} else
+	char *p = v;
+	uint64_t pat = ONES * (unsigned char) c;
+	size_t k;
+
+	// Large fills are one rep stosb on ERMS CPUs.  Otherwise fill
+	// up to a word boundary, then whole words, then the tail.
+	if (n >= 16 && !(string_erms && n >= ERMS_MIN)) {
+		k = -(uintptr_t) p % 8;
+		n -= k;
 		asm volatile("cld; rep stosb\n"
-			     :: "D" (v), "a" (c), "c" (n)
-			     : "cc", "memory");
+			     : "+D" (p), "+c" (k) : "a" (c) : "cc", "memory");
+		k = n / 8;
+		n %= 8;
+		asm volatile("rep stosq\n"
+			     : "+D" (p), "+c" (k) : "a" (pat) : "cc", "memory");
+	}
+	asm volatile("cld; rep stosb\n"
+		     : "+D" (p), "+c" (n) : "a" (c) : "cc", "memory");
 	return v;
 }
 
@@ -144,27 +186,48 @@ memmove(void *dst, const void *src, size_t n)
 {
 	const char *s;
 	char *d;
+	size_t k;
 
 	s = src;
 	d = dst;
 	if (s < d && s + n > d) {
-		s += n;
-		d += n;
-		if ((int64_t)s%4 == 0 && (int64_t)d%4 == 0 && n%4 == 0)
-			asm volatile("std; rep movsl\n"
-				     :: "D" (d-4), "S" (s-4), "c" (n/4) : "cc", "memory");
-		else
+		// Copy backwards from the last byte: up to a word boundary
+		// in d, then whole words, then the rest.
+		s += n - 1;
+		d += n - 1;
+		if (n >= 16) {
+			k = ((uintptr_t) d + 1) % 8;
+			n -= k;
 			asm volatile("std; rep movsb\n"
-				     :: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
+				     : "+D" (d), "+S" (s), "+c" (k) :: "cc", "memory");
+			d -= 7;
+			s -= 7;
+			k = n / 8;
+			n %= 8;
+			asm volatile("rep movsq\n"
+				     : "+D" (d), "+S" (s), "+c" (k) :: "cc", "memory");
+			d += 7;
+			s += 7;
+		}
+		asm volatile("std; rep movsb\n"
+			     : "+D" (d), "+S" (s), "+c" (n) :: "cc", "memory");
 		// Some versions of GCC rely on DF being clear
 		asm volatile("cld" ::: "cc");
 	} else {
-		if ((int64_t)s%4 == 0 && (int64_t)d%4 == 0 && n%4 == 0)
-			asm volatile("cld; rep movsl\n"
-				     :: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
-		else
+		// Forwards, the same way, except that large copies are
+		// one rep movsb on ERMS CPUs.
+		if (n >= 16 && !(string_erms && n >= ERMS_MIN)) {
+			k = -(uintptr_t) d % 8;
+			n -= k;
 			asm volatile("cld; rep movsb\n"
-				     :: "D" (d), "S" (s), "c" (n) : "cc", "memory");
+				     : "+D" (d), "+S" (s), "+c" (k) :: "cc", "memory");
+			k = n / 8;
+			n %= 8;
+			asm volatile("rep movsq\n"
+				     : "+D" (d), "+S" (s), "+c" (k) :: "cc", "memory");
+		}
+		asm volatile("cld; rep movsb\n"
+			     : "+D" (d), "+S" (s), "+c" (n) :: "cc", "memory");
 	}
 	return dst;
 }
@@ -218,6 +281,10 @@ memcmp(const void *v1, const void *v2, size_t n)
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
 
+	// Skip equal words, then find the difference a byte at a time.
+	for (; n >= 8; n -= 8, s1 += 8, s2 += 8)
+		if (*(const uword_t *) s1 != *(const uword_t *) s2)
+			break;
 	while (n-- > 0) {
 		if (*s1 != *s2)
 			return (int) *s1 - (int) *s2;
@@ -230,11 +297,20 @@ memcmp(const void *v1, const void *v2, size_t n)
 void *
 memfind(const void *s, int c, size_t n)
 {
-	const void *ends = (const char *) s + n;
-	for (; s < ends; s++)
-		if (*(const unsigned char *) s == (unsigned char) c)
+	const unsigned char *p = s, *ends = p + n;
+	uint64_t pat = ONES * (unsigned char) c;
+
+	for (; p < ends && (uintptr_t) p % 8 != 0; p++)
+		if (*p == (unsigned char) c)
+			return (void *) p;
+	// A word holding c has a zero byte after xoring with pat.
+	for (; ends - p >= 8; p += 8)
+		if (HASZERO(*(const word_t *) p ^ pat))
+			break;
+	for (; p < ends; p++)
+		if (*p == (unsigned char) c)
 			break;
-	return (void *) s;
+	return (void *) p;
 }
 
 long
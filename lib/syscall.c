@@ -11,7 +11,11 @@ syscall(int num, int check, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4,
 
 	// Generic system call: pass system call number in AX,
 	// up to five parameters in DX, CX, BX, DI, SI.
-	// Interrupt kernel with T_SYSCALL.
+	// Enter the kernel with the SYSCALL instruction, which uses CX
+	// and R11 for the return address and flags, so the second
+	// parameter travels in R10 instead.  The kernel entry code also
+	// uses R8 and R9 as scratch.  A guest kernel does not enable
+	// SYSCALL, so guests interrupt the kernel with T_SYSCALL.
 	//
 	// The "volatile" tells the assembler not to optimize
 	// this instruction away just because we don't use the
@@ -21,6 +25,18 @@ syscall(int num, int check, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4,
 	// potentially change the condition codes and arbitrary
 	// memory locations.
 
+#ifndef VMM_GUEST
+	register uint64_t r10 asm("r10") = a2;
+
+	asm volatile("syscall\n"
+		     : "=a" (ret), "+r" (r10)
+		     : "a" (num),
+		       "d" (a1),
+		       "b" (a3),
+		       "D" (a4),
+		       "S" (a5)
+		     : "rcx", "r8", "r9", "r11", "cc", "memory");
+#else
 	asm volatile("int %1\n"
 		     : "=a" (ret)
 		     : "i" (T_SYSCALL),
@@ -31,6 +47,7 @@ syscall(int num, int check, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4,
 		       "D" (a4),
 		       "S" (a5)
 		     : "cc", "memory");
+#endif
 
 	if(check && ret > 0)
 		panic("syscall %d returned %d (> 0)", num, ret);
@@ -95,6 +112,63 @@ sys_env_set_status(envid_t envid, int status)
 	return syscall(SYS_env_set_status, 1, envid, status, 0, 0, 0);
 }
 
+envid_t
+sys_env_clone(envid_t tmpl)
+{
+	return syscall(SYS_env_clone, 0, tmpl, 0, 0, 0, 0);
+}
+
+int
+sys_env_set_parent(envid_t envid, envid_t parent)
+{
+	return syscall(SYS_env_set_parent, 1, envid, parent, 0, 0, 0);
+}
+
+int
+sys_spawn_from_pages(envid_t envid, void *const *pages, size_t npages)
+{
+	return syscall(SYS_spawn_from_pages, 0, envid, (uint64_t) pages,
+		       npages, 0, 0);
+}
+
+int
+sys_env_write(envid_t envid, uintptr_t dstva, const void *src, size_t len,
+	      int perm)
+{
+	return syscall(SYS_env_write, 0, envid, dstva, (uint64_t) src,
+		       len, perm);
+}
+
+int
+sys_env_read(envid_t envid, uintptr_t srcva, void *dst, size_t len)
+{
+	return syscall(SYS_env_read, 0, envid, srcva, (uint64_t) dst, len, 0);
+}
+
+void
+sys_env_exit(int status)
+{
+	syscall(SYS_env_exit, 1, status, 0, 0, 0, 0);
+}
+
+int
+sys_env_wait(envid_t envid, int *status_store)
+{
+	int r;
+
+	if ((r = syscall(SYS_env_wait, 0, envid, 0, 0, 0, 0)) < 0)
+		return r;
+	if (status_store)
+		*status_store = thisenv->env_wait_status;
+	return 0;
+}
+
+int
+sys_env_keep_zombies(bool keep)
+{
+	return syscall(SYS_env_keep_zombies, 0, keep, 0, 0, 0, 0);
+}
+
 #line 99 "../lib/syscall.c"
 int
 sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
@@ -121,6 +195,56 @@ sys_ipc_recv(void *dstva)
 	return syscall(SYS_ipc_recv, 1, (uint64_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_try_sendv(envid_t envid, uint64_t value, const struct IpcPage *pages, size_t npages)
+{
+	return syscall(SYS_ipc_try_sendv, 0, envid, value, (uint64_t) pages, npages, 0);
+}
+
+int
+sys_ipc_recvv(void *dstva, size_t npages)
+{
+	return syscall(SYS_ipc_recvv, 1, (uint64_t) dstva, npages, 0, 0, 0);
+}
+
+int
+sys_futex_wait(const volatile uint32_t *va, uint32_t expected, unsigned timeout)
+{
+	return syscall(SYS_futex_wait, 0, (uint64_t) va, expected, timeout, 0, 0);
+}
+
+int
+sys_futex_wake(const volatile uint32_t *va, int n)
+{
+	return syscall(SYS_futex_wake, 0, (uint64_t) va, n, 0, 0, 0);
+}
+
+int
+sys_ring_enter(struct Sysring *ring)
+{
+	return syscall(SYS_ring_enter, 0, (uint64_t) ring, 0, 0, 0, 0);
+}
+
+int
+sys_notify(envid_t envid, uint64_t bits)
+{
+	return syscall(SYS_notify, 1, envid, bits, 0, 0, 0);
+}
+
+int
+sys_notify_wait(uint64_t mask, bool ipc, void *dstva, size_t npages,
+		unsigned timeout)
+{
+	return syscall(SYS_notify_wait, 0, mask, ipc, (uint64_t) dstva, npages,
+		       timeout);
+}
+
+uint64_t
+sys_notify_take(uint64_t mask)
+{
+	return (uint64_t) syscall(SYS_notify_take, 0, mask, 0, 0, 0, 0);
+}
+
 #line 125 "../lib/syscall.c"
 unsigned int
 sys_time_msec(void)
@@ -140,6 +264,25 @@ sys_net_receive(char *buf, unsigned int len)
 {
 	return syscall(SYS_net_receive, 0, (uint64_t)buf, len, 0, 0, 0);
 }
+
+int
+sys_disk_read(int diskno, uint32_t secno, void *dst, size_t nsecs)
+{
+	return syscall(SYS_disk_read, 0, diskno, secno, (uint64_t)dst, nsecs, 0);
+}
+
+int
+sys_disk_write(int diskno, uint32_t secno, const void *src, size_t nsecs,
+	       bool async)
+{
+	return syscall(SYS_disk_write, 0, diskno, secno, (uint64_t)src, nsecs, async);
+}
+
+int
+sys_disk_wait(void)
+{
+	return syscall(SYS_disk_wait, 0, 0, 0, 0, 0, 0);
+}
 #line 144 "../lib/syscall.c"
 
 #line 146 "../lib/syscall.c"
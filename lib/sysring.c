@@ -0,0 +1,66 @@
+// Batched system calls through the env's submission ring.
+//
+// sysring_push queues a call; sysring_submit runs everything queued in
+// one sys_ring_enter.  Runs of page mapping calls (spawn, malloc, the
+// VMM loader) use this to avoid a trap per page.  Queued calls don't run
+// until submitted, so don't rely on their effects before then.
+
+#include <inc/lib.h>
+
+static struct Sysring sysring THREAD_LOCAL __attribute__((aligned(PGSIZE)));
+static int64_t sysring_err THREAD_LOCAL;	// First failure since the last submit
+
+// Run the queued entries, remembering the first one that failed.
+static void
+sysring_drain(void)
+{
+	uint32_t i, start;
+
+	static_assert(sizeof(sysring) <= PGSIZE);
+
+	start = sysring.sr_head;
+	sys_ring_enter(&sysring);
+	for (i = start; i != sysring.sr_head; i++)
+		if (sysring.sr_ent[i % SYSRING_SIZE].se_result < 0 && !sysring_err)
+			sysring_err = sysring.sr_ent[i % SYSRING_SIZE].se_result;
+}
+
+// Queue system call 'num' with arguments a1..a5.
+// 'flags' is a combination of SYSRING_LINK and SYSRING_ARG(i).
+// If the ring is full, the queued calls are run first.
+void
+sysring_push(int num, uint32_t flags, uint64_t a1, uint64_t a2,
+	     uint64_t a3, uint64_t a4, uint64_t a5)
+{
+	struct SysringEntry *ent;
+
+	if (sysring.sr_tail - sysring.sr_head == SYSRING_SIZE)
+		sysring_drain();
+
+	ent = &sysring.sr_ent[sysring.sr_tail % SYSRING_SIZE];
+	ent->se_num = num;
+	ent->se_flags = flags;
+	ent->se_args[0] = a1;
+	ent->se_args[1] = a2;
+	ent->se_args[2] = a3;
+	ent->se_args[3] = a4;
+	ent->se_args[4] = a5;
+	sysring.sr_tail++;
+}
+
+// Run every queued system call.
+// Returns 0 if they all succeeded, otherwise the first error
+// (including calls that ran early because the ring filled up).
+int
+sysring_submit(void)
+{
+	int r;
+
+	while (sysring.sr_head != sysring.sr_tail)
+		sysring_drain();
+	// Chains end at a submit.
+	sysring.sr_cancel = 0;
+	r = sysring_err;
+	sysring_err = 0;
+	return r;
+}
@@ -0,0 +1,442 @@
+// Cooperative ("green") threads within one environment, originally
+// written for the lwIP network server.
+//
+// Threads only switch in thread_yield (and the calls built on it), so
+// they need no locks among themselves.  A thread waiting for an IPC
+// reply in thread_ipc_recv lets the others run; once none of them can
+// make progress, one receive is done for the whole environment and the
+// message is handed to the thread waiting for it.  Each thread sends
+// its requests in a page of its own, so several can be outstanding at
+// the same server; a reply that carries the request page back goes to
+// the thread that sent it, others to the sender's longest waiter.
+
+#include <inc/lib.h>
+#include <inc/setjmp.h>
+
+#define THREAD_NUM_ONHALT 4
+enum { name_size = 32 };
+enum { stack_size = PGSIZE };
+
+// Window at which IPC messages are received before being handed to the
+// thread waiting for them, and the per-thread pages that requests in
+// thread_ipc_call travel in.
+#define THREAD_RECVVA		0xE2000000
+#define THREAD_RECV_MAXPAGES	16
+#define THREAD_REQVA		0xE3000000
+#define THREAD_MAXREQ		256
+
+struct thread_context {
+    thread_id_t		tc_tid;
+    void		*tc_stack_bottom;
+    char 		tc_name[name_size];
+    void		(*tc_entry)(uint64_t);
+    uint64_t		tc_arg;
+    struct jos_jmp_buf	tc_jb;
+    bool		tc_waiting;	// In thread_wait
+    volatile uint32_t	*tc_wait_addr;
+    uint32_t		tc_wait_val;
+    uint32_t		tc_wait_until;
+    volatile char	tc_wakeup;
+    envid_t		tc_ipc_from;	// Sender awaited in thread_ipc_recv
+    uint32_t		tc_ipc_seq;	// Order in which waits began
+    void		*tc_ipc_pg;
+    size_t		tc_ipc_maxpages;
+    size_t		tc_ipc_npages;
+    int32_t		tc_ipc_value;
+    bool		tc_ipc_done;
+    void		*tc_req;	// Request page, 0 until first needed
+    void		(*tc_onhalt[THREAD_NUM_ONHALT])(thread_id_t);
+    int			tc_nonhalt;
+    struct thread_context *tc_queue_link;
+};
+
+struct thread_queue
+{
+    struct thread_context *tq_first;
+    struct thread_context *tq_last;
+};
+
+static thread_id_t max_tid THREAD_LOCAL;
+static struct thread_context *cur_tc THREAD_LOCAL;
+
+static struct thread_queue thread_queue THREAD_LOCAL;
+static struct thread_queue kill_queue THREAD_LOCAL;
+static uint32_t ipc_seq THREAD_LOCAL;
+static bool req_used[THREAD_MAXREQ] THREAD_LOCAL;
+
+static inline void
+threadq_init(struct thread_queue *tq)
+{
+    tq->tq_first = 0;
+    tq->tq_last = 0;
+}
+
+static inline void
+threadq_push(struct thread_queue *tq, struct thread_context *tc)
+{
+    tc->tc_queue_link = 0;
+    if (!tq->tq_first) {
+	tq->tq_first = tc;
+	tq->tq_last = tc;
+    } else {
+	tq->tq_last->tc_queue_link = tc;
+	tq->tq_last = tc;
+    }
+}
+
+static inline struct thread_context *
+threadq_pop(struct thread_queue *tq)
+{
+    if (!tq->tq_first)
+	return 0;
+
+    struct thread_context *tc = tq->tq_first;
+    tq->tq_first = tc->tc_queue_link;
+    tc->tc_queue_link = 0;
+    return tc;
+}
+
+void
+thread_init(void) {
+    threadq_init(&thread_queue);
+    max_tid = 0;
+}
+
+uint32_t
+thread_id(void) {
+    return cur_tc->tc_tid;
+}
+
+// Returns true if called from a green thread.
+bool
+thread_active(void) {
+    return cur_tc != NULL;
+}
+
+void
+thread_wakeup(volatile uint32_t *addr) {
+    struct thread_context *tc = thread_queue.tq_first;
+    while (tc) {
+	if (tc->tc_wait_addr == addr)
+	    tc->tc_wakeup = 1;
+	tc = tc->tc_queue_link;
+    }
+}
+
+// Let other threads run until *addr != val (if addr is nonzero), a
+// thread_wakeup on addr, or sys_time_msec() reaches msec.
+void
+thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
+    uint32_t s = sys_time_msec();
+    uint32_t p = s;
+
+    cur_tc->tc_waiting = 1;
+    cur_tc->tc_wait_addr = addr;
+    cur_tc->tc_wait_val = val;
+    cur_tc->tc_wait_until = msec;
+    cur_tc->tc_wakeup = 0;
+
+    while (p < msec) {
+	if (p < s)
+	    break;
+	if (addr && *addr != val)
+	    break;
+	if (cur_tc->tc_wakeup)
+	    break;
+
+	thread_yield();
+	p = sys_time_msec();
+    }
+
+    cur_tc->tc_waiting = 0;
+    cur_tc->tc_wait_addr = 0;
+    cur_tc->tc_wakeup = 0;
+}
+
+// Let other threads run for 'msec' milliseconds.
+void
+thread_sleep(uint32_t msec) {
+    thread_wait(0, 0, sys_time_msec() + msec);
+}
+
+int
+thread_wakeups_pending(void)
+{
+    struct thread_context *tc = thread_queue.tq_first;
+    int n = 0;
+    while (tc) {
+	if (tc->tc_wakeup)
+	    ++n;
+	tc = tc->tc_queue_link;
+    }
+    return n;
+}
+
+int
+thread_onhalt(void (*fun)(thread_id_t)) {
+    if (cur_tc->tc_nonhalt >= THREAD_NUM_ONHALT)
+	return -E_NO_MEM;
+
+    cur_tc->tc_onhalt[cur_tc->tc_nonhalt++] = fun;
+    return 0;
+}
+
+static thread_id_t
+alloc_tid(void) {
+    int tid = max_tid++;
+    if (max_tid == (uint32_t)~0)
+	panic("alloc_tid: no more thread ids");
+    return tid;
+}
+
+static void
+thread_set_name(struct thread_context *tc, const char *name)
+{
+    strncpy(tc->tc_name, name, name_size - 1);
+    tc->tc_name[name_size - 1] = 0;
+}
+
+static void
+thread_entry(void) {
+    cur_tc->tc_entry(cur_tc->tc_arg);
+    thread_halt();
+}
+
+int
+thread_create(thread_id_t *tid, const char *name,
+		void (*entry)(uint64_t), uint64_t arg) {
+    struct thread_context *tc = malloc(sizeof(struct thread_context));
+    if (!tc)
+	return -E_NO_MEM;
+
+    memset(tc, 0, sizeof(struct thread_context));
+
+    thread_set_name(tc, name);
+    tc->tc_tid = alloc_tid();
+
+    tc->tc_stack_bottom = malloc(stack_size);
+    if (!tc->tc_stack_bottom) {
+	free(tc);
+	return -E_NO_MEM;
+    }
+
+    void *stacktop = tc->tc_stack_bottom + stack_size;
+    // Terminate stack unwinding
+    stacktop = stacktop - 8;
+    memset(stacktop, 0, 8);
+
+    memset(&tc->tc_jb, 0, sizeof(tc->tc_jb));
+    tc->tc_jb.jb_rsp = (uint64_t)stacktop;
+    tc->tc_jb.jb_rip = (uint64_t)&thread_entry;
+    tc->tc_entry = entry;
+    tc->tc_arg = arg;
+
+    threadq_push(&thread_queue, tc);
+
+    if (tid)
+	*tid = tc->tc_tid;
+    return 0;
+}
+
+static void
+thread_clean(struct thread_context *tc) {
+    if (!tc) return;
+
+    int i;
+    for (i = 0; i < tc->tc_nonhalt; i++)
+	tc->tc_onhalt[i](tc->tc_tid);
+    if (tc->tc_req) {
+	sys_page_unmap(0, tc->tc_req);
+	req_used[((uintptr_t) tc->tc_req - THREAD_REQVA) / PGSIZE] = 0;
+    }
+    free(tc->tc_stack_bottom);
+    free(tc);
+}
+
+// End the current thread.  The environment exits along with its last
+// thread: the code that started the threads gave up its own context in
+// its first thread_yield, so there is nothing else left to run.
+void
+thread_halt() {
+    // right now the kill_queue will never be more than one
+    // clean up a thread if one is on the queue
+    thread_clean(threadq_pop(&kill_queue));
+
+    threadq_push(&kill_queue, cur_tc);
+    cur_tc = NULL;
+    // Only returns if no thread is left.  We are still on the halted
+    // thread's stack, so it stays on the kill queue until exit.
+    thread_yield();
+    exit();
+}
+
+void
+thread_yield(void) {
+    struct thread_context *next_tc = threadq_pop(&thread_queue);
+
+    if (!next_tc)
+	return;
+
+    if (cur_tc) {
+	if (jos_setjmp(&cur_tc->tc_jb) != 0)
+	    return;
+	threadq_push(&thread_queue, cur_tc);
+    }
+
+    cur_tc = next_tc;
+    jos_longjmp(&cur_tc->tc_jb, 1);
+}
+
+// Could tc get further if it ran now?  A thread that is neither in
+// thread_wait nor thread_ipc_recv always could.
+static bool
+thread_ready(struct thread_context *tc, uint32_t now) {
+    if (tc->tc_ipc_from)
+	return tc->tc_ipc_done;
+    if (tc->tc_waiting)
+	return tc->tc_wakeup || now >= tc->tc_wait_until
+	    || (tc->tc_wait_addr && *tc->tc_wait_addr != tc->tc_wait_val);
+    return 1;
+}
+
+static bool
+thread_others_ready(void) {
+    struct thread_context *tc;
+    uint32_t now = sys_time_msec();
+
+    for (tc = thread_queue.tq_first; tc; tc = tc->tc_queue_link)
+	if (thread_ready(tc, now))
+	    return 1;
+    return 0;
+}
+
+// The thread that the message just received from 'from' is for, if any.
+static struct thread_context *
+thread_ipc_target(envid_t from, size_t npages) {
+    struct thread_context *tc, *oldest = NULL;
+    physaddr_t pa = npages ? PTE_ADDR(uvpt[PGNUM(THREAD_RECVVA)]) : 0;
+
+    for (tc = cur_tc; tc; tc = (tc == cur_tc ? thread_queue.tq_first
+				: tc->tc_queue_link)) {
+	if (tc->tc_ipc_from != from || tc->tc_ipc_done)
+	    continue;
+	if (pa && tc->tc_req && PTE_ADDR(uvpt[PGNUM(tc->tc_req)]) == pa)
+	    return tc;
+	if (!oldest || (int32_t) (tc->tc_ipc_seq - oldest->tc_ipc_seq) < 0)
+	    oldest = tc;
+    }
+    return oldest;
+}
+
+// Called when no thread is ready: receive the next IPC message for the
+// environment and hand it to the thread waiting for it, or give up when
+// the earliest thread_wait deadline comes around.
+static void
+thread_dispatch(void) {
+    struct thread_context *tc;
+    uint32_t now = sys_time_msec(), timeout = 0;
+    size_t npages, i;
+    uintptr_t va;
+    bool echo;
+    int r;
+
+    for (tc = thread_queue.tq_first; tc; tc = tc->tc_queue_link)
+	if (tc->tc_waiting && tc->tc_wait_until != (uint32_t)~0
+	    && (!timeout || tc->tc_wait_until - now < timeout))
+	    timeout = tc->tc_wait_until - now;
+
+    r = sys_notify_wait(0, 1, (void *) THREAD_RECVVA, THREAD_RECV_MAXPAGES,
+			timeout);
+    if (r == -E_TIMEOUT)
+	return;
+    if (r < 0)
+	panic("thread_dispatch: %e", r);
+
+    npages = thisenv->env_ipc_npages;
+    if (!(tc = thread_ipc_target(thisenv->env_ipc_from, npages)))
+	cprintf("thread: dropping IPC %d from %08x\n",
+		thisenv->env_ipc_value, thisenv->env_ipc_from);
+    // A request page sent back is already mapped where its thread wants it.
+    echo = tc && tc->tc_req && npages
+	&& PTE_ADDR(uvpt[PGNUM(tc->tc_req)])
+	   == PTE_ADDR(uvpt[PGNUM(THREAD_RECVVA)]);
+
+    for (i = 0; i < npages; i++) {
+	va = THREAD_RECVVA + i * PGSIZE;
+	if (tc && !echo && tc->tc_ipc_pg && i < tc->tc_ipc_maxpages)
+	    sysring_push(SYS_page_map, 0, 0, va, 0,
+			 (uint64_t) tc->tc_ipc_pg + i * PGSIZE,
+			 uvpt[PGNUM(va)] & PTE_SYSCALL);
+	sysring_push(SYS_page_unmap, 0, 0, va, 0, 0, 0);
+    }
+    if ((r = sysring_submit()) < 0)
+	panic("thread_dispatch: %e", r);
+
+    if (tc) {
+	tc->tc_ipc_value = thisenv->env_ipc_value;
+	tc->tc_ipc_npages = (echo || !tc->tc_ipc_pg) ? 0
+	    : MIN(npages, tc->tc_ipc_maxpages);
+	tc->tc_ipc_done = 1;
+    }
+}
+
+// Like ipc_recvv, but waits for a message from 'from' and lets the
+// other threads run in the meantime.  Messages that no thread is
+// waiting for are dropped.
+int32_t
+thread_ipc_recv(envid_t from, void *pg, size_t maxpages,
+		size_t *npages_store) {
+    if (!cur_tc)
+	return ipc_recvv(NULL, pg, maxpages, npages_store);
+
+    assert(maxpages <= THREAD_RECV_MAXPAGES);
+    cur_tc->tc_ipc_from = from;
+    cur_tc->tc_ipc_seq = ipc_seq++;
+    cur_tc->tc_ipc_pg = pg;
+    cur_tc->tc_ipc_maxpages = maxpages;
+    cur_tc->tc_ipc_done = 0;
+    while (!cur_tc->tc_ipc_done) {
+	if (thread_others_ready())
+	    thread_yield();
+	else
+	    thread_dispatch();
+    }
+    cur_tc->tc_ipc_from = 0;
+
+    if (npages_store)
+	*npages_store = cur_tc->tc_ipc_npages;
+    return cur_tc->tc_ipc_value;
+}
+
+// Send request 'type' with the page at 'req' to server 'to' and wait
+// for the reply, letting the other threads run.  The server writes its
+// reply back into the request page, which is copied back to 'req'; a
+// page the server sends instead is mapped at 'dstva' if it is nonzero.
+// Returns the server's reply value.
+//
+// The request goes in this thread's own page, so other threads may
+// reuse 'req' for their own requests in the meantime.
+int32_t
+thread_ipc_call(envid_t to, uint32_t type, void *req, void *dstva) {
+    int32_t r;
+    int i;
+
+    if (!cur_tc->tc_req) {
+	for (i = 0; i < THREAD_MAXREQ && req_used[i]; i++)
+	    /* do nothing */;
+	if (i == THREAD_MAXREQ)
+	    return -E_NO_MEM;
+	cur_tc->tc_req = (void *) (uintptr_t) (THREAD_REQVA + i * PGSIZE);
+	if ((r = sys_page_alloc(0, cur_tc->tc_req, PTE_P|PTE_U|PTE_W)) < 0) {
+	    cur_tc->tc_req = NULL;
+	    return r;
+	}
+	req_used[i] = 1;
+    }
+
+    memmove(cur_tc->tc_req, req, PGSIZE);
+    ipc_send(to, type, cur_tc->tc_req, PTE_P|PTE_W|PTE_U);
+    r = thread_ipc_recv(to, dstva, dstva ? 1 : 0, NULL);
+    memmove(req, cur_tc->tc_req, PGSIZE);
+    return r;
+}
@@ -1,14 +1,11 @@
 #line 2 "../lib/wait.c"
 #include <inc/lib.h>
 
-// Waits until 'envid' exits.
-void
+// Waits until 'envid' exits.  Returns 0, or < 0 without blocking if
+// 'envid' is already gone.  Use sys_env_wait for the exit status.
+int
 wait(envid_t envid)
 {
-	const volatile struct Env *e;
-
 	assert(envid != 0);
-	e = &envs[ENVX(envid)];
-	while (e->env_id == envid && e->env_status != ENV_FREE)
-		sys_yield();
+	return sys_env_wait(envid, NULL);
 }
@@ -1,7 +1,49 @@
 #line 2 "../net/input.c"
 #include "ns.h"
 
-extern union Nsipc nsipcbuf;
+static struct InputRing *ring = (struct InputRing *) INPUTRINGVA;
+
+static struct jif_pkt *
+input_ring_slot(uint32_t i)
+{
+    return (struct jif_pkt *) (INPUTRINGVA + (1 + (uintptr_t) i % INPUT_RING_SIZE) * PGSIZE);
+}
+
+// Allocate the input ring, shared with any children forked afterwards.
+void
+input_ring_init(void)
+{
+    uintptr_t i;
+    int r;
+
+    for (i = 0; i < 1 + INPUT_RING_SIZE; i++)
+        if ((r = sys_page_alloc(0, (void *) (INPUTRINGVA + i * PGSIZE),
+                                PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+            panic("input_ring_init: %e", r);
+    ring->ir_head = ring->ir_tail = 0;
+}
+
+// Return the oldest packet in the input ring, or NULL if it is empty.
+struct jif_pkt *
+input_ring_peek(void)
+{
+    if (ring->ir_head == ring->ir_tail)
+        return NULL;
+    __sync_synchronize();
+    return input_ring_slot(ring->ir_head);
+}
+
+// Release the packet returned by input_ring_peek.  Returns true if the
+// ring was full, in which case the input env may be waiting for room.
+bool
+input_ring_pop(void)
+{
+    bool full = (ring->ir_tail - ring->ir_head == INPUT_RING_SIZE);
+
+    __sync_synchronize();
+    ring->ir_head++;
+    return full;
+}
 
     void
 input(envid_t ns_envid)
@@ -10,16 +52,26 @@ input(envid_t ns_envid)
 #line 11 "../net/input.c"
     while (1) {
         int r;
-        if ((r = sys_page_alloc(0, &nsipcbuf, PTE_P|PTE_U|PTE_W)) < 0)
-            panic("sys_page_alloc: %e", r);
-        r = sys_net_receive(nsipcbuf.pkt.jp_data, 1518);
+        struct jif_pkt *pkt;
+
+        // Wait for the parent to make room in the ring.  The parent
+        // sends NSNOTIFY_ROOM whenever it pops from a full ring, so the
+        // bit is pending if it did so since the check.
+        while (ring->ir_tail - ring->ir_head == INPUT_RING_SIZE)
+            notify_wait(NSNOTIFY_ROOM);
+
+        pkt = input_ring_slot(ring->ir_tail);
+        r = sys_net_receive(pkt->jp_data, 1518);
         if (r == 0) {
             sys_yield();
         } else if (r < 0) {
             cprintf("Failed to receive packet: %e\n", r);
         } else if (r > 0) {
-            nsipcbuf.pkt.jp_len = r;
-            ipc_send(ns_envid, NSREQ_INPUT, &nsipcbuf, PTE_U|PTE_P);
+            pkt->jp_len = r;
+            __sync_synchronize();
+            ring->ir_tail++;
+            if ((r = sys_notify(ns_envid, NSNOTIFY_INPUT)) < 0)
+                panic("sys_notify: %e", r);
         }
     }
 #line 26 "../net/input.c"
@@ -2,7 +2,7 @@
 #include <inc/lib.h>
 
 #include <lwip/sys.h>
-#include <arch/thread.h>
+#include <inc/thread.h>
 #include <arch/cc.h>
 #include <arch/sys_arch.h>
 #include <arch/perror.h>
@@ -9,13 +9,33 @@
 #define TIMER_INTERVAL 250
 
 // Virtual address at which to receive page mappings containing client requests.
+// Each of the QUEUE_SIZE slots is a request page followed by room for the
+// data pages of a bulk request.  The slots live above the malloc arena.
 #define QUEUE_SIZE	20
-#define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
+#define SLOTPAGES	(1 + NSBULK_MAXPAGES)
+#define REQVA		0xB0000000
+
+// Received packets travel from the input environment to its parent
+// through a ring of INPUT_RING_SIZE packet pages shared at INPUTRINGVA,
+// after a header page holding the ring indices.  The parent sets the
+// ring up with input_ring_init before forking the input environment,
+// and drains it with input_ring_peek/input_ring_pop on NSNOTIFY_INPUT.
+// When the ring fills, the input environment waits for NSNOTIFY_ROOM.
+#define INPUT_RING_SIZE	16
+#define INPUTRINGVA	0xA0000000
+
+struct InputRing {
+	volatile uint32_t ir_head;	// Next packet for the parent to take
+	volatile uint32_t ir_tail;	// Next slot for the input env to fill
+};
 
 /* timer.c */
 void timer(envid_t ns_envid, uint32_t initial_to);
 
 /* input.c */
+void input_ring_init(void);
+struct jif_pkt *input_ring_peek(void);
+bool input_ring_pop(void);
 void input(envid_t ns_envid);
 
 /* output.c */
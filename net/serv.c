@@ -11,7 +11,7 @@
 #include <inc/lib.h>
 
 #include <arch/perror.h>
-#include <arch/thread.h>
+#include <inc/thread.h>
 #include <lwip/sockets.h>
 #include <lwip/netif.h>
 #include <lwip/stats.h>
@@ -65,7 +65,7 @@ get_buffer(void) {
         return 0;
     }
 
-    va = (void *)(REQVA + i * PGSIZE);
+    va = (void *)(REQVA + i * SLOTPAGES * PGSIZE);
     buse[i] = 1;
 
     return va;
@@ -73,7 +73,7 @@ get_buffer(void) {
 
 static void
 put_buffer(void *va) {
-    int64_t i = ((uint64_t)va - REQVA) / PGSIZE;
+    int64_t i = ((uint64_t)va - REQVA) / (SLOTPAGES * PGSIZE);
     buse[i] = 0;
 }
 
@@ -162,32 +162,62 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 }
 
 static void
-process_timer(envid_t envid) {
-    uint32_t start, now, to;
-
-    if (envid != timer_envid) {
-        cprintf("NS: received timer interrupt from envid %x not timer env\n", envid);
-        return;
-    }
-
-    start = sys_time_msec();
+process_timer(void) {
+    // Let the lwIP timer threads run.
     thread_yield();
-    now = sys_time_msec();
+}
 
-    to = TIMER_INTERVAL - (now - start);
-    ipc_send(envid, to, 0, 0);
+static void
+process_input(void) {
+    struct jif_pkt *pkt;
+    bool wake = 0;
+    int r;
+
+    while ((pkt = input_ring_peek()) != NULL) {
+        jif_input(&nif, pkt);
+        wake |= input_ring_pop();
+    }
+    if (wake && (r = sys_notify(input_envid, NSNOTIFY_ROOM)) < 0)
+        panic("sys_notify: %e", r);
 }
 
 struct st_args {
     int32_t reqno;
     uint32_t whom;
     union Nsipc *req;
+    size_t npages;
 };
 
+// Receive up to req->recv.req_len bytes (up to NSBULK_MAXPAGES pages)
+// into freshly allocated pages following the request page, storing the
+// number of pages to send back in *npages_store.
+static int
+recv_bulk(union Nsipc *req, size_t *npages_store)
+{
+    char *data = (char *)req + PGSIZE;
+    size_t n, i;
+    int r;
+
+    *npages_store = 0;
+    if (req->recv.req_len < 0)
+        return -E_INVAL;
+    n = MIN((size_t)req->recv.req_len, NSBULK_MAXPAGES * PGSIZE);
+    for (i = 0; i < ROUNDUP(n, PGSIZE) / PGSIZE; i++)
+        if ((r = sys_page_alloc(0, data + i * PGSIZE, PTE_P|PTE_U|PTE_W)) < 0)
+            return r;
+
+    r = lwip_recv(req->recv.req_s, data, n, req->recv.req_flags);
+    if (r > 0)
+        *npages_store = ROUNDUP(r, PGSIZE) / PGSIZE;
+    return r;
+}
+
 static void
 serve_thread(uint64_t a) {
     struct st_args *args = (struct st_args *)a;
     union Nsipc *req = args->req;
+    struct IpcPage reply[NSBULK_MAXPAGES];
+    size_t nreply = 0, i;
     int r;
 
     switch (args->reqno) {
@@ -226,14 +256,22 @@ serve_thread(uint64_t a) {
             r = lwip_send(req->send.req_s, &req->send.req_buf,
                     req->send.req_size, req->send.req_flags);
             break;
+        case NSREQ_SEND_BULK:
+            if (req->send.req_size < 0
+                || req->send.req_size > (args->npages - 1) * PGSIZE) {
+                r = -E_INVAL;
+                break;
+            }
+            r = lwip_send(req->send.req_s, (char *)req + PGSIZE,
+                    req->send.req_size, req->send.req_flags);
+            break;
+        case NSREQ_RECV_BULK:
+            r = recv_bulk(req, &nreply);
+            break;
         case NSREQ_SOCKET:
             r = lwip_socket(req->socket.req_domain, req->socket.req_type,
                     req->socket.req_protocol);
             break;
-        case NSREQ_INPUT:
-            jif_input(&nif, (void *)&req->pkt);
-            r = 0;
-            break;
         default:
             cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
             r = -E_INVAL;
@@ -246,11 +284,21 @@ serve_thread(uint64_t a) {
         perror(buf);
     }
 
-    if (args->reqno != NSREQ_INPUT)
-        ipc_send(args->whom, r, 0, 0);
+    if (nreply > 0) {
+        for (i = 0; i < nreply; i++) {
+            reply[i].ip_va = (char *)req + (1 + i) * PGSIZE;
+            reply[i].ip_perm = PTE_P|PTE_U|PTE_W;
+        }
+        ipc_sendv(args->whom, r, reply, nreply);
+    } else
+        // Send the request page back so that a client with several
+        // requests outstanding (see thread_ipc_call) can tell which
+        // one this answers.
+        ipc_send(args->whom, r, req, PTE_P|PTE_U|PTE_W);
 
     put_buffer(args->req);
-    sys_page_unmap(0, (void*) args->req);
+    for (i = 0; i < SLOTPAGES; i++)
+        sys_page_unmap(0, (char *)args->req + i * PGSIZE);
     free(args);
 }
 
@@ -258,7 +306,9 @@ void
 serve(void) {
     int32_t reqno;
     uint32_t whom;
-    int i, perm;
+    int i;
+    size_t npages;
+    uint64_t bits;
     void *va;
 
     while (1) {
@@ -268,22 +318,25 @@ serve(void) {
         for (i = 0; thread_wakeups_pending() && i < 32; ++i)
             thread_yield();
 
-        perm = 0;
         va = get_buffer();
-        reqno = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+        reqno = ipc_recv_notify((int32_t *) &whom, (void *) va, SLOTPAGES,
+                &npages, NSNOTIFY_TIMER | NSNOTIFY_INPUT, &bits);
         if (debug) {
-            cprintf("ns req %d from %08x\n", reqno, whom);
+            cprintf("ns req %d from %08x bits %llx\n", reqno, whom, bits);
         }
 
-        // first take care of requests that do not contain an argument page
-        if (reqno == NSREQ_TIMER) {
-            process_timer(whom);
+        // first take care of notifications, which carry no request
+        if (bits) {
+            if (bits & NSNOTIFY_INPUT)
+                process_input();
+            if (bits & NSNOTIFY_TIMER)
+                process_timer();
             put_buffer(va);
             continue;
         }
 
         // All remaining requests must contain an argument page
-        if (!(perm & PTE_P)) {
+        if (npages == 0) {
             cprintf("Invalid request from %08x: no argument page\n", whom);
             continue; // just leave it hanging...
         }
@@ -297,6 +350,7 @@ serve(void) {
         args->reqno = reqno;
         args->whom = whom;
         args->req = va;
+        args->npages = npages;
 
         thread_create(0, "serve_thread", serve_thread, (uint64_t)args);
         thread_yield(); // let the thread created run
@@ -318,6 +372,9 @@ umain(int argc, char **argv)
 
     binaryname = "ns";
 
+    // the input ring must exist before the input thread is forked
+    input_ring_init();
+
     // fork off the timer thread which will send us periodic messages
     timer_envid = fork();
     if (timer_envid < 0)
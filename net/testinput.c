@@ -81,6 +81,7 @@ umain(int argc, char **argv)
         return;
     }
 
+    input_ring_init();
     input_envid = fork();
     if (input_envid < 0)
         panic("error forking");
@@ -93,24 +94,19 @@ umain(int argc, char **argv)
     announce();
 
     while (1) {
-        envid_t whom;
-        int perm;
-
-        int32_t req = ipc_recv((int32_t *)&whom, pkt, &perm);
-        if (req < 0)
-            panic("ipc_recv: %e", req);
-        if (whom != input_envid)
-            panic("IPC from unexpected environment %08x", whom);
-        if (req != NSREQ_INPUT)
-            panic("Unexpected IPC %d", req);
-
-        hexdump("input: ", pkt->jp_data, pkt->jp_len);
-        cprintf("\n");
-
-        // Only indicate that we're waiting for packets once
-        // we've received the ARP reply
-        if (first)
-            cprintf("Waiting for packets...\n");
-        first = 0;
+        struct jif_pkt *in;
+
+        notify_wait(NSNOTIFY_INPUT);
+        while ((in = input_ring_peek()) != NULL) {
+            hexdump("input: ", in->jp_data, in->jp_len);
+            cprintf("\n");
+            input_ring_pop();
+
+            // Only indicate that we're waiting for packets once
+            // we've received the ARP reply
+            if (first)
+                cprintf("Waiting for packets...\n");
+            first = 0;
+        }
     }
 }
@@ -15,19 +15,11 @@ timer(envid_t ns_envid, uint32_t initial_to) {
         if (r < 0)
             panic("sys_time_msec: %e", r);
 
-        ipc_send(ns_envid, NSREQ_TIMER, 0, 0);
+        // Notifications merge, so a busy server sees one tick rather
+        // than a backlog, and we never wait for it to catch up.
+        if ((r = sys_notify(ns_envid, NSNOTIFY_TIMER)) < 0)
+            panic("sys_notify: %e", r);
 
-        while (1) {
-            uint32_t to, whom;
-            to = ipc_recv((int32_t *) &whom, 0, 0);
-
-            if (whom != ns_envid) {
-                cprintf("NS TIMER: timer thread got IPC message from env %x not NS\n", whom);
-                continue;
-            }
-
-            stop = sys_time_msec() + to;
-            break;
-        }
+        stop += TIMER_INTERVAL;
     }
 }
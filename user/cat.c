@@ -26,7 +26,7 @@ umain(int argc, char **argv)
 		cat(0, "<stdin>");
 	else
 		for (i = 1; i < argc; i++) {
-			f = open(argv[i], O_RDONLY);
+			f = open(argv[i], O_RDONLY|O_BUFFERED);
 			if (f < 0)
 				printf("can't open %s: %e\n", argv[i], f);
 			else {
@@ -78,20 +78,17 @@ static int
 send_data(struct http_request *req, int fd)
 {
 #line 81 "../user/httpd.c"
-	char buf[256];
 	int n;
 
+	// splice hands the file's pages to the network server directly.
 	for (;;) {
-		n = read(fd, buf, sizeof(buf));
+		n = splice(fd, req->sock, 64 * PGSIZE);
 		if (n < 0) {
-			cprintf("send_data: read failed: %e\n", n);
+			cprintf("send_data: splice failed: %e\n", n);
 			return n;
 		} else if (n == 0) {
 			return 0;
 		}
-
-		if (write(req->sock, buf, n) != n)
-			die("Failed to sent file to client");
 	}
 #line 100 "../user/httpd.c"
 }
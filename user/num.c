@@ -35,7 +35,7 @@ umain(int argc, char **argv)
 		num(0, "<stdin>");
 	else
 		for (i = 1; i < argc; i++) {
-			f = open(argv[i], O_RDONLY);
+			f = open(argv[i], O_RDONLY|O_BUFFERED);
 			if (f < 0)
 				panic("can't open %s: %e", argv[i], f);
 			else {
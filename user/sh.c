@@ -53,7 +53,7 @@ again:
 				exit();
 			}
 #line 57 "../user/sh.c"
-			if ((fd = open(t, O_RDONLY)) < 0) {
+			if ((fd = open(t, O_RDONLY|O_BUFFERED)) < 0) {
 				cprintf("open %s for read: %e", t, fd);
 				exit();
 			}
@@ -164,8 +164,10 @@ runit:
 		cprintf("\n");
 	}
 
-	// Spawn the command!
-	if ((r = spawn(argv[0], (const char**) argv)) < 0)
+	// Spawn the command!  Commands run from a template after the first
+	// time, which saves reading them from the file system again, until
+	// their file changes.
+	if ((r = spawn_template(argv[0], (const char**) argv)) < 0)
 		cprintf("spawn %s: %e\n", argv[0], r);
 
 	// In the parent, close all file descriptors and wait for the
@@ -316,12 +318,16 @@ umain(int argc, char **argv)
 		usage();
 	if (argc == 2) {
 		close(0);
-		if ((r = open(argv[1], O_RDONLY)) < 0)
+		if ((r = open(argv[1], O_RDONLY|O_BUFFERED)) < 0)
 			panic("open %s: %e", argv[1], r);
 		assert(r == 0);
 	}
 	if (interactive == '?')
 		interactive = iscons(0);
+	// Set up the template table before forking any commands, so that
+	// they share it; without it every command is spawned from disk.
+	if ((r = spawn_template_init()) < 0)
+		cprintf("spawn_template_init: %e\n", r);
 
 	while (1) {
 		char *buf;
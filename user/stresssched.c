@@ -20,7 +20,8 @@ umain(int argc, char **argv)
 	}
 
 	// Wait for the parent to finish forking
-	while (envs[ENVX(parent)].env_status != ENV_FREE)
+	while (envs[ENVX(parent)].env_status != ENV_FREE
+	       && envs[ENVX(parent)].env_status != ENV_ZOMBIE)
 		asm volatile("pause");
 
 	// Check that one environment doesn't run on two CPUs at once
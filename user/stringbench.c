@@ -0,0 +1,114 @@
+// Time the string routines against plain byte loops, and check that
+// they agree, for a few sizes and alignments.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NITER	2000
+#define BUFSIZE	(2 * PGSIZE)
+
+static char src[BUFSIZE + 64], dst[BUFSIZE + 64];
+
+static void *
+byte_memmove(void *d, const void *s, size_t n)
+{
+	volatile char *dp = d;
+	const char *sp = s;
+
+	while (n-- > 0)
+		*dp++ = *sp++;
+	return d;
+}
+
+static void *
+byte_memset(void *v, int c, size_t n)
+{
+	volatile char *p = v;
+
+	while (n-- > 0)
+		*p++ = c;
+	return v;
+}
+
+static int
+byte_memcmp(const void *v1, const void *v2, size_t n)
+{
+	const volatile uint8_t *s1 = v1, *s2 = v2;
+
+	for (; n > 0; n--, s1++, s2++)
+		if (*s1 != *s2)
+			return (int) *s1 - (int) *s2;
+	return 0;
+}
+
+static int
+byte_strlen(const char *s)
+{
+	const volatile char *p = s;
+
+	while (*p)
+		p++;
+	return p - s;
+}
+
+// Print the cycles per call of 'fast' and 'slow' for 'what' on n bytes
+// at offset 'off'.
+#define BENCH(what, n, off, fast, slow)					\
+	do {								\
+		uint64_t t0, t1, t2;					\
+		int i;							\
+		t0 = read_tsc();					\
+		for (i = 0; i < NITER; i++)				\
+			fast;						\
+		t1 = read_tsc();					\
+		for (i = 0; i < NITER; i++)				\
+			slow;						\
+		t2 = read_tsc();					\
+		cprintf("  %-8s %5d +%d: %7ld cycles, bytewise %7ld\n",	\
+			what, n, off, (long) ((t1 - t0) / NITER),	\
+			(long) ((t2 - t1) / NITER));			\
+	} while (0)
+
+void
+umain(int argc, char **argv)
+{
+	static const int sizes[] = { 16, 64, 256, 4096 };
+	static const int offs[] = { 0, 3 };
+	int i, j, n, off;
+
+	for (i = 0; i < BUFSIZE + 64; i++)
+		src[i] = 'a' + i % 26;
+	src[BUFSIZE + 63] = 0;
+
+	cprintf("stringbench: %d calls each\n", NITER);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		for (j = 0; j < sizeof(offs) / sizeof(offs[0]); j++) {
+			n = sizes[i];
+			off = offs[j];
+
+			BENCH("memmove", n, off, memmove(dst + off, src, n),
+			      byte_memmove(dst + off, src, n));
+			if (memcmp(dst + off, src, n) != 0)
+				panic("memmove %d +%d is wrong", n, off);
+			memmove(dst + 1, dst, n);
+			if (byte_memcmp(dst + off + 1, src, n - off) != 0)
+				panic("overlapping memmove %d +%d is wrong", n, off);
+
+			BENCH("memset", n, off, memset(dst + off, 'x', n),
+			      byte_memset(dst + off, 'x', n));
+			if (memfind(dst + off, 'y', n) != dst + off + n)
+				panic("memset %d +%d is wrong", n, off);
+
+			memmove(dst + off, src, n);
+			BENCH("memcmp", n, off, memcmp(dst + off, src, n),
+			      byte_memcmp(dst + off, src, n));
+			dst[off + n - 1] = 0;
+			if (memcmp(dst + off, src, n) >= 0)
+				panic("memcmp %d +%d is wrong", n, off);
+
+			BENCH("strlen", n, off, strlen(dst + off),
+			      byte_strlen(dst + off));
+			if (strlen(dst + off) != n - 1)
+				panic("strlen %d +%d is wrong", n, off);
+		}
+}
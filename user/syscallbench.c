@@ -0,0 +1,69 @@
+// Measure the cost of a null system call through the SYSCALL fast path
+// and through the "int $T_SYSCALL" trap gate, after checking that the
+// fast path passes all five arguments and gives the same answers.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCALLS 100000
+
+static uint64_t
+int_getenvid(void)
+{
+	uint64_t ret;
+
+	asm volatile("int %1\n"
+		     : "=a" (ret)
+		     : "i" (T_SYSCALL), "a" (SYS_getenvid)
+		     : "cc", "memory");
+	return ret;
+}
+
+// sys_page_map takes five arguments, the second of them in R10.
+static void
+check_args(void)
+{
+	char *a = (char *) UTEMP, *b = (char *) UTEMP + PGSIZE;
+	int r;
+
+	if (int_getenvid() != sys_getenvid())
+		panic("syscallbench: the two paths disagree on the envid");
+	if ((r = sys_page_alloc(0, a, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	strcpy(a, "syscallbench");
+	if ((r = sys_page_map(0, a, 0, b, PTE_P|PTE_U)) < 0)
+		panic("sys_page_map: %e", r);
+	if (strcmp(b, "syscallbench") != 0 || (uvpt[PGNUM(b)] & PTE_W))
+		panic("syscallbench: sys_page_map got its arguments wrong");
+	sys_page_unmap(0, a);
+	sys_page_unmap(0, b);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, fast, slow;
+	int i;
+
+	check_args();
+
+	// Warm up both paths.
+	for (i = 0; i < 1000; i++) {
+		sys_getenvid();
+		int_getenvid();
+	}
+
+	start = read_tsc();
+	for (i = 0; i < NCALLS; i++)
+		sys_getenvid();
+	fast = read_tsc() - start;
+
+	start = read_tsc();
+	for (i = 0; i < NCALLS; i++)
+		int_getenvid();
+	slow = read_tsc() - start;
+
+	cprintf("syscallbench: %d calls\n", NCALLS);
+	cprintf("  syscall/sysret: %ld cycles/call\n", (long) (fast / NCALLS));
+	cprintf("  int/iret:       %ld cycles/call\n", (long) (slow / NCALLS));
+}
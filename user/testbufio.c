@@ -0,0 +1,94 @@
+// Test O_BUFFERED files: reads must see buffered writes across seeks,
+// and envs sharing the fd through fork or dup must share one buffer.
+
+#include <inc/lib.h>
+
+#define TESTFILE	"/testbufio"
+
+char buf[512];
+
+// Read strlen(want) bytes at 'off' of fd and check that they are 'want'.
+static void
+check(int fd, off_t off, const char *want)
+{
+	int n, len = strlen(want);
+
+	seek(fd, off);
+	if ((n = readn(fd, buf, len)) != len)
+		panic("read %d bytes at %d, got %d", len, off, n);
+	buf[len] = 0;
+	if (strcmp(buf, want) != 0)
+		panic("read at %d got \"%s\", want \"%s\"", off, buf, want);
+}
+
+static void
+writes(int fd, off_t off, const char *s)
+{
+	int n, len = strlen(s);
+
+	seek(fd, off);
+	if ((n = write(fd, s, len)) != len)
+		panic("write %d bytes at %d, wrote %d", len, off, n);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int fd, fd2, r;
+
+	if ((fd = open(TESTFILE, O_RDWR|O_CREAT|O_TRUNC|O_BUFFERED)) < 0)
+		panic("open %s: %e", TESTFILE, fd);
+
+	// Contiguous writes collect in the buffer; a read flushes them.
+	writes(fd, 0, "hello, world");
+	if ((r = write(fd, " again", 6)) != 6)
+		panic("write: %e", r);
+	check(fd, 0, "hello, world again");
+	writes(fd, 7, "WORLD");
+	check(fd, 0, "hello, WORLD again");
+	// A read past EOF returns nothing.
+	seek(fd, 1000);
+	if ((r = read(fd, buf, sizeof buf)) != 0)
+		panic("read past EOF got %d", r);
+	cprintf("seek ok\n");
+
+	// Leave a write buffered and fork: the child shares the buffer.
+	writes(fd, 100, "parent");
+	if ((r = fork()) < 0)
+		panic("fork: %e", r);
+	if (r == 0) {
+		check(fd, 100, "parent");
+		writes(fd, 200, "child");
+		exit();
+	}
+	wait(r);
+	check(fd, 200, "child");
+	check(fd, 100, "parent");
+	cprintf("fork ok\n");
+
+	// A dup shares the fd, buffer and all.
+	if ((fd2 = dup(fd, 10)) < 0)
+		panic("dup: %e", fd2);
+	writes(fd2, 300, "dup");
+	check(fd, 300, "dup");
+	writes(fd, 400, "orig");
+	check(fd2, 400, "orig");
+	close(fd2);
+	check(fd, 0, "hello, WORLD again");
+	cprintf("dup ok\n");
+
+	// After fsync, an unbuffered fd sees every write.
+	if ((r = fsync(fd)) < 0)
+		panic("fsync: %e", r);
+	if ((fd2 = open(TESTFILE, O_RDONLY)) < 0)
+		panic("open %s: %e", TESTFILE, fd2);
+	check(fd2, 0, "hello, WORLD again");
+	check(fd2, 100, "parent");
+	check(fd2, 200, "child");
+	check(fd2, 300, "dup");
+	check(fd2, 400, "orig");
+	close(fd2);
+	close(fd);
+
+	cprintf("testbufio: OK\n");
+}
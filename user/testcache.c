@@ -0,0 +1,82 @@
+// Check the file server's block cache counters: the cache never holds
+// more blocks than its budget, rereads hit, and (with a budget small
+// enough to overflow, as after 'make BCPAGES=64') blocks evicted while
+// dirty come back from disk intact.
+
+#include <inc/lib.h>
+
+#define SMALLFILE	64	// Blocks
+
+static uint8_t blk[BLKSIZE];
+
+static void
+cachestat(struct CacheStat *cs)
+{
+	int r;
+
+	if ((r = fs_cachestat(cs)) < 0)
+		panic("fs_cachestat: %e", r);
+	if (cs->cs_resident > cs->cs_budget)
+		panic("%d blocks cached, over the budget of %d",
+		      cs->cs_resident, cs->cs_budget);
+}
+
+static void
+fill(uint32_t b)
+{
+	memset(blk, b & 0xFF, BLKSIZE);
+	*(uint32_t *) blk = b;
+}
+
+// Write 'nblocks' numbered blocks to 'path', then read them back twice.
+static void
+write_and_check(const char *path, uint32_t nblocks)
+{
+	uint32_t b;
+	int fd, pass, r;
+
+	if ((fd = open(path, O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open %s: %e", path, fd);
+	for (b = 0; b < nblocks; b++) {
+		fill(b);
+		if ((r = write(fd, blk, BLKSIZE)) != BLKSIZE)
+			panic("write block %d: %e", b, r);
+	}
+	for (pass = 0; pass < 2; pass++) {
+		seek(fd, 0);
+		for (b = 0; b < nblocks; b++) {
+			if ((r = readn(fd, blk, BLKSIZE)) != BLKSIZE)
+				panic("read block %d: %e", b, r);
+			if (*(uint32_t *) blk != b
+			    || blk[BLKSIZE - 1] != (b & 0xFF))
+				panic("block %d came back as %d", b,
+				      *(uint32_t *) blk);
+		}
+	}
+	close(fd);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct CacheStat before, after;
+
+	cachestat(&before);
+	write_and_check("/cachetest", SMALLFILE);
+	cachestat(&after);
+	if (after.cs_hits - before.cs_hits < SMALLFILE)
+		panic("rereading %d cached blocks hit only %d times",
+		      SMALLFILE, (int) (after.cs_hits - before.cs_hits));
+
+	if (after.cs_budget < 1024) {
+		before = after;
+		write_and_check("/cachetest", after.cs_budget + SMALLFILE);
+		cachestat(&after);
+		if (after.cs_evictions == before.cs_evictions)
+			panic("overflowing the cache evicted nothing");
+	} else
+		cprintf("testcache: budget %d too big to overflow, "
+			"skipping eviction\n", after.cs_budget);
+	remove("/cachetest");
+	cprintf("testcache: OK\n");
+}
@@ -0,0 +1,52 @@
+// Check that the clock page gives a time that never goes backwards,
+// keeps going across context switches, and agrees with sys_time_msec.
+
+#include <inc/lib.h>
+
+#define NREADS	2000
+#define SLACK	10	// Milliseconds clock_ns may be off sys_time_msec
+
+static void
+check_agrees(void)
+{
+	int64_t diff = (int64_t) (clock_ns() / 1000000) - sys_time_msec();
+
+	if (diff < -SLACK || diff > SLACK)
+		panic("clock_ns is %ld ms off sys_time_msec", (long) diff);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t last, now, start;
+	unsigned msec;
+	int i;
+
+	if (uvpt[PGNUM(UCLOCK)] & PTE_W)
+		panic("the clock page is writable");
+	if (!clockpage.cp_mult)
+		cprintf("testclock: TSC not calibrated, testing the fallback\n");
+
+	last = clock_ns();
+	for (i = 0; i < NREADS; i++) {
+		if (i % 100 == 0)
+			sys_yield();
+		if ((now = clock_ns()) < last)
+			panic("clock_ns went back from %ld to %ld",
+			      (long) last, (long) now);
+		last = now;
+	}
+	check_agrees();
+
+	// Spin across several timer ticks, and so several rebases.
+	start = clock_ns();
+	msec = sys_time_msec();
+	while (sys_time_msec() < msec + 100)
+		sys_yield();
+	now = clock_ns();
+	if (now - start < 100 * 1000000ULL - SLACK * 1000000ULL)
+		panic("clock_ns only moved %ld ns in 100 ms",
+		      (long) (now - start));
+	check_agrees();
+	cprintf("testclock: OK\n");
+}
@@ -0,0 +1,59 @@
+// Check that system calls reading or writing user memory in place
+// (copy_from_user and copy_to_user) turn bad user pointers into -E_FAULT
+// rather than a kernel fault, stop at the first bad page of a range,
+// and resolve copy-on-write pages.  sys_cputs still kills the caller.
+
+#include <inc/lib.h>
+
+#define MAPPED	((char *) UTEMP)
+#define HOLE	((char *) UTEMP + PGSIZE)	// Left unmapped
+
+static const char rodata[] = "read-only";
+static volatile int cowval = 1;
+
+void
+umain(int argc, char **argv)
+{
+	envid_t self = thisenv->env_id, who;
+	int r, status;
+
+	sys_env_keep_zombies(1);
+	if ((r = sys_page_alloc(0, MAPPED, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+
+	if ((r = sys_env_set_trapframe(self, (struct Trapframe *) HOLE)) != -E_FAULT)
+		panic("sys_env_set_trapframe from a hole returned %e", r);
+	if ((r = sys_env_set_trapframe(self, (struct Trapframe *) KERNBASE)) != -E_FAULT)
+		panic("sys_env_set_trapframe from the kernel returned %e", r);
+	if ((r = sys_ipc_try_sendv(self, 0, (struct IpcPage *) HOLE, 1)) != -E_FAULT)
+		panic("sys_ipc_try_sendv from a hole returned %e", r);
+
+	// A range that runs off the end of the mapped page.
+	if ((r = sys_env_write(self, (uintptr_t) MAPPED, HOLE - 8, 16,
+			       PTE_P|PTE_U|PTE_W)) != -E_FAULT)
+		panic("sys_env_write from a range into a hole returned %e", r);
+	if ((r = sys_env_read(self, (uintptr_t) MAPPED, HOLE - 8, 16)) != -E_FAULT)
+		panic("sys_env_read into a range into a hole returned %e", r);
+	if ((r = sys_env_read(self, (uintptr_t) MAPPED, (void *) rodata, 4)) != -E_FAULT)
+		panic("sys_env_read into read-only data returned %e", r);
+
+	// After fork, cowval is copy-on-write here too.
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		sys_cputs((const char *) HOLE, 8);
+		exit_with(0);
+	}
+	*(volatile int *) MAPPED = 2;
+	if ((r = sys_env_read(self, (uintptr_t) MAPPED, (void *) &cowval,
+			      sizeof cowval)) < 0)
+		panic("sys_env_read into a COW page: %e", r);
+	if (cowval != 2)
+		panic("sys_env_read into a COW page left %d", cowval);
+
+	if ((r = sys_env_wait(who, &status)) < 0)
+		panic("sys_env_wait: %e", r);
+	if (status != -1)
+		panic("sys_cputs from a hole did not kill the child");
+	cprintf("testcopyuser: OK\n");
+}
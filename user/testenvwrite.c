@@ -0,0 +1,53 @@
+// Check sys_env_write and sys_env_read against a forked child: copies
+// across a page boundary into fresh pages, into a copy-on-write page,
+// and the errors for read-only and missing pages.
+
+#include <inc/lib.h>
+
+static char msg[] = "across the page boundary";
+static volatile int shared = 1;		// Copy-on-write after fork
+
+void
+umain(int argc, char **argv)
+{
+	uintptr_t va = (uintptr_t) UTEMP + PGSIZE - 10;
+	char buf[sizeof msg];
+	int val = 2, r;
+	envid_t who;
+
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		ipc_recv(0, 0, 0);
+		if (strcmp((char *) va, msg) != 0)
+			panic("child has \"%s\" at UTEMP", (char *) va);
+		if (shared != 2)
+			panic("child's shared is %d, not 2", shared);
+		return;
+	}
+
+	if ((r = sys_env_write(who, va, msg, sizeof msg,
+			       PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_env_write across pages: %e", r);
+	if ((r = sys_env_read(who, va, buf, sizeof buf)) < 0)
+		panic("sys_env_read across pages: %e", r);
+	if (strcmp(buf, msg) != 0)
+		panic("read back \"%s\"", buf);
+
+	if ((r = sys_env_write(who, (uintptr_t) &shared, &val, sizeof val,
+			       PTE_P|PTE_U|PTE_W)) < 0)
+		panic("sys_env_write to a COW page: %e", r);
+	if (shared != 1)
+		panic("writing the child's COW page changed the parent's");
+
+	if ((r = sys_env_write(who, (uintptr_t) umain, &val, sizeof val,
+			       PTE_P|PTE_U|PTE_W)) != -E_FAULT)
+		panic("sys_env_write to text returned %e, not -E_FAULT", r);
+	if ((r = sys_env_read(who, (uintptr_t) UTEMP + 4 * PGSIZE, buf,
+			      sizeof buf)) != -E_FAULT)
+		panic("sys_env_read of a missing page returned %e", r);
+
+	ipc_send(who, 0, 0, 0);
+	wait(who);
+	cprintf("testenvwrite: OK\n");
+}
@@ -0,0 +1,79 @@
+// Check the file server's deferred write-back: overwritten blocks stay
+// dirty in the cache until fsync or the flush deadline, fsync writes
+// contiguous dirty blocks with fewer disk commands than blocks, and the
+// deadline flushes without any request.
+
+#include <inc/lib.h>
+
+#define NBLOCKS	16
+
+static uint8_t blk[BLKSIZE];
+
+static uint64_t
+disk_writes(void)
+{
+	struct CacheStat cs;
+	int r;
+
+	if ((r = fs_cachestat(&cs)) < 0)
+		panic("fs_cachestat: %e", r);
+	return cs.cs_writes;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t w0, w1, w2;
+	unsigned start;
+	int fd, i, r;
+
+	if ((fd = open("/flushtest", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open: %e", fd);
+	// Lay the file out first: extending a file writes its File block
+	// back at once (see file_set_size).  Then start with nothing dirty,
+	// so that no deadline falls inside the test.
+	memset(blk, 0xFF, BLKSIZE);
+	for (i = 0; i < NBLOCKS; i++)
+		if ((r = write(fd, blk, BLKSIZE)) != BLKSIZE)
+			panic("write: %e", r);
+	fsync(fd);
+
+	// Overwrite it in place.
+	w0 = disk_writes();
+	seek(fd, 0);
+	for (i = 0; i < NBLOCKS; i++) {
+		memset(blk, i, BLKSIZE);
+		if ((r = write(fd, blk, BLKSIZE)) != BLKSIZE)
+			panic("write: %e", r);
+	}
+	w1 = disk_writes();
+	if (w1 != w0)
+		panic("%d blocks written through before any fsync",
+		      (int) (w1 - w0));
+	if ((r = fsync(fd)) < 0)
+		panic("fsync: %e", r);
+	w2 = disk_writes();
+	if (w2 == w1)
+		panic("fsync wrote nothing");
+	if (w2 - w1 >= NBLOCKS)
+		panic("fsync took %d disk writes for %d dirty blocks",
+		      (int) (w2 - w1), NBLOCKS);
+
+	seek(fd, 0);
+	if ((r = readn(fd, blk, BLKSIZE)) != BLKSIZE || blk[0] != 0)
+		panic("first block reads back wrong");
+	seek(fd, 0);
+	memset(blk, 0xAA, BLKSIZE);
+	write(fd, blk, BLKSIZE);
+	start = sys_time_msec();
+	while (disk_writes() == w2) {
+		if (sys_time_msec() - start > 5000)
+			panic("dirty block not written back after 5 s");
+		sys_yield();
+	}
+
+	close(fd);
+	remove("/flushtest");
+	cprintf("testflush: %d disk writes for %d blocks: OK\n",
+		(int) (w2 - w1), NBLOCKS);
+}
@@ -0,0 +1,70 @@
+// Check that each environment keeps its own FPU/SSE registers across
+// context switches, and that fork hands the parent's to the child.
+
+#include <inc/lib.h>
+
+#define NCHILD	4
+#define NROUNDS	200
+
+static void
+check(int id)
+{
+	uint64_t val = id * 0x0101010101010101ULL, out;
+	double x = id, sum = 0;
+	int i;
+
+	// The kernel never touches %xmm7, so only a context switch that
+	// fails to save and restore it can change it.
+	asm volatile("movq %0, %%xmm7" : : "r" (val) : "xmm7");
+	for (i = 0; i < NROUNDS; i++) {
+		sum += x * 0.5;
+		sys_yield();
+		asm volatile("movq %%xmm7, %0" : "=r" (out));
+		if (out != val)
+			panic("env %d: %%xmm7 is %llx, not %llx", id, out, val);
+	}
+	if (sum != id * 0.5 * NROUNDS)
+		panic("env %d: FPU state lost (%d != %d)", id,
+		      (int) sum, (int) (id * 0.5 * NROUNDS));
+}
+
+// The child must start out with the parent's %xmm6.
+static void
+check_fork(void)
+{
+	uint64_t val = 0x0123456789abcdefULL, out;
+	envid_t who;
+
+	asm volatile("movq %0, %%xmm6" : : "r" (val) : "xmm6");
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	asm volatile("movq %%xmm6, %0" : "=r" (out));
+	if (out != val)
+		panic("%s: %%xmm6 is %llx after fork, not %llx",
+		      who ? "parent" : "child", out, val);
+	if (who == 0)
+		exit();
+	wait(who);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t who[NCHILD];
+	int i;
+
+	check_fork();
+
+	for (i = 0; i < NCHILD; i++) {
+		if ((who[i] = fork()) < 0)
+			panic("fork: %e", who[i]);
+		if (who[i] == 0) {
+			check(i + 1);
+			exit();
+		}
+	}
+	check(NCHILD + 1);
+	for (i = 0; i < NCHILD; i++)
+		wait(who[i]);
+	cprintf("testfpu: OK\n");
+}
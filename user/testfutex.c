@@ -0,0 +1,76 @@
+// Check sys_futex_wait and sys_futex_wake on a page shared with forked
+// children: the argument checks, timeouts, wakeups, and waiters woken
+// by the page being unmapped.
+
+#include <inc/lib.h>
+
+#define WORD	((volatile uint32_t *) 0xA0000000)
+
+// Wait until 'who' is blocked in the kernel.
+static void
+await_blocked(envid_t who)
+{
+	while (envs[ENVX(who)].env_status != ENV_NOT_RUNNABLE)
+		sys_yield();
+}
+
+// Fork a child that waits on WORD while it is 0 and exits with what
+// sys_futex_wait returned.
+static envid_t
+fork_waiter(void)
+{
+	envid_t who;
+
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0)
+		exit_with(sys_futex_wait(WORD, 0, 0));
+	await_blocked(who);
+	return who;
+}
+
+static int
+status(envid_t who)
+{
+	int r, status;
+
+	if ((r = sys_env_wait(who, &status)) < 0)
+		panic("sys_env_wait: %e", r);
+	return status;
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t who;
+	int r;
+
+	sys_env_keep_zombies(1);
+	if ((r = sys_page_alloc(0, (void *) WORD, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+
+	if ((r = sys_futex_wait((uint32_t *) ((char *) WORD + 1), 0, 0)) != -E_INVAL)
+		panic("misaligned wait returned %e", r);
+	if ((r = sys_futex_wait(WORD, 1, 0)) != -E_AGAIN)
+		panic("wait on a changed word returned %e", r);
+	if ((r = sys_futex_wait(WORD, 0, 50)) != -E_TIMEOUT)
+		panic("wait with a timeout returned %e", r);
+	if ((r = sys_futex_wake(WORD, 1)) != 0)
+		panic("wake with no waiters woke %d", r);
+
+	who = fork_waiter();
+	*WORD = 1;
+	if ((r = sys_futex_wake(WORD, NENV)) != 1)
+		panic("wake woke %d waiters, not 1", r);
+	if ((r = status(who)) != 0)
+		panic("woken waiter got %e", r);
+
+	*WORD = 0;
+	who = fork_waiter();
+	if ((r = sys_page_unmap(0, (void *) WORD)) < 0)
+		panic("sys_page_unmap: %e", r);
+	if ((r = status(who)) != 0)
+		panic("waiter on an unmapped page got %e", r);
+
+	cprintf("testfutex: OK\n");
+}
@@ -0,0 +1,117 @@
+// Check readv, writev, preadv and pwritev on a file and a pipe: the
+// buffers are filled and drained in order whatever their sizes, and the
+// positioned calls leave the file position alone.
+
+#include <inc/lib.h>
+
+#define LEN	(3 * PGSIZE + 300)
+
+static uint8_t data[LEN], got[LEN];
+
+static void
+fill(uint8_t *p, size_t n, int seed)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		p[i] = (i * 31 + seed + i / 257) & 0xFF;
+}
+
+// Split buf[0..LEN) into three pieces of 10, 0 and the rest bytes, or,
+// if 'big', 2 pages + 1 and the rest.
+static int
+split(struct iovec *iov, uint8_t *buf, bool big)
+{
+	size_t first = big ? 2 * PGSIZE + 1 : 10;
+
+	iov[0].iov_base = buf;
+	iov[0].iov_len = first;
+	iov[1].iov_base = buf + first;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = buf + first;
+	iov[2].iov_len = LEN - first;
+	return 3;
+}
+
+static void
+check_got(const char *what)
+{
+	if (memcmp(got, data, LEN) != 0)
+		panic("%s got the wrong data", what);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct iovec iov[3];
+	struct Stat st;
+	uint8_t patch[100];
+	int fd, p[2], n, r;
+	envid_t who;
+
+	fill(data, LEN, 1);
+	if ((fd = open("/iovtest", O_RDWR|O_CREAT|O_TRUNC)) < 0)
+		panic("open: %e", fd);
+	n = split(iov, data, 0);
+	if ((r = writev(fd, iov, n)) != LEN)
+		panic("writev wrote %e", r);
+	if ((r = fstat(fd, &st)) < 0 || st.st_size != LEN)
+		panic("file is %d bytes after writev", st.st_size);
+
+	seek(fd, 0);
+	n = split(iov, got, 1);
+	if ((r = readv(fd, iov, n)) != LEN)
+		panic("readv read %e", r);
+	check_got("readv");
+
+	// Positioned calls, with the position parked at 5.
+	seek(fd, 5);
+	fill(patch, sizeof patch, 2);
+	memcpy(data + PGSIZE - 50, patch, sizeof patch);
+	iov[0].iov_base = patch;
+	iov[0].iov_len = 50;
+	iov[1].iov_base = patch + 50;
+	iov[1].iov_len = 50;
+	if ((r = pwritev(fd, iov, 2, PGSIZE - 50)) != sizeof patch)
+		panic("pwritev wrote %e", r);
+	n = split(iov, got, 0);
+	if ((r = preadv(fd, iov, n, 0)) != LEN)
+		panic("preadv read %e", r);
+	check_got("preadv after pwritev");
+	if ((r = read(fd, got, 1)) != 1 || got[0] != data[5])
+		panic("preadv/pwritev moved the file position");
+
+	if ((r = readv(fd, iov, -1)) != -E_INVAL)
+		panic("readv of -1 buffers returned %e", r);
+	if ((r = writev(fd, iov, IOV_MAX + 1)) != -E_INVAL)
+		panic("writev of too many buffers returned %e", r);
+	close(fd);
+	remove("/iovtest");
+
+	// Through a pipe, which has native dev_readv and dev_writev.
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		close(p[0]);
+		n = split(iov, data, 1);
+		if ((r = writev(p[1], iov, n)) != LEN)
+			panic("writev to a pipe wrote %e", r);
+		exit();
+	}
+	close(p[1]);
+	memset(got, 0, LEN);
+	for (r = 0; r < LEN; r += n) {
+		iov[0].iov_base = got + r;
+		iov[0].iov_len = MIN(10, LEN - r);
+		iov[1].iov_base = got + r + iov[0].iov_len;
+		iov[1].iov_len = LEN - r - iov[0].iov_len;
+		if ((n = readv(p[0], iov, 2)) <= 0)
+			panic("readv from a pipe: %e", n);
+	}
+	check_got("readv from a pipe");
+	close(p[0]);
+	wait(who);
+	cprintf("testiov: OK\n");
+}
@@ -7,6 +7,7 @@ umain(int argc, char **argv)
 	char *buf;
 	int n;
 	void *v;
+	struct MallocStats ms;
 
 	while (1) {
 		buf = readline("> ");
@@ -19,6 +20,15 @@ umain(int argc, char **argv)
 			n = strtol(buf + 7, 0, 0);
 			v = malloc(n);
 			printf("\t0x%x\n", (uintptr_t) v);
+		} else if (strcmp(buf, "stats") == 0) {
+			malloc_stats(&ms);
+			printf("\t%ld mallocs, %ld frees, %ld bytes in use\n",
+			       (long) ms.ms_nmalloc, (long) ms.ms_nfree,
+			       (long) ms.ms_inuse);
+			printf("\t%ld slab pages (%ld empty), %ld run pages, "
+			       "%ld map calls\n", (long) ms.ms_slabpages,
+			       (long) ms.ms_emptyslabs, (long) ms.ms_runpages,
+			       (long) ms.ms_mapcalls);
 		} else
 			printf("?unknown command\n");
 	}
@@ -0,0 +1,93 @@
+// Check notification bits: they merge while pending, sys_notify_take
+// clears only the bits asked for, waits time out, and a notification
+// wakes an env blocked in notify_wait or ipc_recv_notify, as IPC does.
+
+#include <inc/lib.h>
+
+static void
+await_blocked(envid_t who)
+{
+	while (envs[ENVX(who)].env_status != ENV_NOT_RUNNABLE)
+		sys_yield();
+}
+
+static int
+status(envid_t who)
+{
+	int r, status;
+
+	if ((r = sys_env_wait(who, &status)) < 0)
+		panic("sys_env_wait: %e", r);
+	return status;
+}
+
+// Fork a child that waits with ipc_recv_notify for bit 0 and exits with
+// the IPC value, or 100 plus the bits.
+static envid_t
+fork_receiver(void)
+{
+	uint64_t bits;
+	envid_t who;
+	int32_t v;
+
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		v = ipc_recv_notify(0, 0, 0, 0, 0x1, &bits);
+		exit_with(bits ? 100 + (int) bits : v);
+	}
+	await_blocked(who);
+	return who;
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t self = thisenv->env_id, who;
+	uint64_t bits;
+	int r;
+
+	sys_env_keep_zombies(1);
+
+	sys_notify(self, 0x5);
+	sys_notify(self, 0x2);
+	if ((r = sys_notify_wait(0x4, 0, 0, 0, 0)) != 1)
+		panic("wait with a bit pending returned %e", r);
+	if ((bits = sys_notify_take(0x3)) != 0x3)
+		panic("took %lx, not 0x3", (long) bits);
+	if ((bits = sys_notify_take(~0ULL)) != 0x4)
+		panic("took %lx, not 0x4", (long) bits);
+	if ((bits = sys_notify_take(~0ULL)) != 0)
+		panic("took %lx after taking everything", (long) bits);
+
+	if ((r = sys_notify_wait(0, 0, 0, 0, 0)) != -E_INVAL)
+		panic("wait for nothing returned %e", r);
+	if ((r = sys_notify_wait(0x1, 0, 0, 0, 30)) != -E_TIMEOUT)
+		panic("wait with a timeout returned %e", r);
+
+	// Only bits in the waiter's mask wake it, and it takes only those.
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0)
+		exit_with((int) notify_wait(0x10));
+	await_blocked(who);
+	sys_notify(who, 0x20);
+	sys_yield();
+	if (envs[ENVX(who)].env_status != ENV_NOT_RUNNABLE)
+		panic("a bit outside the mask woke the waiter");
+	sys_notify(who, 0x30);
+	if ((r = status(who)) != 0x10)
+		panic("notify_wait returned %x, not 0x10", r);
+
+	who = fork_receiver();
+	ipc_send(who, 77, 0, 0);
+	if ((r = status(who)) != 77)
+		panic("ipc_recv_notify got %d, not the IPC value 77", r);
+
+	who = fork_receiver();
+	sys_notify(who, 0x1);
+	if ((r = status(who)) != 101)
+		panic("ipc_recv_notify got %d, not bit 0", r);
+
+	cprintf("testnotify: OK\n");
+}
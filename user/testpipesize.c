@@ -0,0 +1,104 @@
+// Check pipes of several ring sizes: pipesize rounds up to a power of
+// two pages and rejects sizes that don't fit, a writer fills the ring
+// exactly before blocking, and data survives many wraps in odd-sized
+// pieces.
+
+#include <inc/lib.h>
+
+#define NBYTES	(100 * 1024)
+
+static uint8_t buf[2 * (FDDATAPAGES / 2) * PGSIZE];
+
+static uint8_t
+pattern(size_t i)
+{
+	return (i * 7 + i / 251) & 0xFF;
+}
+
+// Make a pipe with a ring of at least 'size' bytes and check it holds
+// exactly 'want' bytes before the writer blocks.
+static void
+check_capacity(size_t size, size_t want)
+{
+	struct Stat st;
+	envid_t who;
+	int p[2], r;
+
+	if ((r = pipesize(p, size)) < 0)
+		panic("pipesize(%d): %e", size, r);
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		close(p[0]);
+		write(p[1], buf, 2 * want);
+		exit();
+	}
+	close(p[1]);
+	while (envs[ENVX(who)].env_status != ENV_NOT_RUNNABLE)
+		sys_yield();
+	if ((r = fstat(p[0], &st)) < 0)
+		panic("fstat: %e", r);
+	if (st.st_size != want)
+		panic("pipesize(%d) holds %d bytes, not %d", size, st.st_size,
+		      want);
+	close(p[0]);
+	wait(who);
+}
+
+// Send NBYTES through a pipe of 'size' bytes, writing 1000 and reading
+// 777 bytes at a time.
+static void
+check_transfer(size_t size)
+{
+	size_t i, n, got;
+	envid_t who;
+	int p[2], r;
+
+	if ((r = pipesize(p, size)) < 0)
+		panic("pipesize(%d): %e", size, r);
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		close(p[0]);
+		for (i = 0; i < NBYTES; i += n) {
+			n = MIN(1000, NBYTES - i);
+			for (got = 0; got < n; got++)
+				buf[got] = pattern(i + got);
+			if ((r = write(p[1], buf, n)) != n)
+				panic("write: %e", r);
+		}
+		exit();
+	}
+	close(p[1]);
+	for (i = 0; i < NBYTES; i += n) {
+		if ((r = readn(p[0], buf, MIN(777, NBYTES - i))) <= 0)
+			panic("read at %d: %e", i, r);
+		n = r;
+		for (got = 0; got < n; got++)
+			if (buf[got] != pattern(i + got))
+				panic("byte %d is %02x, not %02x", i + got,
+				      buf[got], pattern(i + got));
+	}
+	if ((r = read(p[0], buf, 1)) != 0)
+		panic("read past the end returned %d", r);
+	close(p[0]);
+	wait(who);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int p[2], r;
+
+	if ((r = pipesize(p, (FDDATAPAGES / 2) * PGSIZE + 1)) != -E_INVAL)
+		panic("oversized pipesize returned %e", r);
+
+	check_capacity(1, PGSIZE);
+	check_capacity(3 * PGSIZE, 4 * PGSIZE);
+	check_capacity((FDDATAPAGES / 2) * PGSIZE, (FDDATAPAGES / 2) * PGSIZE);
+
+	check_transfer(1);
+	check_transfer(4 * PGSIZE);
+	check_transfer((FDDATAPAGES / 2) * PGSIZE);
+	cprintf("testpipesize: OK\n");
+}
@@ -0,0 +1,61 @@
+// Check read-ahead: scanning a file nothing has read since boot takes
+// far fewer cache misses than it has blocks, and the blocks read ahead
+// hold the same data as a second, fully cached scan.
+
+#include <inc/lib.h>
+
+// A program on the disk image that the other tests never run.
+#define PROG	"/lsfd"
+
+static uint8_t blk[BLKSIZE];
+
+// Read 'path' block by block and return a checksum and block count.
+static uint32_t
+scan(const char *path, uint32_t *nblocks)
+{
+	uint32_t sum = 0;
+	int fd, n, i;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		panic("open %s: %e", path, fd);
+	*nblocks = 0;
+	while ((n = readn(fd, blk, BLKSIZE)) > 0) {
+		for (i = 0; i < n; i++)
+			sum = sum * 31 + blk[i];
+		(*nblocks)++;
+	}
+	if (n < 0)
+		panic("read %s: %e", path, n);
+	close(fd);
+	return sum;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct CacheStat before, after;
+	uint32_t cold, warm, nblocks, misses;
+	int r;
+
+	if ((r = fs_cachestat(&before)) < 0)
+		panic("fs_cachestat: %e", r);
+	cold = scan(PROG, &nblocks);
+	fs_cachestat(&after);
+	warm = scan(PROG, &nblocks);
+	if (cold != warm)
+		panic("read-ahead and cached scans of %s differ", PROG);
+
+	misses = after.cs_misses - before.cs_misses;
+	if (misses == 0) {
+		cprintf("testreadahead: %s was cached already, skipping\n",
+			PROG);
+		return;
+	}
+	if (after.cs_readahead == before.cs_readahead)
+		panic("scanning %d blocks read nothing ahead", nblocks);
+	if (misses > nblocks / 2)
+		panic("scanning %d blocks missed %d times", nblocks, misses);
+	cprintf("testreadahead: %d blocks, %d misses, %d read ahead: OK\n",
+		nblocks, misses,
+		(int) (after.cs_readahead - before.cs_readahead));
+}
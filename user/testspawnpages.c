@@ -0,0 +1,58 @@
+// Check that programs the file server maps straight from its block cache
+// (sys_spawn_from_pages) get private copies of their writable data: each
+// child scribbles on a whole data page and a later child must still see
+// the page as it is in the file.
+
+#include <inc/lib.h>
+
+#define NSPAWN	3
+
+// Initialized, so it is in the file, and big enough to hold a whole
+// page that the kernel maps copy-on-write rather than copies.
+static char data[3 * PGSIZE] = { [PGSIZE + 5] = 42, [2 * PGSIZE] = 1 };
+static const char text[] = "read-only";
+
+static void
+child(void)
+{
+	char *p = &data[PGSIZE + 5];
+
+	if (*p != 42)
+		panic("child sees %d, not 42: a sibling's write leaked", *p);
+	if (uvpt[PGNUM(text)] & PTE_W)
+		panic("read-only data is writable");
+	*p = 99;
+	write(1, "ok\n", 3);
+}
+
+void
+umain(int argc, char **argv)
+{
+	char buf[3 * NSPAWN + 1];
+	envid_t who;
+	int p[2], i, n, r;
+
+	if (argc > 1) {
+		child();
+		return;
+	}
+
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	dup(p[1], 1);
+	close(p[1]);
+	for (i = 0; i < NSPAWN; i++) {
+		if ((who = spawnl("/testspawnpages", "testspawnpages",
+				  "child", 0)) < 0)
+			panic("spawn: %e", who);
+		wait(who);
+	}
+	close(1);
+	n = readn(p[0], buf, sizeof buf - 1);
+	buf[MAX(n, 0)] = 0;
+	if (n != 3 * NSPAWN)
+		panic("only got \"%s\" from %d children", buf, NSPAWN);
+	if (data[PGSIZE + 5] != 42)
+		panic("the parent's copy changed");
+	cprintf("testspawnpages: OK\n");
+}
@@ -0,0 +1,128 @@
+// Check splice between files and into a pipe, and that the file server
+// keeps files coherent when their blocks have been lent out: after a
+// splice or a bulk read, writes to either file must show up in that file
+// only, before and after the blocks are written back.
+
+#include <inc/lib.h>
+
+#define LEN	(5 * PGSIZE + 123)
+
+static uint8_t buf[LEN], got[LEN];
+
+static void
+fill(uint8_t *p, size_t n, int seed)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		p[i] = (i * 13 + seed + i / 509) & 0xFF;
+}
+
+static int
+xopen(const char *path, int mode)
+{
+	int fd;
+
+	if ((fd = open(path, mode)) < 0)
+		panic("open %s: %e", path, fd);
+	return fd;
+}
+
+// Check that 'fd' holds 'want' (LEN bytes).
+static void
+check_file(int fd, const uint8_t *want, const char *what)
+{
+	size_t i;
+	int r;
+
+	seek(fd, 0);
+	if ((r = readn(fd, got, LEN)) != LEN)
+		panic("%s: read %e", what, r);
+	for (i = 0; i < LEN; i++)
+		if (got[i] != want[i])
+			panic("%s: byte %d is %02x, not %02x", what, i, got[i],
+			      want[i]);
+}
+
+// Write 'n' bytes of 'p' to 'fd' at 'off', and the same to 'shadow'.
+static void
+patch(int fd, uint8_t *shadow, size_t off, const uint8_t *p, size_t n)
+{
+	int r;
+
+	seek(fd, off);
+	if ((r = write(fd, p, n)) != n)
+		panic("write: %e", r);
+	memcpy(shadow + off, p, n);
+}
+
+void
+umain(int argc, char **argv)
+{
+	static uint8_t a[LEN], b[LEN], patchbuf[2 * PGSIZE];
+	int fa, fb, p[2], r;
+	envid_t who;
+
+	fill(a, LEN, 1);
+	fa = xopen("/splice_a", O_RDWR|O_CREAT|O_TRUNC);
+	if ((r = write(fa, a, LEN)) != LEN)
+		panic("write /splice_a: %e", r);
+	fsync(fa);
+
+	// File to file: the blocks go over as pages from the cache.
+	fb = xopen("/splice_b", O_RDWR|O_CREAT|O_TRUNC);
+	seek(fa, 0);
+	if ((r = splice(fa, fb, LEN)) != LEN)
+		panic("splice file to file moved %e", r);
+	memcpy(b, a, LEN);
+	check_file(fb, b, "spliced copy");
+
+	// Writes to either side stay on that side.
+	fill(patchbuf, sizeof patchbuf, 2);
+	patch(fa, a, PGSIZE, patchbuf, PGSIZE);
+	patch(fb, b, 2 * PGSIZE + 7, patchbuf, 100);
+	check_file(fa, a, "source after writes");
+	check_file(fb, b, "copy after writes");
+	fsync(fa);
+	fsync(fb);
+	check_file(fa, a, "source after fsync");
+	check_file(fb, b, "copy after fsync");
+
+	// A bulk read, then a write over what it read, then a reread.
+	seek(fa, 0);
+	if ((r = readn(fa, buf, 3 * PGSIZE)) != 3 * PGSIZE)
+		panic("bulk read: %e", r);
+	if (memcmp(buf, a, 3 * PGSIZE) != 0)
+		panic("bulk read got the wrong data");
+	fill(patchbuf, sizeof patchbuf, 3);
+	patch(fa, a, 0, patchbuf, 2 * PGSIZE);
+	check_file(fa, a, "source after bulk read and write");
+	fsync(fa);
+	check_file(fa, a, "source after bulk read, write and fsync");
+
+	// File to pipe.
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		close(p[1]);
+		if ((r = readn(p[0], got, LEN)) != LEN)
+			panic("pipe end got %e", r);
+		if (memcmp(got, a, LEN) != 0)
+			panic("pipe end got the wrong data");
+		exit();
+	}
+	close(p[0]);
+	seek(fa, 0);
+	if ((r = splice(fa, p[1], LEN)) != LEN)
+		panic("splice file to pipe moved %e", r);
+	close(p[1]);
+	wait(who);
+
+	close(fa);
+	close(fb);
+	remove("/splice_a");
+	remove("/splice_b");
+	cprintf("testsplice: OK\n");
+}
@@ -0,0 +1,85 @@
+// Check the system call ring: results land in each entry, calls that
+// may not be queued fail, a failed SYSRING_LINK entry cancels the rest
+// of its chain, SYSRING_ARG passes results along, and the ring wraps.
+
+#include <inc/lib.h>
+
+#define A	((char *) UTEMP)
+#define B	((char *) UTEMP + PGSIZE)
+#define C	((char *) UTEMP + 2 * PGSIZE)
+
+static struct Sysring ring __attribute__((aligned(PGSIZE)));
+
+static void
+push(int num, uint32_t flags, uint64_t a1, uint64_t a2, uint64_t a3,
+     uint64_t a4, uint64_t a5)
+{
+	struct SysringEntry *ent = &ring.sr_ent[ring.sr_tail % SYSRING_SIZE];
+
+	ent->se_num = num;
+	ent->se_flags = flags;
+	ent->se_args[0] = a1;
+	ent->se_args[1] = a2;
+	ent->se_args[2] = a3;
+	ent->se_args[3] = a4;
+	ent->se_args[4] = a5;
+	ent->se_result = 1;
+	ring.sr_tail++;
+}
+
+static void
+expect(uint32_t i, int64_t want)
+{
+	int64_t got = ring.sr_ent[i % SYSRING_SIZE].se_result;
+
+	if (got != want)
+		panic("entry %d returned %ld, not %ld", i, (long) got,
+		      (long) want);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int perm = PTE_P|PTE_U|PTE_W;
+	uint32_t i;
+	int r;
+
+	push(SYS_getenvid, 0, 0, 0, 0, 0, 0);
+	push(SYS_exofork, 0, 0, 0, 0, 0, 0);
+	push(SYS_page_alloc, SYSRING_LINK, 0, (uint64_t) A, perm, 0, 0);
+	push(SYS_page_map, 0, 0, (uint64_t) A, 0, (uint64_t) B, PTE_P|PTE_U);
+	push(SYS_page_alloc, SYSRING_LINK, 0, (uint64_t) C, 0x1000000, 0, 0);
+	push(SYS_page_map, SYSRING_LINK, 0, (uint64_t) C, 0, (uint64_t) C, perm);
+	push(SYS_page_unmap, 0, 0, (uint64_t) B, 0, 0, 0);
+	push(SYS_getenvid, 0, 0, 0, 0, 0, 0);
+	push(SYS_page_unmap, SYSRING_ARG(1), 12345, (uint64_t) A, 0, 0, 0);
+	if ((r = sys_ring_enter(&ring)) != 9)
+		panic("sys_ring_enter ran %d entries, not 9", r);
+
+	expect(0, thisenv->env_id);
+	expect(1, -E_INVAL);
+	expect(2, 0);
+	expect(3, 0);
+	expect(4, -E_INVAL);
+	expect(5, -E_CANCELED);
+	expect(6, -E_CANCELED);
+	expect(7, thisenv->env_id);
+	expect(8, 0);
+	if ((uvpt[PGNUM(A)] & PTE_P) || !(uvpt[PGNUM(B)] & PTE_P))
+		panic("the ring left the wrong pages mapped");
+
+	// A full ring's worth, which wraps around the end of sr_ent.
+	for (i = 0; i < SYSRING_SIZE; i++)
+		push(SYS_getenvid, 0, 0, 0, 0, 0, 0);
+	if ((r = sys_ring_enter(&ring)) != SYSRING_SIZE)
+		panic("sys_ring_enter ran %d entries, not a ring's worth", r);
+	for (i = ring.sr_head - SYSRING_SIZE; i != ring.sr_head; i++)
+		expect(i, thisenv->env_id);
+
+	// The library ring drains itself when full.
+	for (i = 0; i < 3 * SYSRING_SIZE; i++)
+		sysring_push(SYS_getenvid, 0, 0, 0, 0, 0, 0);
+	if ((r = sysring_submit()) != 0)
+		panic("sysring_submit: %e", r);
+	cprintf("testsysring: OK\n");
+}
@@ -0,0 +1,88 @@
+// Check that spawn_template starts each child with its own arguments,
+// makes one template per program, and makes a new one once the
+// program's file has changed.
+
+#include <inc/lib.h>
+
+#define PROG	"/tmplecho"
+
+// Copy /echo to PROG, which bumps PROG's version.
+static void
+copy_echo(void)
+{
+	char buf[512];
+	int rfd, wfd, n, r;
+
+	if ((rfd = open("/echo", O_RDONLY)) < 0)
+		panic("open /echo: %e", rfd);
+	if ((wfd = open(PROG, O_WRONLY|O_CREAT|O_TRUNC)) < 0)
+		panic("open %s: %e", PROG, wfd);
+	while ((n = read(rfd, buf, sizeof buf)) > 0)
+		if ((r = write(wfd, buf, n)) != n)
+			panic("write %s: %e", PROG, r);
+	if (n < 0)
+		panic("read /echo: %e", n);
+	close(rfd);
+	close(wfd);
+}
+
+// Spawn PROG from its template with 'arg' and wait for it.
+static void
+run(const char *arg)
+{
+	const char *argv[] = { PROG, arg, 0 };
+	envid_t child;
+
+	if ((child = spawn_template(PROG, argv)) < 0)
+		panic("spawn_template: %e", child);
+	wait(child);
+}
+
+// Return how many templates this env owns, and the last one's envid.
+static int
+templates(envid_t *last)
+{
+	int i, n = 0;
+
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_status == ENV_TEMPLATE
+		    && envs[i].env_parent_id == thisenv->env_id) {
+			*last = envs[i].env_id;
+			n++;
+		}
+	return n;
+}
+
+void
+umain(int argc, char **argv)
+{
+	char buf[32];
+	envid_t first, second;
+	int p[2], n, r;
+
+	if ((r = spawn_template_init()) < 0)
+		panic("spawn_template_init: %e", r);
+	copy_echo();
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	dup(p[1], 1);
+	close(p[1]);
+
+	run("one");
+	run("two");
+	if (templates(&first) != 1)
+		panic("two spawns of %s made %d templates", PROG,
+		      templates(&first));
+
+	copy_echo();
+	run("three");
+	if (templates(&second) != 1 || second == first)
+		panic("rewriting %s did not replace its template", PROG);
+
+	close(1);
+	n = readn(p[0], buf, sizeof buf - 1);
+	buf[MAX(n, 0)] = 0;
+	if (strcmp(buf, "one\ntwo\nthree\n") != 0)
+		panic("children wrote \"%s\"", buf);
+	cprintf("testtemplate: OK\n");
+}
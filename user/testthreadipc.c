@@ -0,0 +1,81 @@
+// Check that several green threads can each have a thread_ipc_call
+// outstanding at the same server, and that every reply reaches the
+// thread whose request page it carries, although the server answers
+// in the opposite order.
+
+#include <inc/lib.h>
+
+#define NCLIENT	4
+
+static envid_t server;
+static volatile uint32_t ndone;
+static uint8_t reqbuf[NCLIENT][PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static void
+serve(void)
+{
+	envid_t whom[NCLIENT];
+	int32_t value[NCLIENT];
+	uint32_t *pg;
+	int i, perm;
+
+	// Take every request before answering any.
+	for (i = 0; i < NCLIENT; i++) {
+		value[i] = ipc_recv(&whom[i], UTEMP + i * PGSIZE, &perm);
+		if (!perm)
+			panic("request %d came without its page", i);
+	}
+	for (i = NCLIENT - 1; i >= 0; i--) {
+		pg = (uint32_t *) (UTEMP + i * PGSIZE);
+		pg[0] = value[i] * 100 + 7;
+		ipc_send(whom[i], value[i] + 1000, pg, PTE_P|PTE_U|PTE_W);
+		sys_page_unmap(0, pg);
+	}
+}
+
+static void
+client(uint64_t id)
+{
+	uint32_t *req = (uint32_t *) reqbuf[id];
+	int32_t r;
+
+	req[0] = id;
+	r = thread_ipc_call(server, id, req, 0);
+	if (r != (int32_t) id + 1000)
+		panic("client %d got reply %d", (int) id, r);
+	if (req[0] != id * 100 + 7)
+		panic("client %d got page %d", (int) id, req[0]);
+	ndone++;
+}
+
+static void
+tmain(uint64_t arg)
+{
+	uint64_t i;
+	int r;
+
+	for (i = 0; i < NCLIENT; i++)
+		if ((r = thread_create(0, "client", client, i)) < 0)
+			panic("thread_create: %e", r);
+	// Wait without counting as ready, so that the clients block in
+	// the kernel for their replies instead of spinning.
+	while (ndone < NCLIENT)
+		thread_wait(&ndone, ndone, (uint32_t) ~0);
+	cprintf("testthreadipc: OK\n");
+}
+
+void
+umain(int argc, char **argv)
+{
+	if ((server = fork()) < 0)
+		panic("fork: %e", server);
+	if (server == 0) {
+		serve();
+		return;
+	}
+
+	thread_init();
+	thread_create(0, "main", tmain, 0);
+	thread_yield();
+	// never coming here!
+}
@@ -0,0 +1,91 @@
+// Check sys_env_wait and zombies: exit statuses come back whether the
+// child exits before or after the wait, only to envs that keep zombies,
+// only to ancestors, and turning zombies off reaps the ones left.
+
+#include <inc/lib.h>
+
+static envid_t
+fork_exit(int status, int delay)
+{
+	envid_t who;
+
+	if ((who = fork()) < 0)
+		panic("fork: %e", who);
+	if (who == 0) {
+		while (delay-- > 0)
+			sys_yield();
+		exit_with(status);
+	}
+	return who;
+}
+
+static void
+await_zombie(envid_t who)
+{
+	while (envs[ENVX(who)].env_status != ENV_ZOMBIE)
+		sys_yield();
+}
+
+static int
+status(envid_t who)
+{
+	int r, status;
+
+	if ((r = sys_env_wait(who, &status)) < 0)
+		panic("sys_env_wait: %e", r);
+	return status;
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t who, sib;
+	int r, st;
+
+	// By default an exited child is simply gone.
+	who = fork_exit(5, 0);
+	while (envs[ENVX(who)].env_id == who
+	       && envs[ENVX(who)].env_status != ENV_FREE)
+		sys_yield();
+	if ((r = sys_env_wait(who, &st)) != -E_BAD_ENV)
+		panic("waiting for a reaped child returned %e", r);
+
+	sys_env_keep_zombies(1);
+	if ((r = sys_env_wait(thisenv->env_id, &st)) != -E_INVAL)
+		panic("waiting for myself returned %e", r);
+
+	who = fork_exit(7, 0);
+	await_zombie(who);
+	if ((r = status(who)) != 7)
+		panic("zombie reported %d, not 7", r);
+	if ((r = sys_env_wait(who, &st)) != -E_BAD_ENV)
+		panic("waiting twice returned %e", r);
+
+	who = fork_exit(3, 20);
+	if ((r = status(who)) != 3)
+		panic("waited-for child reported %d, not 3", r);
+
+	who = fork_exit(0, 1000);
+	sys_env_destroy(who);
+	if ((r = status(who)) != -1)
+		panic("destroyed child reported %d, not -1", r);
+
+	// A sibling is no ancestor.
+	who = fork_exit(0, 50);
+	if ((sib = fork()) < 0)
+		panic("fork: %e", sib);
+	if (sib == 0)
+		exit_with(sys_env_wait(who, &st));
+	if ((r = status(sib)) != -E_BAD_ENV)
+		panic("a sibling's sys_env_wait returned %e", r);
+	status(who);
+
+	who = fork_exit(9, 0);
+	await_zombie(who);
+	sys_env_keep_zombies(0);
+	if (envs[ENVX(who)].env_id == who
+	    && envs[ENVX(who)].env_status == ENV_ZOMBIE)
+		panic("turning zombies off left one behind");
+
+	cprintf("testwait: OK\n");
+}
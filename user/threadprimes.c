@@ -0,0 +1,97 @@
+// Count the primes below a limit with a pool of sfork'd threads.
+// Usage: threadprimes [nthreads [limit]]
+//
+// The threads take chunks of the range from a shared counter, so the
+// work spreads over however many CPUs there are.
+
+#include <inc/lib.h>
+
+#define CHUNK		1000
+#define MAXTHREADS	32
+
+static struct Mutex lock;
+static struct Cond start;
+static bool go;
+static uint32_t next;		// First number not yet handed out
+static uint32_t limit = 200000;
+static uint32_t total;		// Primes found by all threads
+
+static bool
+isprime(uint32_t n)
+{
+	uint32_t d;
+
+	if (n < 2)
+		return 0;
+	for (d = 2; d * d <= n; d++)
+		if (n % d == 0)
+			return 0;
+	return 1;
+}
+
+static int
+counter(void *arg)
+{
+	uint32_t lo, hi, n, count = 0;
+
+	mutex_lock(&lock);
+	while (!go)
+		cond_wait(&start, &lock);
+	mutex_unlock(&lock);
+
+	while (1) {
+		mutex_lock(&lock);
+		lo = next;
+		next = MIN(next + CHUNK, limit);
+		hi = next;
+		mutex_unlock(&lock);
+		if (lo == hi)
+			break;
+		for (n = lo; n < hi; n++)
+			count += isprime(n);
+	}
+
+	mutex_lock(&lock);
+	total += count;
+	mutex_unlock(&lock);
+	return count;
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t tids[MAXTHREADS];
+	int nthreads = 4, i, r, count, sum = 0;
+	uint64_t t0;
+
+	if (argc > 1)
+		nthreads = strtol(argv[1], 0, 0);
+	if (nthreads < 1 || nthreads > MAXTHREADS)
+		panic("usage: threadprimes [nthreads [limit]], nthreads <= %d",
+		      MAXTHREADS);
+	if (argc > 2)
+		limit = strtol(argv[2], 0, 0);
+
+	mutex_init(&lock);
+	cond_init(&start);
+	for (i = 0; i < nthreads; i++)
+		if ((r = sthread_create(&tids[i], counter, 0)) < 0)
+			panic("sthread_create: %e", r);
+
+	t0 = clock_ns();
+	mutex_lock(&lock);
+	go = 1;
+	cond_broadcast(&start);
+	mutex_unlock(&lock);
+
+	for (i = 0; i < nthreads; i++) {
+		if ((r = sthread_join(tids[i], &count)) < 0)
+			panic("sthread_join: %e", r);
+		sum += count;
+	}
+
+	cprintf("%d primes below %u with %d threads in %u ms\n",
+		sum, limit, nthreads, (unsigned) ((clock_ns() - t0) / 1000000));
+	if (sum != total)
+		panic("joined counts %d != shared total %u", sum, total);
+}
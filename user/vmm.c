@@ -19,7 +19,7 @@ static int
 map_in_guest( envid_t guest, uintptr_t gpa, size_t memsz, 
 	      int fd, size_t filesz, off_t fileoffset ) {
 	/* Your code here */
-    int i, r;
+    int i, r, r2;
     void *blk;
 
 
@@ -30,26 +30,38 @@ map_in_guest( envid_t guest, uintptr_t gpa, size_t memsz,
         fileoffset -= i;
     }
 
+    // File pages are read into a staging page at UTEMP and copied into
+    // fresh guest pages with sys_env_write, one kernel entry each.  The
+    // blank pages are batched on the sysring and cost no kernel entries
+    // of their own.
+    if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+        return r;
     for (i = 0; i < memsz; i += PGSIZE) {
         if (i >= filesz) {
-            if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
-                  return r;
-            if ((r = sys_ept_map(thisenv->env_id, UTEMP, guest, (void *)(gpa + i), __EPTE_FULL)) < 0)
-                  panic("spawn: sys_ept_map data: %e", r);
-            sys_page_unmap(0, UTEMP);
-
+            sysring_push(SYS_page_alloc, 0, 0, (uint64_t) UTEMP, PTE_P|PTE_U|PTE_W, 0, 0);
+            sysring_push(SYS_ept_map, 0, thisenv->env_id, (uint64_t) UTEMP,
+                         guest, gpa + i, __EPTE_FULL);
         } else {
-            if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
-                return r;
-            if ((r = seek(fd, fileoffset + i)) < 0)
-                return r;
-            if ((r = readn(fd, UTEMP, MIN(PGSIZE, filesz-i))) < 0)
-                return r;
-            if ((r = sys_ept_map(thisenv->env_id, UTEMP, guest, (void *)(gpa + i), __EPTE_FULL)) < 0)
-                panic("spawn: sys_ept_map data: %e", r);
-            sys_page_unmap(0, UTEMP);
+            if ((r = seek(fd, fileoffset + i)) < 0
+                || (r = readn(fd, UTEMP, MIN(PGSIZE, filesz-i))) < 0)
+                break;
+            // A file cut short still gets the page, blank.
+            if (r == 0) {
+                sysring_push(SYS_page_alloc, 0, 0, (uint64_t) UTEMP, PTE_P|PTE_U|PTE_W, 0, 0);
+                sysring_push(SYS_ept_map, 0, thisenv->env_id, (uint64_t) UTEMP,
+                             guest, gpa + i, __EPTE_FULL);
+            } else if ((r = sys_env_write(guest, gpa + i, UTEMP, r, 0)) < 0)
+                break;
         }
     }
+    // Run what is queued even after an error, so that it does not
+    // spill into a later submit.
+    sysring_push(SYS_page_unmap, 0, 0, (uint64_t) UTEMP, 0, 0, 0);
+    r2 = sysring_submit();
+    if (r < 0)
+        return r;
+    if (r2 < 0)
+        panic("map_in_guest: sys_ept_map data: %e", r2);
     return 0;
 } 
 
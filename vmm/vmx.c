@@ -244,7 +244,7 @@ void vmcs_host_init() {
 	vmcs_write64( VMCS_HOST_GDTR_BASE, xdtr_base );
 
 	vmcs_write64( VMCS_HOST_FS_BASE, 0x0 );
-	vmcs_write64( VMCS_HOST_GS_BASE, 0x0 );
+	vmcs_write64( VMCS_HOST_GS_BASE, (uint64_t) thiscpu );
 	vmcs_write64( VMCS_HOST_TR_BASE, (uint64_t) &thiscpu->cpu_ts );
 
 	uint64_t tmpl;